@@ -0,0 +1,188 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../src/avl_typed.h"
+
+/* compares the AVL tree operations at 10^6 keys(or at the number of keys given as the argument): */
+/*   recursive - the previous recursive implementation(kept here only as the reference) */
+/*   generic   - iterative insert/delete/find, compare function called through the pointer */
+/*   typed     - the same operations with the compare function inlined(AVL_TREE_DEFINE) */
+/* smaller trees are rebuilt several times, so that every run does about 10^6 operations */
+/* output: one line per operation, "tree op keys ns/op comparisons/op" */
+
+#define DEFAULT_KEYS 1000000
+
+// number of keys in the tree
+static int keys_size = DEFAULT_KEYS;
+// number of times the tree is built, searched and emptied
+static int rounds = 1;
+
+// number of compare calls made so far
+static unsigned long long comparisons = 0;
+
+// keys are stored in the pointers themselves, so that the benchmark measures the tree, not the key loads
+static inline int compare_long(const void * a, const void * b, void * context) {
+    long arg1 = (long) a, arg2 = (long) b;
+    return (arg1 > arg2) - (arg1 < arg2);
+}
+
+// the same compare function, that also counts its calls
+static inline int compare_counted(const void * a, const void * b, void * context) {
+    comparisons++;
+    return compare_long(a, b, context);
+}
+
+#define COMPARE_LONG(tree, a, b) compare_long((a), (b), NULL)
+#define COMPARE_COUNTED(tree, a, b) compare_counted((a), (b), NULL)
+AVL_TREE_DEFINE(typed, COMPARE_LONG)
+AVL_TREE_DEFINE(typed_counted, COMPARE_COUNTED)
+
+/* reference: the recursive operations, as they were before the iterative ones */
+static int old_compare(AvlTree * tree, void * a, void * b) {
+    return (*tree->compare_func)(a, b, tree->context) < 0 ? -1 : ((*tree->compare_func)(a, b, tree->context) > 0 ? 1 : 0);
+}
+
+static Node * old_find_helper(AvlTree * tree, Node * node, void * key) {
+    if(node == NULL) return NULL;
+    if(old_compare(tree, key, node->key) == -1) return old_find_helper(tree, node->left, key);
+    else if(old_compare(tree, key, node->key) == 1) return old_find_helper(tree, node->right, key);
+    else return node;
+}
+
+static Node * old_insert_helper(AvlTree * tree, Node * node, void * key) {
+    if(node == NULL) return create_node(tree, key);
+    if(old_compare(tree, key, node->key) == -1) node->left = old_insert_helper(tree, node->left, key);
+    else if(old_compare(tree, key, node->key) == 1) node->right = old_insert_helper(tree, node->right, key);
+    else return node;
+    avl_update(node);
+    int balance = avl_height(node->left) - avl_height(node->right);
+    if(balance > 1 && old_compare(tree, key, node->left->key) == -1) return avl_right_rotate(node);
+    if(balance < -1 && old_compare(tree, key, node->right->key) == 1) return avl_left_rotate(node);
+    if(balance > 1 && old_compare(tree, key, node->left->key) == 1) {
+        node->left = avl_left_rotate(node->left);
+        return avl_right_rotate(node);
+    }
+    if(balance < -1 && old_compare(tree, key, node->right->key) == -1) {
+        node->right = avl_right_rotate(node->right);
+        return avl_left_rotate(node);
+    }
+    return node;
+}
+
+static Node * old_delete_helper(AvlTree * tree, Node * root, void * key) {
+    if(root == NULL) return root;
+    if(old_compare(tree, key, root->key) == -1) root->left = old_delete_helper(tree, root->left, key);
+    else if(old_compare(tree, key, root->key) == 1) root->right = old_delete_helper(tree, root->right, key);
+    else {
+        if((root->left == NULL) || (root->right == NULL)) {
+            Node * temp = root->left ? root->left : root->right;
+            if(temp == NULL) {
+                temp = root;
+                root = NULL;
+            } else *root = *temp;
+            free_node(tree, temp);
+        } else {
+            Node * temp = root->right;
+            while(temp->left) temp = temp->left;
+            root->key = temp->key;
+            root->right = old_delete_helper(tree, root->right, temp->key);
+        }
+    }
+    if(root == NULL) return root;
+    return avl_rebalance(root);
+}
+
+static int old_insert(AvlTree * tree, void * key) {
+    if(old_find_helper(tree, tree->root, key)) return 0;
+    tree->root = old_insert_helper(tree, tree->root, key);
+    return 1;
+}
+
+static void old_delete(AvlTree * tree, void * key) {
+    if(!old_find_helper(tree, tree->root, key)) return;
+    tree->root = old_delete_helper(tree, tree->root, key);
+}
+
+static Node * old_find(AvlTree * tree, void * key) {
+    return old_find_helper(tree, tree->root, key);
+}
+
+/* benchmark driver */
+enum { RECURSIVE, GENERIC, TYPED };
+enum { INSERT, FIND, DELETE };
+
+static const char * tree_names[3] = {"recursive", "generic", "typed"};
+static const char * op_names[3] = {"insert", "find", "delete"};
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// run one operation on every key(the dispatch is outside of the loops, so that only the tree is measured)
+static void run_op(int variant, int op, int flag_counting, AvlTree * tree, long * keys) {
+    int i;
+    switch(variant * 3 + op) {
+        case RECURSIVE * 3 + INSERT: for(i = 0; i < keys_size; i++) old_insert(tree, (void *) keys[i]); break;
+        case RECURSIVE * 3 + FIND: for(i = 0; i < keys_size; i++) if(!old_find(tree, (void *) keys[i])) abort(); break;
+        case RECURSIVE * 3 + DELETE: for(i = 0; i < keys_size; i++) old_delete(tree, (void *) keys[i]); break;
+        case GENERIC * 3 + INSERT: for(i = 0; i < keys_size; i++) insert(tree, (void *) keys[i]); break;
+        case GENERIC * 3 + FIND: for(i = 0; i < keys_size; i++) if(!find_node(tree, (void *) keys[i])) abort(); break;
+        case GENERIC * 3 + DELETE: for(i = 0; i < keys_size; i++) delete(tree, (void *) keys[i]); break;
+        case TYPED * 3 + INSERT:
+            if(flag_counting) for(i = 0; i < keys_size; i++) typed_counted_insert(tree, (void *) keys[i]);
+            else for(i = 0; i < keys_size; i++) typed_insert(tree, (void *) keys[i]);
+            break;
+        case TYPED * 3 + FIND:
+            if(flag_counting) { for(i = 0; i < keys_size; i++) if(!typed_counted_find(tree, (void *) keys[i])) abort(); }
+            else for(i = 0; i < keys_size; i++) if(!typed_find(tree, (void *) keys[i])) abort();
+            break;
+        case TYPED * 3 + DELETE:
+            if(flag_counting) for(i = 0; i < keys_size; i++) typed_counted_delete(tree, (void *) keys[i]);
+            else for(i = 0; i < keys_size; i++) typed_delete(tree, (void *) keys[i]);
+            break;
+    }
+}
+
+// run all three operations once with counting(for comparisons) and once without(for time)
+static void run(int variant, long * keys) {
+    double time_ns[3] = {0, 0, 0}, ops = (double) keys_size * rounds;
+    unsigned long long cmp[3] = {0, 0, 0};
+    for(int flag_counting = 1; flag_counting >= 0; flag_counting--) {
+        AvlTree * tree = create_tree(flag_counting ? &compare_counted : &compare_long, NULL);
+        for(int round = 0; round < rounds; round++) for(int op = INSERT; op <= DELETE; op++) {
+            double start = now_ns();
+            comparisons = 0;
+            run_op(variant, op, flag_counting, tree, keys);
+            if(flag_counting) cmp[op] += comparisons;
+            else time_ns[op] += now_ns() - start;
+        }
+        if(tree->root) abort();
+        free_tree(tree);
+    }
+    for(int op = INSERT; op <= DELETE; op++)
+        printf("%-9s %-6s %d %8.1f ns/op %6.2f cmp/op\n", tree_names[variant], op_names[op], keys_size, time_ns[op] / ops, cmp[op] / ops);
+}
+
+int main(int argc, char ** argv) {
+    long * keys;
+    if(argc > 1 && atoi(argv[1]) > 0)
+        keys_size = atoi(argv[1]);
+    rounds = (keys_size < DEFAULT_KEYS) ? DEFAULT_KEYS / keys_size : 1;
+    keys = (long *) malloc(keys_size * sizeof(long));
+    srand(42);
+    // distinct keys in random order
+    for(int i = 0; i < keys_size; i++)
+        keys[i] = i + 1; // NULL is not a valid key
+    for(int i = keys_size - 1; i > 0; i--) {
+        int j = ((long) rand() * RAND_MAX + rand()) % (i + 1);
+        long tmp = keys[i];
+        keys[i] = keys[j];
+        keys[j] = tmp;
+    }
+    for(int variant = RECURSIVE; variant <= TYPED; variant++)
+        run(variant, keys);
+    free(keys);
+    return 0;
+}
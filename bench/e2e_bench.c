@@ -0,0 +1,259 @@
+#define _GNU_SOURCE // memmem
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <limits.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/stat.h>
+
+/* end-to-end capture latency of the real daemon binary, without parcellite and GitHub: */
+/*   - the clipboard is a file, that this harness rewrites RATE times a second, */
+/*     and the daemon reads it through a generated CLIP_PIPE_SCRIPT */
+/*   - the git remote is a local bare repository, whose post-receive hook */
+/*     saves the pushed history file together with the time of the push */
+/* every copy carries a marker, so the harness can tell when it reached the history file */
+/* (polled every millisecond) and when it reached the remote */
+/* SLOW_SOURCE adds a second capture source, whose reader takes that many milliseconds every time, */
+/* to show, that the copies of the clipboard don't wait for it(see CAPTURE_SOURCES) */
+/* usage: e2e_bench.out DAEMON SRC_DIR [RATE=copies/s] [DURATION=s] [POLL_INTERVAL=s] [POLL_MIN_MS=ms] */
+/*        [FLUSH_DELAY_MS=ms] [DELAY=s] [HISTORY_MODE=text|journal] [SETTLE=s] [SLOW_SOURCE=ms] */
+/*        [KEEP=1(keep the scratch directory)] */
+/* output(tab separated): metric count p50_ms p99_ms max_ms, then copies and missed copies */
+
+// how often the history file is checked for new copies
+#define WATCH_STEP_NS 1000000L
+// upper bound for the number of copies in one run
+#define MAX_COPIES 100000
+
+// times of every copy(nanoseconds of CLOCK_REALTIME, 0 if it didn't happen)
+static long long * copied, * persisted, * pushed;
+static int copies = 0;
+// scratch directory with the repositories and the daemon's files
+static char work_dir[] = "/tmp/e2e_bench.XXXXXX";
+
+static long long now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void sleep_ns(long long ns) {
+    struct timespec ts;
+    if(ns <= 0) return;
+    ts.tv_sec = ns / 1000000000LL;
+    ts.tv_nsec = ns % 1000000000LL;
+    nanosleep(&ts, NULL);
+}
+
+// get the value of optional NAME=value argument(or the default value)
+static char * get_option(int argc, char ** argv, char * name, char * default_value) {
+    size_t name_len = strlen(name);
+    for(int i = 3; i < argc; i++)
+        if(!strncmp(argv[i], name, name_len) && argv[i][name_len] == '=')
+            return argv[i] + name_len + 1;
+    return default_value;
+}
+
+// run a shell command and stop the harness if it fails
+static void shell(const char * format, ...) {
+    char command[4096];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(command, sizeof(command), format, args);
+    va_end(args);
+    if(system(command)) {
+        fprintf(stderr, "failed: %s\n", command);
+        exit(1);
+    }
+}
+
+// read the whole file(NULL if it doesn't exist)
+static char * read_file(const char * file_name, size_t * len) {
+    FILE * fp = fopen(file_name, "r");
+    char * data;
+    long size;
+    if(!fp) return NULL;
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    rewind(fp);
+    data = (char *) malloc(size + 1);
+    *len = fread(data, 1, size, fp);
+    data[*len] = '\0';
+    fclose(fp);
+    return data;
+}
+
+// set the time of every copy, whose marker is in the data(the earliest time wins)
+static void find_markers(char * data, size_t len, long long * times, long long time) {
+    char * p = data, * end = data + len;
+    int id;
+    while((p = memmem(p, end - p, "<<copy:", 7))) {
+        p += 7;
+        id = atoi(p);
+        if(id >= 0 && id < copies && (!times[id] || time < times[id]))
+            times[id] = time;
+    }
+}
+
+// put the copy on the fake clipboard(written aside and renamed, so the reader never sees half of it)
+static void copy(const char * clipboard, int id) {
+    char tmp_file[256];
+    FILE * fp;
+    snprintf(tmp_file, sizeof(tmp_file), "%s.tmp", clipboard);
+    fp = fopen(tmp_file, "w");
+    // parcellite prints '\n' first(the reader drops it, like _read_parsellite_.sh), the rest looks like a small multi-line copy
+    fprintf(fp, "\n<<copy:%06d>> скопированный текст\nвторая строка %d\n", id, rand());
+    fclose(fp);
+    rename(tmp_file, clipboard);
+}
+
+// print p50, p99 and max of the latencies of the copies, that reached the stage
+static void report(const char * metric, long long * times) {
+    double * latencies = (double *) malloc((copies + 1) * sizeof(double)), tmp;
+    int count = 0;
+    for(int i = 0; i < copies; i++)
+        if(times[i] && copied[i])
+            latencies[count++] = (times[i] - copied[i]) / 1e6;
+    // insertion sort is plenty for a few thousand copies
+    for(int i = 1; i < count; i++)
+        for(int j = i; j > 0 && latencies[j - 1] > latencies[j]; j--) {
+            tmp = latencies[j];
+            latencies[j] = latencies[j - 1];
+            latencies[j - 1] = tmp;
+        }
+    if(count)
+        printf("%s\t%d\t%.1f\t%.1f\t%.1f\n", metric, count, latencies[(count - 1) / 2], latencies[(int) ((count - 1) * 0.99)], latencies[count - 1]);
+    else
+        printf("%s\t0\t-\t-\t-\n", metric);
+    free(latencies);
+}
+
+int main(int argc, char ** argv) {
+    char daemon[PATH_MAX], src_dir[PATH_MAX], path[PATH_MAX + 64], history[PATH_MAX + 64], clipboard[PATH_MAX + 64];
+    char pid_file[PATH_MAX + 64], reader[PATH_MAX + 64], pushes[PATH_MAX + 64], sources[PATH_MAX + 128] = "";
+    char push_file[PATH_MAX + 64 + NAME_MAX + 2];
+    double rate;
+    int duration, poll_interval, poll_min, flush_delay, delay, settle, slow_source, missed = 0, daemon_pid = 0;
+    long long start, next_copy, end, copy_step;
+    char * data, * mode;
+    size_t len;
+    struct stat st;
+    struct timespec last_mtime = {0, 0};
+    off_t last_size = -1;
+    DIR * dir;
+    struct dirent * entry;
+    FILE * fp;
+    if(argc < 3 || !realpath(argv[1], daemon) || !realpath(argv[2], src_dir)) {
+        fprintf(stderr, "usage: %s DAEMON SRC_DIR [RATE=1] [DURATION=20] [POLL_INTERVAL=1] [POLL_MIN_MS=250] [FLUSH_DELAY_MS=1000] [DELAY=2] [HISTORY_MODE=text] [SETTLE=10] [SLOW_SOURCE=0] [KEEP=0]\n", argv[0]);
+        return 1;
+    }
+    rate = atof(get_option(argc, argv, "RATE", "1"));
+    duration = atoi(get_option(argc, argv, "DURATION", "20"));
+    poll_interval = atoi(get_option(argc, argv, "POLL_INTERVAL", "1"));
+    poll_min = atoi(get_option(argc, argv, "POLL_MIN_MS", "250"));
+    flush_delay = atoi(get_option(argc, argv, "FLUSH_DELAY_MS", "1000"));
+    delay = atoi(get_option(argc, argv, "DELAY", "2"));
+    mode = get_option(argc, argv, "HISTORY_MODE", "text");
+    settle = atoi(get_option(argc, argv, "SETTLE", "10"));
+    slow_source = atoi(get_option(argc, argv, "SLOW_SOURCE", "0"));
+    if(rate <= 0 || duration <= 0 || !mkdtemp(work_dir)) return 1;
+    copies = (int) (rate * duration);
+    if(copies > MAX_COPIES) copies = MAX_COPIES;
+    copied = (long long *) calloc(copies + 1, sizeof(long long));
+    persisted = (long long *) calloc(copies + 1, sizeof(long long));
+    pushed = (long long *) calloc(copies + 1, sizeof(long long));
+
+    /* local bare remote with a hook, that records every push, and the daemon's clone of it */
+    snprintf(pushes, sizeof(pushes), "%s/pushes", work_dir);
+    shell("cd %s && mkdir pushes && git init -q --bare remote.git && git clone -q remote.git work 2>/dev/null", work_dir);
+    shell("cd %s/work && git config user.email e2e@bench && git config user.name e2e && git commit -q --allow-empty -m init && git push -q origin HEAD 2>/dev/null", work_dir);
+    snprintf(path, sizeof(path), "%s/remote.git/hooks/post-receive", work_dir);
+    fp = fopen(path, "w");
+    fprintf(fp, "#! /bin/sh\nwhile read old new ref; do git show \"$new:history\" > %s/$(date +%%s%%N) 2>/dev/null; done\n", pushes);
+    fclose(fp);
+    chmod(path, 0755);
+    /* fake clipboard and its reader */
+    snprintf(clipboard, sizeof(clipboard), "%s/clipboard", work_dir);
+    snprintf(reader, sizeof(reader), "%s/read_clipboard.sh", work_dir);
+    fp = fopen(reader, "w");
+    fprintf(fp, "#! /bin/sh\ncat %s 2>/dev/null | sed '1{/^$/d}'\n", clipboard);
+    fclose(fp);
+    chmod(reader, 0755);
+    copy(clipboard, copies); // the marker of the initial contents is out of range
+    /* slow reader, polled as often as the clipboard(its timeout leaves it time to finish) */
+    if(slow_source > 0) {
+        snprintf(path, sizeof(path), "%s/read_slow.sh", work_dir);
+        fp = fopen(path, "w");
+        fprintf(fp, "#! /bin/sh\nsleep %d.%03d\necho slow source\n", slow_source / 1000, slow_source % 1000);
+        fclose(fp);
+        chmod(path, 0755);
+        snprintf(sources, sizeof(sources), "CAPTURE_SOURCES=slow:%s:%d:%d:%d", path, poll_min, poll_interval * 1000, slow_source + 1000);
+    }
+    /* start the daemon(it forks away and writes its pid) */
+    snprintf(history, sizeof(history), "%s/work/history", work_dir);
+    snprintf(pid_file, sizeof(pid_file), "%s/daemon_pid", work_dir);
+    shell("%s %d %s/current %s %s/unused %d %s %s/log %s/stdout %s/stderr %s/_git_synch_.sh %s/work %s/_git_clone_.sh "
+        "CAPTURE_MODE=pipe CLIP_PIPE_SCRIPT=%s POLL_INTERVAL=%d POLL_MIN_MS=%d FLUSH_DELAY_MS=%d HISTORY_MODE=%s STATS_FILE=%s/stats.json %s",
+        daemon, copies + 10, work_dir, history, work_dir, delay, pid_file, work_dir, work_dir, work_dir,
+        src_dir, work_dir, src_dir, reader, poll_interval, poll_min, flush_delay, mode, work_dir, sources);
+
+    /* copy at the given rate and watch the history file */
+    start = now_ns();
+    copy_step = (long long) (1e9 / rate);
+    next_copy = start;
+    end = start + (long long) duration * 1000000000LL + (long long) settle * 1000000000LL;
+    for(int id = 0; now_ns() < end; ) {
+        if(id < copies && now_ns() >= next_copy) {
+            copied[id] = now_ns();
+            copy(clipboard, id++);
+            next_copy += copy_step;
+        }
+        if(!stat(history, &st) && (st.st_size != last_size || st.st_mtim.tv_nsec != last_mtime.tv_nsec || st.st_mtim.tv_sec != last_mtime.tv_sec)) {
+            last_size = st.st_size;
+            last_mtime = st.st_mtim;
+            if((data = read_file(history, &len))) {
+                find_markers(data, len, persisted, now_ns());
+                free(data);
+            }
+        }
+        sleep_ns(WATCH_STEP_NS);
+    }
+
+    /* stop the daemon(it dumps its stats on the way out) */
+    if((fp = fopen(pid_file, "r"))) {
+        if(fscanf(fp, "%d", &daemon_pid) == 1 && daemon_pid > 0)
+            kill(daemon_pid, SIGTERM);
+        fclose(fp);
+    }
+    /* every push file holds the history as it was pushed, named by the time of the push */
+    if((dir = opendir(pushes))) {
+        while((entry = readdir(dir)))
+            if(entry->d_name[0] != '.') {
+                snprintf(push_file, sizeof(push_file), "%s/%s", pushes, entry->d_name);
+                if((data = read_file(push_file, &len))) {
+                    find_markers(data, len, pushed, atoll(entry->d_name));
+                    free(data);
+                }
+            }
+        closedir(dir);
+    }
+    for(int i = 0; i < copies; i++)
+        missed += copied[i] && !persisted[i];
+
+    printf("metric\tcount\tp50_ms\tp99_ms\tmax_ms\n");
+    report("copy_to_persisted", persisted);
+    report("copy_to_pushed", pushed);
+    printf("copies\t%d\nmissed\t%d\n", copies, missed);
+    // the daemon's log and stats.json stay there for a closer look
+    if(atoi(get_option(argc, argv, "KEEP", "0")))
+        printf("work_dir\t%s\n", work_dir);
+    else {
+        sleep_ns(500000000LL); // let the daemon finish its shutdown
+        shell("rm -rf %s", work_dir);
+    }
+    return 0;
+}
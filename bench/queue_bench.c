@@ -0,0 +1,477 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "../src/queue.h"
+#include "../src/history.h"
+#include "../src/journal.h"
+#include "../src/snapshot.h"
+#include "../src/trigram_index.h"
+#include "../src/logger.h"
+
+/* benchmarks the queue and the persistence paths on synthetic clipboards: */
+/*   insert_item, find_item, delete_item                - the queue itself */
+/*   insert_item(with a QUEUE_BYTES budget)             - the priority eviction */
+/*   insert_item(with the index listening), trigram_search - the substring index */
+/*   write_to_file, read_clip_history                   - the text history */
+/*   journal_append(through insert_item), journal_open  - the binary journal */
+/*   write_snapshot, load_snapshot                      - the snapshot, that a start maps */
+/*   insert_item, write_to_file(with a chunk store)     - chunking of near-identical big pastes */
+/*   log_write(a debug line per capture)                - the cost of logging in the capture loop */
+/* every clipboard size runs with 0%, 50% and 90% of the captures repeating an earlier one */
+/* output(tab separated, one line per result, so that runs of two commits can be diffed): */
+/*   suite op size bytes dup ops ns_per_op allocs_per_op mb_per_s */
+/* (the chunks suite adds a "#" line with the memory and the disk, that the chunks took, */
+/* the log suite one with the lines, that the full ring dropped) */
+/* allocs are the malloc/calloc/realloc calls of the daemon's code(counted through -Wl,--wrap) */
+/* the optional argument scales the amount of work(e.g. 0.1 for a quick run) */
+
+// total payload bytes, that one benchmark pushes through
+#define WORK_BYTES (64.0 * 1024 * 1024)
+// bounds of the number of captures in one run
+#define MIN_OPS 16
+#define MAX_OPS 50000
+// memory, that the items of one queue may take
+#define QUEUE_BYTES (64 * 1024 * 1024)
+// bounds of the queue capacity(the daemon keeps up to MAX_CLIPBOARD_SIZE items)
+#define MIN_CAPACITY 8
+#define MAX_CAPACITY 2000
+// substring queries of one search run, and their length in bytes
+#define SEARCHES 10000
+#define QUERY_BYTES 12
+// results, that one query asks for
+#define MAX_RESULTS 20
+// payloads from this size on are chunked(as CHUNK_MIN_KB in the Makefile)
+#define CHUNK_MIN_BYTES (64 * 1024)
+// bytes, that one edit of a big paste overwrites, and the edits of each version
+#define EDIT_BYTES 8
+#define EDITS 3
+// versions of the capture, that the chunks suite inserts(at most)
+#define VERSIONS 32
+
+// clipboard shapes, from a copied word to a copied book chapter
+typedef struct _shape {
+    const char * name;
+    size_t bytes; // approximate size of one capture
+    int flag_cyrillic; // multi-line Cyrillic text(as in the real history) instead of ASCII
+} Shape;
+
+static const Shape shapes[] = {
+    {"tiny", 16, 0},
+    {"line", 100, 0},
+    {"paragraph", 2 * 1024, 1},
+    {"page", 64 * 1024, 1},
+    {"chapter", 2 * 1024 * 1024, 1}
+};
+static const double dup_ratios[] = {0.0, 0.5, 0.9};
+
+// words, that the Cyrillic captures are made of(UTF-8)
+static const char * words[] = {
+    "Осада", "цитадели", "продолжалась", "двенадцать", "дней", "Наконец", "перебив", "почти", "всех",
+    "защитников", "монголы", "ворвались", "в", "крепость", "и", "схватили", "немногих", "оставшихся",
+    "покрытых", "ранами", "обожженных", "Они", "поразились", "узнав", "что", "защищали", "от", "большого",
+    "войска", "всего", "четыреста", "человек"
+};
+
+// allocation calls of the daemon's code so far
+static unsigned long long allocs = 0;
+// scale of the work
+static double scale = 1.0;
+// directory for the history and journal files
+static char work_dir[] = "/tmp/queue_bench.XXXXXX";
+
+void * __real_malloc(size_t);
+void * __real_calloc(size_t, size_t);
+void * __real_realloc(void *, size_t);
+
+void * __wrap_malloc(size_t size) {
+    allocs++;
+    return __real_malloc(size);
+}
+
+void * __wrap_calloc(size_t count, size_t size) {
+    allocs++;
+    return __real_calloc(count, size);
+}
+
+void * __wrap_realloc(void * ptr, size_t size) {
+    allocs++;
+    return __real_realloc(ptr, size);
+}
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// print one result line
+static void report(const char * suite, const char * op, const Shape * shape, double dup, long ops, double time_ns, unsigned long long op_allocs, double bytes) {
+    printf("%s\t%s\t%s\t%zu\t%.2f\t%ld\t%.1f\t%.2f\t%.1f\n", suite, op, shape->name, shape->bytes, dup, ops,
+        time_ns / ops, (double) op_allocs / ops, bytes / (time_ns / 1e9) / (1024 * 1024));
+}
+
+// generate one capture of the shape, that starts with its number(so that distinct numbers give distinct captures)
+static char * make_capture(const Shape * shape, long number) {
+    char * str = (char *) malloc(shape->bytes + 64);
+    size_t len = (size_t) sprintf(str, "%ld ", number), line_start = 0, word_len;
+    const char * word;
+    while(len < shape->bytes) {
+        if(!shape->flag_cyrillic) {
+            str[len] = (char) ('a' + (number + len) % 26);
+            len++;
+            continue;
+        }
+        word = words[(number * 7 + len) % (sizeof(words) / sizeof(words[0]))];
+        word_len = strlen(word);
+        memcpy(str + len, word, word_len);
+        len += word_len;
+        // lines of about 80 characters(two bytes each)
+        if(len - line_start > 160) {
+            str[len++] = '\n';
+            line_start = len;
+        } else str[len++] = ' ';
+    }
+    str[len] = '\0';
+    return str;
+}
+
+// generate the sequence of captures: a repeat picks one of the earlier distinct captures
+/* distinct captures are collected into strings, captures only point to them */
+static char ** make_captures(const Shape * shape, double dup, long ops, char ** strings, long * distinct) {
+    char ** captures = (char **) malloc(ops * sizeof(char *));
+    *distinct = 0;
+    for(long i = 0; i < ops; i++) {
+        if(*distinct && (double) rand() / RAND_MAX < dup)
+            captures[i] = strings[rand() % *distinct];
+        else {
+            strings[*distinct] = make_capture(shape, *distinct);
+            captures[i] = strings[(*distinct)++];
+        }
+    }
+    return captures;
+}
+
+// queue suite: insert every capture, look all of them up, then delete the items
+static void bench_queue(const Shape * shape, double dup, char ** captures, long ops, int capacity, double bytes) {
+    Queue queue;
+    double start, time_ns;
+    unsigned long long allocs_start;
+    long found = 0;
+    queue_init(&queue, capacity);
+    allocs_start = allocs;
+    start = now_ns();
+    for(long i = 0; i < ops; i++)
+        insert_item(&queue, captures[i], 0);
+    time_ns = now_ns() - start;
+    report("queue", "insert_item", shape, dup, ops, time_ns, allocs - allocs_start, bytes);
+    allocs_start = allocs;
+    start = now_ns();
+    for(long i = 0; i < ops; i++)
+        found += find_item(&queue, captures[i], strlen(captures[i])) != NULL;
+    time_ns = now_ns() - start;
+    if(!found) abort();
+    report("queue", "find_item", shape, dup, ops, time_ns, allocs - allocs_start, bytes);
+    ops = queue.size;
+    allocs_start = allocs;
+    start = now_ns();
+    while(queue.start)
+        delete_item(&queue, queue.start);
+    time_ns = now_ns() - start;
+    report("queue", "delete_item", shape, dup, ops, time_ns, allocs - allocs_start, (double) ops * shape->bytes);
+    free_only_queue(&queue);
+}
+
+// budget suite: insert every capture into a queue limited by memory instead of the item count
+static void bench_budget(const Shape * shape, double dup, char ** captures, long ops, double bytes) {
+    Queue queue;
+    double start, time_ns;
+    unsigned long long allocs_start;
+    queue_init(&queue, MAX_OPS);
+    queue_set_budget(&queue, QUEUE_BYTES);
+    allocs_start = allocs;
+    start = now_ns();
+    for(long i = 0; i < ops; i++)
+        insert_item(&queue, captures[i], 0);
+    time_ns = now_ns() - start;
+    if(queue.bytes > QUEUE_BYTES) abort();
+    report("budget", "insert_item", shape, dup, ops, time_ns, allocs - allocs_start, bytes);
+    free_only_queue(&queue);
+}
+
+// search suite: index every capture of an unbounded queue, then look up pieces of random captures
+/* pieces are cut at random bytes, so they often start or end inside a Cyrillic character */
+static void bench_search(const Shape * shape, double dup, char ** captures, long ops, double bytes) {
+    Queue queue;
+    TrigramIndex index;
+    Item * results[MAX_RESULTS];
+    char * capture;
+    double start, time_ns;
+    unsigned long long allocs_start;
+    long found = 0;
+    size_t offset;
+    queue_init(&queue, ops);
+    trigram_index_init(&index, &queue);
+    queue_add_listener(&queue, &trigram_index_listener, &index);
+    allocs_start = allocs;
+    start = now_ns();
+    for(long i = 0; i < ops; i++)
+        insert_item(&queue, captures[i], 0);
+    time_ns = now_ns() - start;
+    report("search", "insert_item", shape, dup, ops, time_ns, allocs - allocs_start, bytes);
+    allocs_start = allocs;
+    start = now_ns();
+    for(long i = 0; i < SEARCHES; i++) {
+        capture = captures[rand() % ops];
+        offset = rand() % (strlen(capture) - QUERY_BYTES);
+        found += trigram_search(&index, &queue, capture + offset, QUERY_BYTES, results, MAX_RESULTS) > 0;
+    }
+    time_ns = now_ns() - start;
+    // every piece comes from a capture, that is in the queue
+    if(found != SEARCHES) abort();
+    report("search", "trigram_search", shape, dup, SEARCHES, time_ns, allocs - allocs_start, (double) SEARCHES * QUERY_BYTES);
+    trigram_index_free(&index);
+    free_only_queue(&queue);
+}
+
+// history suite: write the full queue to the text file, then load it into empty queues
+static void bench_history(const Shape * shape, double dup, char ** captures, long ops, int capacity) {
+    Queue queue;
+    HistoryFile history_file;
+    char file_name[64];
+    double start, time_ns = 0, file_bytes = 0;
+    unsigned long long allocs_start, op_allocs = 0;
+    long bytes, rounds = ops / capacity > 1 ? ops / capacity : 1;
+    snprintf(file_name, sizeof(file_name), "%s/history.txt", work_dir);
+    queue_init(&queue, capacity);
+    for(long i = 0; i < ops; i++)
+        insert_item(&queue, captures[i], 0);
+    for(long round = 0; round < rounds; round++) {
+        allocs_start = allocs;
+        start = now_ns();
+        if((bytes = write_to_file(queue.start, file_name, 0)) < 0) abort();
+        time_ns += now_ns() - start;
+        op_allocs += allocs - allocs_start;
+        file_bytes += bytes;
+    }
+    report("history", "write_to_file", shape, dup, rounds, time_ns, op_allocs, file_bytes);
+    free_only_queue(&queue);
+    time_ns = 0;
+    op_allocs = 0;
+    for(long round = 0; round < rounds; round++) {
+        queue_init(&queue, capacity);
+        history_file_init(&history_file, file_name);
+        allocs_start = allocs;
+        start = now_ns();
+        read_clip_history(&queue, &history_file);
+        time_ns += now_ns() - start;
+        op_allocs += allocs - allocs_start;
+        free_only_queue(&queue);
+    }
+    report("history", "read_clip_history", shape, dup, rounds, time_ns, op_allocs, file_bytes);
+    unlink(file_name);
+}
+
+// snapshot suite: write the full queue to the snapshot, then load it into empty queues
+/* a load removes the file, so every round writes it again */
+static void bench_snapshot(const Shape * shape, double dup, char ** captures, long ops, int capacity) {
+    Queue queue, loaded;
+    char file_name[64];
+    double start, write_ns = 0, load_ns = 0, file_bytes = 0;
+    unsigned long long allocs_start, write_allocs = 0, load_allocs = 0;
+    long bytes, rounds = ops / capacity > 1 ? ops / capacity : 1;
+    snprintf(file_name, sizeof(file_name), "%s/history.snap", work_dir);
+    queue_init(&queue, capacity);
+    for(long i = 0; i < ops; i++)
+        insert_item(&queue, captures[i], 0);
+    for(long round = 0; round < rounds; round++) {
+        allocs_start = allocs;
+        start = now_ns();
+        if((bytes = write_snapshot(&queue, file_name)) < 0) abort();
+        write_ns += now_ns() - start;
+        write_allocs += allocs - allocs_start;
+        file_bytes += bytes;
+        queue_init(&loaded, capacity);
+        allocs_start = allocs;
+        start = now_ns();
+        if(load_snapshot(&loaded, file_name) != queue.size) abort();
+        load_ns += now_ns() - start;
+        load_allocs += allocs - allocs_start;
+        free_only_queue(&loaded);
+    }
+    report("snapshot", "write_snapshot", shape, dup, rounds, write_ns, write_allocs, file_bytes);
+    report("snapshot", "load_snapshot", shape, dup, rounds, load_ns, load_allocs, file_bytes);
+    free_only_queue(&queue);
+}
+
+// journal suite: insert every capture with the journal listening, then replay the journal
+static void bench_journal(const Shape * shape, double dup, char ** captures, long ops, int capacity, double bytes) {
+    Queue queue;
+    Journal journal;
+    char file_name[64];
+    double start, time_ns;
+    unsigned long long allocs_start;
+    off_t journal_size;
+    snprintf(file_name, sizeof(file_name), "%s/history.journal", work_dir);
+    unlink(file_name);
+    queue_init(&queue, capacity);
+    if(!journal_open(&journal, file_name, &queue)) abort();
+    queue_add_listener(&queue, &journal_listener, &journal);
+    allocs_start = allocs;
+    start = now_ns();
+    for(long i = 0; i < ops; i++)
+        insert_item(&queue, captures[i], 0);
+    time_ns = now_ns() - start;
+    report("journal", "insert_item", shape, dup, ops, time_ns, allocs - allocs_start, bytes);
+    journal_size = journal.size;
+    journal_close(&journal);
+    free_only_queue(&queue);
+    queue_init(&queue, capacity);
+    allocs_start = allocs;
+    start = now_ns();
+    if(!journal_open(&journal, file_name, &queue)) abort();
+    time_ns = now_ns() - start;
+    report("journal", "journal_open", shape, dup, 1, time_ns, allocs - allocs_start, (double) journal_size);
+    journal_close(&journal);
+    free_only_queue(&queue);
+    unlink(file_name);
+}
+
+// log suite: log a debug line per capture, as the daemon does with LOG_LEVEL=debug,-
+// while the flush thread writes(and rotates) the file
+/* captures come milliseconds apart, so the clock is stopped, whenever the ring is half */
+/* full, until the flush thread has caught up(a tight loop would only measure the drops) */
+static void bench_log(const Shape * shape, long ops) {
+    Logger logger;
+    char file_name[64], rotated_name[64];
+    double start, time_ns = 0;
+    unsigned long long allocs_start, dropped;
+    snprintf(file_name, sizeof(file_name), "%s/log.txt", work_dir);
+    snprintf(rotated_name, sizeof(rotated_name), "%s/log.txt.1", work_dir);
+    if(!logger_start(&logger, file_name, LOG_DEBUG, 1024 * 1024)) abort();
+    allocs_start = allocs;
+    for(long i = 0; i < ops; i++) {
+        while(atomic_load(&logger.tail) - atomic_load(&logger.head) >= LOG_RING_SIZE / 2)
+            usleep(100);
+        start = now_ns();
+        log_write(&logger, LOG_DEBUG, "capture: %zu bytes(%s), %s in %.1f ms", shape->bytes, "text/plain", i & 1 ? "inserted" : "unchanged", i / 1e3);
+        time_ns += now_ns() - start;
+    }
+    dropped = atomic_load(&logger.dropped);
+    report("log", "log_write", shape, 0, ops, time_ns, allocs - allocs_start, 0);
+    printf("# log\t%s\tlines %ld\tdropped %llu\n", shape->name, ops, dropped);
+    logger_stop(&logger);
+    unlink(file_name);
+    unlink(rotated_name);
+}
+
+// chunks suite: insert versions of one capture, each with a few small edits of the previous one,-
+// into a chunked queue, and write its history(the chunk files once, as the daemon does)
+static void bench_chunks(const Shape * shape, char * capture, int capacity) {
+    Queue queue;
+    ChunkStore store;
+    Chunk ** chunks;
+    char file_name[64], chunks_dir[64], path[64 + NAME_MAX + 1], ** versions;
+    struct dirent * entry;
+    DIR * dir;
+    size_t len = strlen(capture), chunk_bytes = 0;
+    double start, time_ns;
+    unsigned long long allocs_start;
+    long ops = capacity < VERSIONS ? capacity : VERSIONS, bytes;
+    int count;
+    if(len < CHUNK_MIN_BYTES) return;
+    versions = (char **) malloc(ops * sizeof(char *));
+    for(long i = 0; i < ops; i++) {
+        versions[i] = strdup(i ? versions[i - 1] : capture);
+        for(int e = 0; e < EDITS; e++)
+            memset(versions[i] + rand() % (len - EDIT_BYTES), 'a' + e, EDIT_BYTES);
+    }
+    chunk_store_init(&store, CHUNK_MIN_BYTES);
+    queue_init(&queue, capacity);
+    queue_set_chunk_store(&queue, &store);
+    allocs_start = allocs;
+    start = now_ns();
+    for(long i = 0; i < ops; i++)
+        insert_item(&queue, versions[i], 0);
+    time_ns = now_ns() - start;
+    report("chunks", "insert_item", shape, 0, ops, time_ns, allocs - allocs_start, (double) ops * len);
+    snprintf(file_name, sizeof(file_name), "%s/history.txt", work_dir);
+    snprintf(chunks_dir, sizeof(chunks_dir), "%s/chunks", work_dir);
+    mkdir(chunks_dir, 0755);
+    allocs_start = allocs;
+    start = now_ns();
+    count = unsaved_chunks(queue.start, &chunks);
+    for(int i = 0; i < count; i++) {
+        if(!chunk_save(chunks_dir, chunks[i], 0)) abort();
+        chunk_bytes += chunks[i]->len;
+    }
+    release_chunks(&store, chunks, count, 1);
+    if((bytes = write_to_file(queue.start, file_name, 0)) < 0) abort();
+    time_ns = now_ns() - start;
+    report("chunks", "write_to_file", shape, 0, 1, time_ns, allocs - allocs_start, (double) bytes + chunk_bytes);
+    printf("# chunks\t%s\tversions %ld\tpayload %.1f MB\tmemory %.1f MB\tdisk %.1f MB\n", shape->name, ops,
+        (double) ops * len / (1024 * 1024), (double) queue_memory(&queue) / (1024 * 1024), (double) (bytes + chunk_bytes) / (1024 * 1024));
+    free_only_queue(&queue);
+    chunk_store_free(&store);
+    if((dir = opendir(chunks_dir))) {
+        while((entry = readdir(dir))) {
+            snprintf(path, sizeof(path), "%s/%s", chunks_dir, entry->d_name);
+            if(*entry->d_name != '.') unlink(path);
+        }
+        closedir(dir);
+    }
+    rmdir(chunks_dir);
+    unlink(file_name);
+    for(long i = 0; i < ops; i++)
+        free(versions[i]);
+    free(versions);
+}
+
+int main(int argc, char ** argv) {
+    const Shape * shape;
+    char ** captures, ** strings;
+    long ops, distinct;
+    int capacity;
+    double bytes;
+    if(argc > 1 && atof(argv[1]) > 0)
+        scale = atof(argv[1]);
+    if(!mkdtemp(work_dir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    srand(42);
+    printf("suite\top\tsize\tbytes\tdup\tops\tns_per_op\tallocs_per_op\tmb_per_s\n");
+    for(size_t s = 0; s < sizeof(shapes) / sizeof(shapes[0]); s++) {
+        shape = &shapes[s];
+        ops = (long) (WORK_BYTES * scale / shape->bytes);
+        ops = ops < MIN_OPS ? MIN_OPS : (ops > MAX_OPS ? MAX_OPS : ops);
+        capacity = QUEUE_BYTES / shape->bytes;
+        capacity = capacity < MIN_CAPACITY ? MIN_CAPACITY : (capacity > MAX_CAPACITY ? MAX_CAPACITY : capacity);
+        for(size_t d = 0; d < sizeof(dup_ratios) / sizeof(dup_ratios[0]); d++) {
+            strings = (char **) malloc(ops * sizeof(char *));
+            captures = make_captures(shape, dup_ratios[d], ops, strings, &distinct);
+            bytes = (double) ops * shape->bytes;
+            bench_queue(shape, dup_ratios[d], captures, ops, capacity, bytes);
+            bench_budget(shape, dup_ratios[d], captures, ops, bytes);
+            bench_search(shape, dup_ratios[d], captures, ops, bytes);
+            bench_history(shape, dup_ratios[d], captures, ops, capacity);
+            bench_snapshot(shape, dup_ratios[d], captures, ops, capacity);
+            bench_journal(shape, dup_ratios[d], captures, ops, capacity, bytes);
+            if(!d) {
+                bench_chunks(shape, captures[0], capacity);
+                bench_log(shape, ops);
+            }
+            for(long i = 0; i < distinct; i++)
+                free(strings[i]);
+            free(strings);
+            free(captures);
+            fflush(stdout);
+        }
+    }
+    rmdir(work_dir);
+    return 0;
+}
@@ -1,8 +1,9 @@
 #! /bin/sh
 
 BASE_DIR="$1"
-_PPID="$2"
 
-git pull &>/dev/null
-
-kill -10 "$_PPID" # send a signal to daemon process
+cd "$BASE_DIR" || exit 1
+# the history file is flushed between pushes, so commit it first(the next push sends it)
+git add -A . || exit 1
+git diff --cached --quiet || git commit -q -m "Update clipboard history" || exit 1
+git pull -q >/dev/null 2>&1
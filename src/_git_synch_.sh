@@ -1,11 +1,9 @@
 #! /bin/sh
 
 BASE_DIR="$1"
-_PPID="$2"
 
-git add "$BASE_DIR"
-git commit -m "Update clipboard history"
-git push origin master
-
-kill -10 "$_PPID" # send a signal to daemon process
- 
\ No newline at end of file
+cd "$BASE_DIR" || exit 1
+git add -A . || exit 1
+# all changes since the previous sync go into one commit(nothing to commit is fine)
+git diff --cached --quiet || git commit -q -m "Update clipboard history" || exit 1
+git push -q origin HEAD
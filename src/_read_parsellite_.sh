@@ -0,0 +1,5 @@
+#! /bin/sh
+
+# print the current clipboard contents to stdout(the daemon reads them through a pipe)
+# parcellite prints '\n' before the contents, the daemon keeps every byte, so it is dropped here
+parcellite -c 2>/dev/null | sed '1{/^$/d}'
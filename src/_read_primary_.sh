@@ -0,0 +1,4 @@
+#! /bin/sh
+
+# print the current PRIMARY selection to stdout(polled as a capture source of its own, see CAPTURE_SOURCES)
+parcellite -p 2>/dev/null
@@ -1,191 +1,123 @@
-#include "avl_tree.h"
+#include "avl_typed.h"
 
-// root of the AVL tree
-Node * avl_root = NULL;
-// custom compare function
-int (*compare_func)(const void *, const void *) = NULL;
+// call the compare function of the tree(used by the generic operations)
+#define AVL_CALL_COMPARE(tree, a, b) ((*(tree)->compare_func)((a), (b), (tree)->context))
 
-void assign_compare_func(int (*my_comparator) (const void *, const void *)) {
-    compare_func = my_comparator;
-}
+// generic operations, that call the compare function through the pointer
+AVL_TREE_DEFINE(avl, AVL_CALL_COMPARE)
+
+// number of nodes in one slab of the node pool
+#define NODES_PER_SLAB 256
+
+static void in_order_get_helper(Node *, void * (*my_get_callback)(void *));
+static int in_range_get_helper(AvlTree *, Node *, void *, void *, int (*my_range_callback)(void *, void *), void *);
 
-Node * get_avl_root(void) {
-    return avl_root;
+AvlTree * create_tree(int (*my_comparator)(const void *, const void *, void *), void * context) {
+    AvlTree * tree = (AvlTree *) malloc(sizeof(AvlTree));
+    tree->root = NULL;
+    tree->compare_func = my_comparator;
+    tree->context = context;
+    pool_init(&tree->nodes, sizeof(Node), NODES_PER_SLAB);
+    return tree;
 }
-  
-int max(int a, int b) {
-    return (a > b) ? a : b;
+
+Node * get_avl_root(AvlTree * tree) {
+    return tree->root;
 }
-  
-int height(Node * node) {
-    if(node == NULL) return 0;
-    return node->height;
+
+int tree_size(AvlTree * tree) {
+    return avl_count(tree->root);
 }
-  
-Node * create_node(void * key) {
-    Node * node = (Node*) malloc(sizeof(Node));
+
+Node * create_node(AvlTree * tree, void * key) {
+    Node * node = (Node*) pool_alloc(&tree->nodes);
     node->key = key;
     node->left = NULL;
     node->right = NULL;
     node->height = 1;
+    node->count = 1;
     return node;
 }
-  
-Node * right_rotate(Node * y) {
-    Node * x = y->left;
-    Node * T2 = x->right;
-    // perform rotation
-    x->right = y;
-    y->left = T2;
-    // update heights 
-    y->height = max(height(y->left), height(y->right)) + 1;
-    x->height = max(height(x->left), height(x->right)) + 1;
-    // return new root
-    return x;
-}
-  
-Node * left_rotate(Node * x) {
-    Node * y = x->right;
-    Node * T2 = y->left;
-    // perform rotation 
-    y->left = x;
-    x->right = T2;
-    // update heights 
-    x->height = max(height(x->left), height(x->right)) + 1;
-    y->height = max(height(y->left), height(y->right)) + 1;
-    // return new root
-    return y;
-}
-  
-int get_balance(Node * node) {
-    if(node == NULL) return 0; 
-    return height(node->left) - height(node->right);
-}
 
-int insert(void * key) {
-    if(find_node(key)) return 0;
-    avl_root = insert_helper(avl_root, key);
-    return 1;
+void free_node(AvlTree * tree, Node * node) {
+    pool_free(&tree->nodes, node);
 }
 
-Node * insert_helper(Node * node, void * key) {
-    // perform the normal BST insertion
-    if(node == NULL) return create_node(key); // empty leaf
-    if((*compare_func)(key, node->key) == -1)
-        node->left  = insert_helper(node->left, key);
-    else if((*compare_func)(key, node->key) == 1)
-        node->right = insert_helper(node->right, key);
-    else {
-        // already exists will return NULL
-        return node;
-    }
-    // update height of this ancestor node
-    node->height = max(height(node->left), height(node->right)) + 1; 
-
-    // get balance
-    int balance = get_balance(node); 
-    // left left case 
-    if(balance > 1 && (*compare_func)(key, node->left->key) == -1) return right_rotate(node);
-    // right right case
-    if (balance < -1 && (*compare_func)(key, node->right->key) == 1) return left_rotate(node);
-    // left right case 
-    if(balance > 1 && (*compare_func)(key, node->left->key) == 1) {
-        node->left =  left_rotate(node->left);
-        return right_rotate(node);
-    }
-    // right left case 
-    if(balance < -1 && (*compare_func)(key, node->right->key) == -1) {
-        node->right = right_rotate(node->right);
-        return left_rotate(node);
-    }
-    return node;
+int insert(AvlTree * tree, void * key) {
+    return avl_insert(tree, key);
 }
 
-Node * min_value_node(Node * node) {
-    Node * current = node;
-    while(current->left != NULL)
-        current = current->left;
-    return current;
+void delete(AvlTree * tree, void * key) {
+    if(!key) return;
+    avl_delete(tree, key);
 }
 
-void delete(void * key) {
-    // if there is no such element in the tree, don't even try to delete it
-    if(!key || !find_node(key)) return;
-    avl_root = delete_helper(avl_root, key);
+Node * find_node(AvlTree * tree, void * key) {
+    return avl_find(tree, key);
 }
 
-Node * delete_helper(Node * root, void * key) {
-    if(root == NULL) return root;
-    if((*compare_func)(key, root->key) == -1) 
-        root->left = delete_helper(root->left, key);
-    else if((*compare_func)(key, root->key) == 1)
-        root->right = delete_helper(root->right, key);
-    else {
-        if((root->left == NULL) || (root->right == NULL)) {
-            Node * temp = root->left ? root->left : root->right;
-            if(temp == NULL) {
-                temp = root;
-                root = NULL;
-            }
-            else *root = *temp;
-            free(temp);
-        }
+void * find_nth(AvlTree * tree, int index) {
+    Node * node = tree->root;
+    if(index < 0) return NULL;
+    while(node) {
+        if(index < avl_count(node->left))
+            node = node->left;
+        else if(index == avl_count(node->left))
+            return node->key;
         else {
-            Node * temp = min_value_node(root->right);
-            root->key = temp->key;
-            root->right = delete_helper(root->right, temp->key);
+            index -= avl_count(node->left) + 1;
+            node = node->right;
         }
     }
-    if(root == NULL) return root;
-    root->height = max(height(root->left), height(root->right)) + 1;
-    
-    // start balancing
-    int balance = get_balance(root);
-    // left left case 
-    if(balance > 1 && get_balance(root->left) >= 0)
-        return right_rotate(root); 
-    // left right case 
-    if(balance > 1 && get_balance(root->left) < 0) {
-        root->left =  left_rotate(root->left);
-        return right_rotate(root);
-    }
-    // right right case 
-    if (balance < -1 && get_balance(root->right) <= 0) 
-        return left_rotate(root); 
-    // right left case
-    if(balance < -1 && get_balance(root->right) > 0) {
-        root->right = right_rotate(root->right);
-        return left_rotate(root);
+    return NULL;
+}
+
+int lower_bound_rank(AvlTree * tree, void * key) {
+    Node * node = tree->root;
+    int rank = 0;
+    while(node) {
+        if(AVL_CALL_COMPARE(tree, key, node->key) <= 0)
+            node = node->left;
+        else {
+            rank += avl_count(node->left) + 1;
+            node = node->right;
+        }
     }
-    return root;
-} 
+    return rank;
+}
 
-Node * find_node(void * key) {
-    return find_node_helper(avl_root, key);
+int in_range_get(AvlTree * tree, void * from, void * to, int (*my_range_callback)(void *, void *), void * arg) {
+    return in_range_get_helper(tree, tree->root, from, to, my_range_callback, arg);
 }
 
-Node * find_node_helper(Node * node, void * key) {
-	if(node == NULL) return NULL;
-    if((*compare_func)(key, node->key) == -1)
-        return find_node_helper(node->left, key);
-    else if((*compare_func)(key, node->key) == 1)
-        return find_node_helper(node->right, key);
-	else return node;
+static int in_range_get_helper(AvlTree * tree, Node * node, void * from, void * to, int (*my_range_callback)(void *, void *), void * arg) {
+    int res, after_from, before_to;
+    if(node == NULL) return 0;
+    // only descend into subtrees, that can contain keys from the range
+    after_from = AVL_CALL_COMPARE(tree, node->key, from) >= 0;
+    before_to = AVL_CALL_COMPARE(tree, node->key, to) <= 0;
+    if(after_from && (res = in_range_get_helper(tree, node->left, from, to, my_range_callback, arg)))
+        return res;
+    if(after_from && before_to && (res = (*my_range_callback)(node->key, arg)))
+        return res;
+    if(before_to)
+        return in_range_get_helper(tree, node->right, from, to, my_range_callback, arg);
+    return 0;
 }
 
-void free_tree(Node * root) {
-    if(!root) return;
-    free_tree(root->left);
-    free_tree(root->right);
-    //free(root->key);
-    free(root);
+void free_tree(AvlTree * tree) {
+    if(!tree) return;
+    // nodes live in the pool, so releasing its slabs frees all of them(keys are not freed)
+    pool_destroy(&tree->nodes);
+    free(tree);
 }
 
-void in_order_get(void * (*my_get_callback)(void *)) {
-    in_order_get_helper(avl_root, my_get_callback);
+void in_order_get(AvlTree * tree, void * (*my_get_callback)(void *)) {
+    if(tree->root)
+        in_order_get_helper(tree->root, my_get_callback);
 }
 
-void in_order_get_helper(Node * node, void * (*my_get_callback)(void *)) {
+static void in_order_get_helper(Node * node, void * (*my_get_callback)(void *)) {
     if(node->left)
         in_order_get_helper(node->left, my_get_callback);
     (*my_get_callback)(node->key);
@@ -1,49 +1,60 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include "pool.h"
 
-// AVL tree node 
+#ifndef AVL_TREE_H
+#define AVL_TREE_H
+
+// AVL tree node
 typedef struct _node {
     void * key;
     struct _node * left;
     struct _node * right;
     int height;
+    int count; // number of nodes in the subtree(for rank queries)
 } Node;
 
+// AVL tree handle
+/* compare_func returns negative, 0 or positive value(like strcmp) */
+/* and gets the context of its tree as the third argument */
+typedef struct _avl_tree {
+    Node * root;
+    int (*compare_func)(const void *, const void *, void *);
+    void * context;
+    Pool nodes; // all nodes of the tree are allocated from here
+} AvlTree;
+
+// create an empty tree with custom compare function and its context
+AvlTree * create_tree(int (*my_comparator)(const void *, const void *, void *), void *);
 // get the root of the AVL tree
-Node * get_avl_root(void);
-// assign custom compare function
-void assign_compare_func(int (*my_comparator)(const void *, const void *));
-// get maximum of two integers 
-static int max(int, int);
-// get the height of the tree
-static int height(Node *);
-static Node * create_node(void *);
-// right rotate 
-static Node * right_rotate(Node *);
-// left rotate
-static Node * left_rotate(Node *);
-// get Balance factor of node 
-static int get_balance(Node *);
+Node * get_avl_root(AvlTree *);
+// get the number of keys in the tree
+int tree_size(AvlTree *);
+// allocate a node for the key
+Node * create_node(AvlTree *, void *);
+// free the node(the key is not freed)
+void free_node(AvlTree *, Node *);
 // insert and balance the tree(if needed)
 /* takes already allocated key and assigns it to the new created node */
-/* frees that key, if it is already present in the tree */
 /* return 1 if insertion was successful and 0, if such a key was already in the tree */
-int insert(void *);
-static Node * insert_helper(Node *, void *);
-// find the node with the minimum value
-static Node * min_value_node(Node *);
+int insert(AvlTree *, void *);
 // delete a node from the tree
 /* takes already allocated key, but, does not delete it */
 /* the key should be deleted manually by calling find_node before deletion and freeing it after */
-void delete(void *);
-static Node * delete_helper(Node *, void *);
-// find a node(if (exists) return 1; else return 0)
-Node * find_node(void *);
-static Node * find_node_helper(Node *, void *);
-// free the tree
-void free_tree(Node *);
-// get AVL tree root
-Node * get_avl_root(void);
+void delete(AvlTree *, void *);
+// find a node(if (exists) return it; else return NULL)
+/* for the compare function inlined into these three, see AVL_TREE_DEFINE in avl_typed.h */
+Node * find_node(AvlTree *, void *);
+// find the key with the given in-order index(0 is the smallest key), NULL if out of range
+void * find_nth(AvlTree *, int);
+// get the in-order index of the first key, that is not less than the given key
+int lower_bound_rank(AvlTree *, void *);
+// call my_range_callback on every key from [from, to] in order
+/* stops early when the callback returns non-zero value and returns that value */
+int in_range_get(AvlTree *, void *, void *, int (*my_range_callback)(void *, void *), void *);
+// free the tree(keys are not freed)
+void free_tree(AvlTree *);
 // get keys of the tree in-order
-void in_order_get(void * (*my_get_callback)(void *));
-static void in_order_get_helper(Node *, void * (*my_get_callback)(void *));
+void in_order_get(AvlTree *, void * (*my_get_callback)(void *));
+
+#endif
@@ -0,0 +1,127 @@
+#include "avl_tree.h"
+
+#ifndef AVL_TYPED_H
+#define AVL_TYPED_H
+
+// maximum height of the tree(AVL tree of height 64 would need more than 2^44 nodes)
+#define AVL_MAX_HEIGHT 64
+
+/* iterative AVL operations, that are specialized on the compare function at compile time */
+/* AVL_TREE_DEFINE(name, compare) defines name##_insert, name##_delete and name##_find, */
+/* where compare(tree, a, b) returns negative, 0 or positive value(like strcmp). */
+/* if compare is a macro or a static function, it gets inlined into the search loops, */
+/* otherwise these are the same operations, that the generic insert/delete/find use. */
+/* every operation compares the key only once per level and never searches twice: */
+/* the slots(child pointers) passed on the way down are kept on a stack, */
+/* and the tree is rebalanced bottom-up by popping them. */
+
+static inline int avl_height(Node * node) {
+    return node ? node->height : 0;
+}
+
+static inline int avl_count(Node * node) {
+    return node ? node->count : 0;
+}
+
+// recompute height and count of the node from its children
+static inline void avl_update(Node * node) {
+    int left = avl_height(node->left), right = avl_height(node->right);
+    node->height = (left > right ? left : right) + 1;
+    node->count = avl_count(node->left) + avl_count(node->right) + 1;
+}
+
+static inline Node * avl_right_rotate(Node * y) {
+    Node * x = y->left;
+    y->left = x->right;
+    x->right = y;
+    avl_update(y);
+    avl_update(x);
+    return x;
+}
+
+static inline Node * avl_left_rotate(Node * x) {
+    Node * y = x->right;
+    x->right = y->left;
+    y->left = x;
+    avl_update(x);
+    avl_update(y);
+    return y;
+}
+
+// update the node and rotate it(if needed), return the new root of the subtree
+static inline Node * avl_rebalance(Node * node) {
+    int balance;
+    avl_update(node);
+    balance = avl_height(node->left) - avl_height(node->right);
+    if(balance > 1) {
+        // left right case
+        if(avl_height(node->left->left) < avl_height(node->left->right))
+            node->left = avl_left_rotate(node->left);
+        // left left case
+        return avl_right_rotate(node);
+    }
+    if(balance < -1) {
+        // right left case
+        if(avl_height(node->right->right) < avl_height(node->right->left))
+            node->right = avl_right_rotate(node->right);
+        // right right case
+        return avl_left_rotate(node);
+    }
+    return node;
+}
+
+#define AVL_TREE_DEFINE(name, compare) \
+\
+/* return 1 if insertion was successful and 0, if such a key was already in the tree */ \
+static inline int name##_insert(AvlTree * tree, void * key) { \
+    Node ** path[AVL_MAX_HEIGHT], ** link = &tree->root; \
+    int depth = 0, res; \
+    while(*link) { \
+        if(!(res = compare(tree, key, (*link)->key))) return 0; \
+        path[depth++] = link; \
+        link = (res < 0) ? &(*link)->left : &(*link)->right; \
+    } \
+    *link = create_node(tree, key); \
+    while(depth--) \
+        *path[depth] = avl_rebalance(*path[depth]); \
+    return 1; \
+} \
+\
+/* return 1 if the key was deleted and 0, if there was no such key */ \
+static inline int name##_delete(AvlTree * tree, void * key) { \
+    Node ** path[AVL_MAX_HEIGHT], ** link = &tree->root, * node, * next; \
+    int depth = 0, res; \
+    while(*link && (res = compare(tree, key, (*link)->key))) { \
+        path[depth++] = link; \
+        link = (res < 0) ? &(*link)->left : &(*link)->right; \
+    } \
+    if(!(node = *link)) return 0; \
+    if(node->left && node->right) { \
+        /* take the key of the minimum node of the right subtree and delete that node instead */ \
+        path[depth++] = link; \
+        link = &node->right; \
+        while((*link)->left) { \
+            path[depth++] = link; \
+            link = &(*link)->left; \
+        } \
+        next = *link; \
+        node->key = next->key; \
+        *link = next->right; \
+        node = next; \
+    } else \
+        *link = node->left ? node->left : node->right; \
+    free_node(tree, node); \
+    while(depth--) \
+        *path[depth] = avl_rebalance(*path[depth]); \
+    return 1; \
+} \
+\
+static inline Node * name##_find(AvlTree * tree, void * key) { \
+    Node * node = tree->root; \
+    int res; \
+    while(node && (res = compare(tree, key, node->key))) \
+        node = (res < 0) ? node->left : node->right; \
+    return node; \
+}
+
+#endif
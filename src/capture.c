@@ -0,0 +1,322 @@
+#define _GNU_SOURCE // pipe2
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include "capture.h"
+
+// initial size of the capture buffer
+#define CAPTURE_BUF_SIZE 4096
+
+extern char ** environ;
+
+// body of the capture thread
+static void * worker_main(void *);
+// poll_timer handler: start the reader of the source(unless it is still running)
+static void source_poll(Reactor *, void *, uint32_t);
+// reader's stdout handler(in pipe mode)
+static void source_pipe(Reactor *, void *, uint32_t);
+// the reader exited: hand what it has read over to the index thread
+static void source_done(Reactor *, ReactorChild *, void *);
+// push the capture of the exited reader into the ring(NULL: the reader couldn't be started)
+static void source_push(CaptureSource *, ReactorChild *);
+// arm the poll timer for the next read(the interval is reset if the source changed)
+static void source_schedule(CaptureSource *, int);
+// stop handler: leave the thread's loop
+static void worker_stop(Reactor *, void *, uint32_t);
+
+void capture_init(Capture * capture) {
+    capture->pid = 0;
+    capture->fd = -1;
+    capture->buf = (char *) malloc(CAPTURE_BUF_SIZE);
+    capture->buf[0] = '\0';
+    capture->len = 0;
+    capture->size = CAPTURE_BUF_SIZE;
+    capture->hash = HASH_SEED;
+}
+
+int capture_start(Capture * capture, char ** argv) {
+    int fds[2], res;
+    sigset_t signals_set;
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    if(pipe2(fds, O_CLOEXEC)) return 0;
+    // reader's stdout is the write end of the pipe(dup2 drops O_CLOEXEC from it)
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, fds[1], STDOUT_FILENO);
+    // reader shouldn't inherit the signals, that the daemon blocks
+    sigemptyset(&signals_set);
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setsigmask(&attr, &signals_set);
+    // own process group, so that the reader can be killed together with its children
+    posix_spawnattr_setpgroup(&attr, 0);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETPGROUP);
+    res = posix_spawn(&capture->pid, argv[0], &actions, &attr, argv, environ);
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+    close(fds[1]);
+    if(res) {
+        close(fds[0]);
+        capture->pid = 0;
+        return 0;
+    }
+    capture->fd = fds[0];
+    capture->len = 0;
+    capture->buf[0] = '\0';
+    capture->hash = HASH_SEED;
+    return 1;
+}
+
+int capture_read(Capture * capture) {
+    ssize_t count;
+    // keep room for at least half a buffer and the '\0'
+    if(capture->size - capture->len - 1 < capture->size / 2)
+        capture->buf = (char *) realloc(capture->buf, (capture->size *= 2));
+    while((count = read(capture->fd, capture->buf + capture->len, capture->size - capture->len - 1)) < 0 && errno == EINTR);
+    if(count < 0) return -1;
+    // the bytes are hashed while they are still in the cache
+    capture->hash = hash_bytes_update(capture->hash, capture->buf + capture->len, count);
+    capture->len += count;
+    capture->buf[capture->len] = '\0';
+    return count > 0;
+}
+
+int capture_finish(Capture * capture) {
+    int status = 0;
+    pid_t res;
+    if(capture->fd >= 0) {
+        close(capture->fd);
+        capture->fd = -1;
+    }
+    if(!capture->pid) return 0;
+    while((res = waitpid(capture->pid, &status, 0)) < 0 && errno == EINTR);
+    capture->pid = 0;
+    return res > 0 && WIFEXITED(status) && !WEXITSTATUS(status);
+}
+
+int capture_run(Capture * capture, char ** argv) {
+    int res;
+    if(!capture_start(capture, argv)) return 0;
+    while((res = capture_read(capture)) > 0);
+    // the reader has to be waited for even if reading failed
+    return capture_finish(capture) && !res;
+}
+
+void capture_free(Capture * capture) {
+    if(capture->pid)
+        kill(-capture->pid, SIGKILL);
+    capture_finish(capture);
+    free(capture->buf);
+    capture->buf = NULL;
+}
+
+int capture_read_file(Capture * capture, char * file_name) {
+    int res;
+    if((capture->fd = open(file_name, O_RDONLY | O_CLOEXEC)) < 0) return 0;
+    capture->len = 0;
+    capture->buf[0] = '\0';
+    capture->hash = HASH_SEED;
+    while((res = capture_read(capture)) > 0);
+    close(capture->fd);
+    capture->fd = -1;
+    return !res;
+}
+
+char * capture_detach(Capture * capture) {
+    char * buf = (char *) realloc(capture->buf, capture->len + 1);
+    if(!buf) buf = capture->buf;
+    capture->buf = (char *) malloc(CAPTURE_BUF_SIZE);
+    capture->buf[0] = '\0';
+    capture->len = 0;
+    capture->size = CAPTURE_BUF_SIZE;
+    capture->hash = HASH_SEED;
+    return buf;
+}
+
+void capture_entry_free(Backing * backing) {
+    // the backing is the first member of its entry
+    CaptureEntry * entry = (CaptureEntry *) backing;
+    free(entry->buf);
+    free(entry);
+}
+
+void capture_source_init(CaptureSource * source, char ** args, char * file_name, long min_interval, long max_interval, long timeout) {
+    source->args = args;
+    source->file_name = file_name;
+    source->min_interval = min_interval > 0 ? min_interval : 1;
+    source->max_interval = max_interval > source->min_interval ? max_interval : source->min_interval;
+    source->interval = source->min_interval;
+    source->timeout = timeout;
+    source->flag_last = source->flag_skip_newline = 0;
+    source->poll_timer.fd = source->pipe.fd = -1;
+    reactor_child_init(&source->child);
+}
+
+int capture_worker_start(CaptureWorker * worker, Ring * out, CaptureSource * sources, int count) {
+    int i;
+    worker->out = out;
+    worker->sources = sources;
+    worker->sources_count = count;
+    atomic_init(&worker->skipped, 0);
+    worker->stop.fd = -1;
+    if(!reactor_init(&worker->reactor)) return 0;
+    // the first polls fire at once
+    for(i = 0; i < count; i++) {
+        sources[i].worker = worker;
+        sources[i].id = i + 1;
+        capture_init(&sources[i].capture);
+        if(!reactor_add(&worker->reactor, &sources[i].poll_timer, reactor_timer_fd(0, 0), EPOLLIN, &source_poll, &sources[i])) {
+            capture_free(&sources[i].capture);
+            break;
+        }
+    }
+    if(i < count || !reactor_add(&worker->reactor, &worker->stop, eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC), EPOLLIN, &worker_stop, worker) ||
+        pthread_create(&worker->thread, NULL, &worker_main, worker)) {
+        reactor_remove(&worker->reactor, &worker->stop);
+        while(i--) {
+            reactor_remove(&worker->reactor, &sources[i].poll_timer);
+            capture_free(&sources[i].capture);
+        }
+        reactor_free(&worker->reactor);
+        return 0;
+    }
+    return 1;
+}
+
+void capture_worker_stop(CaptureWorker * worker) {
+    uint64_t one = 1;
+    if(write(worker->stop.fd, &one, sizeof(one)) < 0) return;
+    pthread_join(worker->thread, NULL);
+}
+
+static void * worker_main(void * context) {
+    CaptureWorker * worker = (CaptureWorker *) context;
+    CaptureSource * source;
+    reactor_run(&worker->reactor);
+    // everything below belongs to this thread, so it is freed here
+    for(int i = 0; i < worker->sources_count; i++) {
+        source = &worker->sources[i];
+        reactor_child_kill(&worker->reactor, &source->child);
+        reactor_remove(&worker->reactor, &source->pipe);
+        reactor_remove(&worker->reactor, &source->poll_timer);
+        source->capture.fd = -1; // the pipe was closed with its source
+        capture_free(&source->capture);
+    }
+    reactor_remove(&worker->reactor, &worker->stop);
+    reactor_free(&worker->reactor);
+    return NULL;
+}
+
+static void source_poll(Reactor * reactor, void * context, uint32_t events) {
+    CaptureSource * source = (CaptureSource *) context;
+    if(!reactor_timer_read(source->poll_timer.fd)) return;
+    // the timer is re-armed only once the reader is done, so none is running here
+    if(source->file_name) {
+        if(!reactor_spawn(reactor, &source->child, source->args, source->timeout, &source_done, source))
+            source_push(source, NULL);
+        return;
+    }
+    if(!capture_start(&source->capture, source->args)) {
+        source_push(source, NULL);
+        return;
+    }
+    fcntl(source->capture.fd, F_SETFL, fcntl(source->capture.fd, F_GETFL) | O_NONBLOCK);
+    if(!reactor_watch(reactor, &source->child, source->capture.pid, source->timeout, &source_done, source)) {
+        kill(-source->capture.pid, SIGKILL);
+        capture_finish(&source->capture);
+        source_push(source, NULL);
+        return;
+    }
+    source->capture.pid = 0; // the reactor reaps the reader from now on
+    if(!reactor_add(reactor, &source->pipe, source->capture.fd, EPOLLIN, &source_pipe, source)) {
+        source->capture.fd = -1; // already closed by reactor_add
+        reactor_child_kill(reactor, &source->child);
+        source_push(source, NULL);
+    }
+}
+
+static void source_pipe(Reactor * reactor, void * context, uint32_t events) {
+    CaptureSource * source = (CaptureSource *) context;
+    int res = capture_read(&source->capture);
+    if(res > 0 || (res < 0 && errno == EAGAIN)) return;
+    // EOF(or error): the rest is handled when the reader exits
+    reactor_remove(reactor, &source->pipe);
+    source->capture.fd = -1;
+}
+
+static void source_done(Reactor * reactor, ReactorChild * child, void * context) {
+    CaptureSource * source = (CaptureSource *) context;
+    if(source->pipe.fd >= 0) {
+        // take what is left in the pipe, and don't wait for EOF(the reader is gone)
+        while(capture_read(&source->capture) > 0);
+        reactor_remove(reactor, &source->pipe);
+        source->capture.fd = -1;
+    }
+    source_push(source, child);
+}
+
+static void source_push(CaptureSource * source, ReactorChild * child) {
+    CaptureEntry * entry;
+    uint64_t now = reactor_now();
+    unsigned long long hash;
+    size_t skip, len;
+    // in file mode the reader has written the file by now
+    int flag_failed = !child || !reactor_child_ok(child) ||
+        (source->file_name && !capture_read_file(&source->capture, source->file_name));
+    // the fingerprint of this capture(capture_detach resets it, so it is kept for after the push)
+    hash = source->capture.hash;
+    len = source->capture.len;
+    // most polls find the source unchanged: the hash is already there, so this costs nothing
+    if(!flag_failed && source->flag_last && len == source->last_len && hash == source->last_hash) {
+        atomic_fetch_add_explicit(&source->worker->skipped, 1, memory_order_relaxed);
+        source_schedule(source, 0);
+        return;
+    }
+    source_schedule(source, !flag_failed);
+    entry = (CaptureEntry *) malloc(sizeof(CaptureEntry));
+    entry->source = source->id;
+    entry->capture_time = child ? now - child->started : 0;
+    entry->flag_timed_out = child && child->flag_timed_out;
+    entry->flag_failed = flag_failed;
+    entry->buf = NULL;
+    entry->backing.data = NULL;
+    entry->backing.size = 0;
+    entry->backing.refs = 0;
+    entry->backing.release_func = &capture_entry_free;
+    entry->backing.prev = entry->backing.next = NULL;
+    if(!entry->flag_failed) {
+        // skip the '\n' that parcellite writes first(any other reader's bytes are kept as they are)
+        skip = source->flag_skip_newline && source->capture.len && source->capture.buf[0] == '\n';
+        entry->backing.size = source->capture.len - skip;
+        entry->buf = capture_detach(&source->capture);
+        entry->backing.data = entry->buf + skip;
+    }
+    entry->parse_time = reactor_now() - now;
+    // a full ring means the index thread is behind: drop the capture, the next one comes soon
+    /* the fingerprint is only taken from a capture, that got through, so the next poll retries a dropped one */
+    if(!ring_push(source->worker->out, entry)) {
+        capture_entry_free(&entry->backing);
+        return;
+    }
+    if(!flag_failed) {
+        source->last_hash = hash;
+        source->last_len = len;
+        source->flag_last = 1;
+    }
+}
+
+static void source_schedule(CaptureSource * source, int flag_changed) {
+    if(flag_changed)
+        source->interval = source->min_interval;
+    else if((source->interval *= 2) > source->max_interval)
+        source->interval = source->max_interval;
+    reactor_timer_set(source->poll_timer.fd, source->interval, 0);
+}
+
+static void worker_stop(Reactor * reactor, void * context, uint32_t events) {
+    reactor_stop(reactor);
+}
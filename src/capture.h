@@ -0,0 +1,116 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include "queue.h"
+#include "reactor.h"
+#include "ring.h"
+
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+// most capture sources of one capture thread
+#define CAPTURE_MAX_SOURCES 8
+
+// clipboard capture through a pipe
+/* the reader command is started with posix_spawn, its stdout is a pipe, */
+/* and the clipboard contents are streamed from it into a growable buffer, */
+/* so there is no temporary file, no signal and no per-byte reading */
+typedef struct _capture {
+    pid_t pid; // reader process(0 if none is running)
+    int fd; // read end of the pipe(-1 if none is open)
+    char * buf; // captured bytes(always followed by '\0'), reused between captures
+    size_t len, size;
+    unsigned long long hash; // hash of the len captured bytes(updated by every read)
+} Capture;
+
+// clipboard capture handed from the capture thread to the index thread
+/* the payload is a backing, so the queue can point right into it(see insert_item_backed) */
+/* instead of copying it; backing.release_func frees the whole entry */
+typedef struct _capture_entry {
+    Backing backing; // payload(data and size, not '\0'-terminated for the queue)
+    char * buf; // buffer, that the payload lies in
+    int source; // number of the source, that captured it(see CaptureSource)
+    int flag_failed; // the reader failed or timed out(there is no payload)
+    int flag_timed_out;
+    uint64_t capture_time; // nanoseconds from the reader's start to its exit
+    uint64_t parse_time; // nanoseconds spent getting the payload out of the reader's output
+} CaptureEntry;
+
+struct _capture_worker;
+
+// one thing, that the capture thread polls(the CLIPBOARD or the PRIMARY selection, or any command, that prints something)
+/* the poll interval drops to the minimum after a change and doubles with every */
+/* unchanged poll up to the maximum, so bursts are caught fast and idle costs little */
+typedef struct _capture_source {
+    struct _capture_worker * worker;
+    int id; // number of the source(1 for the first one, see Item)
+    ReactorSource poll_timer; // starts the reader(one-shot, re-armed after every capture)
+    ReactorSource pipe; // reader's stdout(in pipe mode)
+    ReactorChild child; // reader
+    Capture capture;
+    char ** args; // reader command
+    char * file_name; // file, that the reader writes(NULL in pipe mode, where it prints)
+    long min_interval; // milliseconds between two reads right after a change
+    long max_interval; // milliseconds between two reads of an idle source
+    long interval; // milliseconds until the next read
+    long timeout; // milliseconds before a hanging reader is killed
+    // fingerprint of the last capture: an identical one is dropped right here,-
+    // without copying it or waking the index thread
+    unsigned long long last_hash;
+    size_t last_len;
+    int flag_last; // the fingerprint is set
+    int flag_skip_newline; // the reader writes '\n' before the contents(parcellite in file mode), it is dropped
+} CaptureSource;
+
+// capture thread
+/* it polls every source on its own reactor and pushes every capture into the ring, */
+/* so a slow index or history write never delays the next read; the readers of all */
+/* the sources run at the same time(each is a child process with its pipe in the epoll */
+/* set, its own timer and its own timeout), so a slow or hanging source never holds up */
+/* the others, and still only this thread pushes into the ring */
+typedef struct _capture_worker {
+    Reactor reactor;
+    ReactorSource stop; // eventfd, that stops the thread
+    CaptureSource * sources; // owned by the caller
+    int sources_count;
+    Ring * out; // captures for the index thread(a capture is dropped if it is full)
+    atomic_uint_least64_t skipped; // captures dropped, because they were identical to the last one of their source
+    pthread_t thread;
+} CaptureWorker;
+
+// initialize the capture(nothing is started)
+void capture_init(Capture *);
+// start the reader command(argv[0] is its path) in its own process group,-
+// with its stdout connected to the pipe
+/* return 1 on success and 0 if the command couldn't be started */
+int capture_start(Capture *, char **);
+// read what is available from the pipe into the buffer
+/* return 1 if something was read, 0 at EOF and -1 on error(errno is EAGAIN, */
+/* if the pipe was made non-blocking and is empty for now) */
+int capture_read(Capture *);
+// close the pipe and wait for the reader
+/* return 1 if the reader exited successfully and 0 otherwise */
+int capture_finish(Capture *);
+// start the reader, read its output until EOF and wait for it(return 1 on success)
+int capture_run(Capture *, char **);
+// read the whole file into the buffer(return 1 on success)
+int capture_read_file(Capture *, char *);
+// take the buffer over(it is shrunk to len + 1), the capture gets a new one
+char * capture_detach(Capture *);
+// free the buffer(and stop the reader, if it is still running)
+void capture_free(Capture *);
+// release function of the capture entries
+void capture_entry_free(Backing *);
+// set up the source(nothing is started)
+/* arguments: reader command, file written by the reader(NULL: the reader prints), */
+/* minimum and maximum poll interval and reader timeout in milliseconds */
+void capture_source_init(CaptureSource *, char **, char *, long, long, long);
+// start the capture thread, that polls the sources and pushes CaptureEntry pointers into the ring
+/* the sources are numbered from 1 in the order of the array; return 1 on success */
+int capture_worker_start(CaptureWorker *, Ring *, CaptureSource *, int);
+// stop the capture thread(the running readers are killed) and wait for it
+void capture_worker_stop(CaptureWorker *);
+
+#endif
@@ -0,0 +1,264 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "chunk_store.h"
+
+// number of chunks in one slab of the chunks pool
+#define CHUNKS_PER_SLAB 256
+// size of one block of the data arena(chunks up to a quarter of it share blocks)
+#define DATA_BLOCK_SIZE (4 * CHUNK_MAX_SIZE)
+// cut points: the top bits of the gear hash are zero(a stricter mask before the average length,-
+// a looser one after it, so the lengths crowd around the average)
+#define STRICT_BITS (CHUNK_AVG_BITS + 1)
+#define LOOSE_BITS (CHUNK_AVG_BITS - 1)
+// seed of the gear table(every device has to cut at the same places)
+#define GEAR_SEED 0x636c6970626f6172ULL
+// multipliers of the second content hash
+#define HASH2_PRIME 0x9e3779b97f4a7c15ULL
+#define HASH2_MIX 0xff51afd7ed558ccdULL
+
+// key of the index: the second hash and the data(NULL: the hashes are enough, e.g. for a name)
+typedef struct _chunk_key {
+    unsigned long long hash2;
+    const char * data;
+} ChunkKey;
+
+// random value of every byte, that the rolling hash adds
+static unsigned long long gear[256];
+static int flag_gear_ready = 0;
+
+// fill the gear table(the same on every device)
+static void init_gear(void);
+// second content hash of the data(word by word, little-endian everywhere)
+static unsigned long long hash2_bytes(const char *, size_t);
+// compare function for the index
+static int chunk_equal(const void *, const char *, size_t);
+// write the whole buffer to the fd
+static int write_full(int, const char *, size_t);
+
+void chunk_store_init(ChunkStore * store, size_t min_len) {
+    init_gear();
+    store->index = hash_index_create(1024, &chunk_equal);
+    pool_init(&store->chunks_pool, sizeof(Chunk), CHUNKS_PER_SLAB);
+    arena_init(&store->data, DATA_BLOCK_SIZE);
+    store->min_len = min_len;
+    store->count = store->bytes = 0;
+    store->mapping = NULL;
+    store->mapping_size = store->mapped = 0;
+}
+
+size_t chunk_cut(const char * data, size_t len) {
+    const unsigned char * p = (const unsigned char *) data;
+    unsigned long long hash = 0;
+    size_t i = CHUNK_MIN_SIZE, normal = (size_t) 1 << CHUNK_AVG_BITS;
+    if(len <= CHUNK_MIN_SIZE) return len;
+    if(len > CHUNK_MAX_SIZE) len = CHUNK_MAX_SIZE;
+    if(normal > len) normal = len;
+    // the hash is shifted every byte, so its top bits cover the last 64 bytes only
+    for(; i < normal; i++) {
+        hash = (hash << 1) + gear[p[i]];
+        if(!(hash >> (64 - STRICT_BITS))) return i + 1;
+    }
+    for(; i < len; i++) {
+        hash = (hash << 1) + gear[p[i]];
+        if(!(hash >> (64 - LOOSE_BITS))) return i + 1;
+    }
+    return len;
+}
+
+Chunk * chunk_store_add(ChunkStore * store, const char * data, size_t len) {
+    ChunkKey key;
+    Chunk * chunk;
+    unsigned long long hash = hash_bytes(data, len);
+    key.hash2 = hash2_bytes(data, len);
+    key.data = data;
+    if((chunk = (Chunk *) hash_index_find(store->index, (char *) &key, len, hash))) {
+        chunk->refs++;
+        return chunk;
+    }
+    chunk = (Chunk *) pool_alloc(&store->chunks_pool);
+    chunk->data = (char *) arena_alloc(&store->data, len);
+    memcpy(chunk->data, data, len);
+    chunk->len = len;
+    chunk->hash = hash;
+    chunk->hash2 = key.hash2;
+    chunk->refs = 1;
+    chunk->flag_saved = chunk->flag_saving = chunk->flag_mapped = 0;
+    hash_index_insert(store->index, chunk, len, hash);
+    store->count++;
+    store->bytes += len;
+    return chunk;
+}
+
+Chunk * chunk_store_add_mapped(ChunkStore * store, char * data, size_t len, unsigned long long hash, unsigned long long hash2, int flag_saved) {
+    Chunk * chunk;
+    if((chunk = chunk_store_find(store, hash, hash2, len))) {
+        chunk->refs++;
+        return chunk;
+    }
+    chunk = (Chunk *) pool_alloc(&store->chunks_pool);
+    chunk->data = data;
+    chunk->len = len;
+    chunk->hash = hash;
+    chunk->hash2 = hash2;
+    chunk->refs = 1;
+    chunk->flag_saved = flag_saved;
+    chunk->flag_saving = 0;
+    chunk->flag_mapped = 1;
+    hash_index_insert(store->index, chunk, len, hash);
+    store->count++;
+    store->bytes += len;
+    store->mapped++;
+    return chunk;
+}
+
+void chunk_store_keep_mapping(ChunkStore * store, char * data, size_t size) {
+    if(!store->mapped) {
+        munmap(data, size);
+        return;
+    }
+    store->mapping = data;
+    store->mapping_size = size;
+}
+
+Chunk * chunk_store_find(ChunkStore * store, unsigned long long hash, unsigned long long hash2, size_t len) {
+    ChunkKey key;
+    key.hash2 = hash2;
+    key.data = NULL;
+    return (Chunk *) hash_index_find(store->index, (char *) &key, len, hash);
+}
+
+void chunk_release(ChunkStore * store, Chunk * chunk) {
+    if(--chunk->refs) return;
+    hash_index_remove(store->index, chunk, chunk->hash);
+    store->count--;
+    store->bytes -= chunk->len;
+    if(!chunk->flag_mapped)
+        arena_free(&store->data, chunk->data);
+    else if(!--store->mapped && store->mapping) {
+        munmap(store->mapping, store->mapping_size);
+        store->mapping = NULL;
+    }
+    pool_free(&store->chunks_pool, chunk);
+}
+
+void chunk_store_free(ChunkStore * store) {
+    hash_index_free(store->index);
+    pool_destroy(&store->chunks_pool);
+    arena_destroy(&store->data);
+    if(store->mapping)
+        munmap(store->mapping, store->mapping_size);
+    store->index = NULL;
+    store->mapping = NULL;
+    store->count = store->bytes = store->mapped = 0;
+}
+
+void chunk_name(Chunk * chunk, char * name) {
+    snprintf(name, CHUNK_NAME_SIZE, "%016llx%016llx", chunk->hash, chunk->hash2);
+}
+
+int parse_chunk_name(const char * name, unsigned long long * hash, unsigned long long * hash2) {
+    char half[17];
+    for(int i = 0; i < CHUNK_NAME_SIZE - 1; i++)
+        if(!((name[i] >= '0' && name[i] <= '9') || (name[i] >= 'a' && name[i] <= 'f'))) return 0;
+    memcpy(half, name, 16);
+    half[16] = '\0';
+    *hash = strtoull(half, NULL, 16);
+    memcpy(half, name + 16, 16);
+    *hash2 = strtoull(half, NULL, 16);
+    return 1;
+}
+
+int chunk_save(char * directory, Chunk * chunk, int flag_sync) {
+    size_t dir_len = strlen(directory);
+    char * file_name = (char *) malloc(dir_len + 1 + CHUNK_NAME_SIZE + strlen(".tmp"));
+    char * tmp_file = (char *) malloc(dir_len + 1 + CHUNK_NAME_SIZE + strlen(".tmp"));
+    int fd, res = 1;
+    sprintf(file_name, "%s/", directory);
+    chunk_name(chunk, file_name + dir_len + 1);
+    // the name is the content, so an existing file is already right
+    if(access(file_name, F_OK)) {
+        sprintf(tmp_file, "%s.tmp", file_name);
+        if((fd = open(tmp_file, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) res = 0;
+        else {
+            res = write_full(fd, chunk->data, chunk->len) && (!flag_sync || !fdatasync(fd));
+            if(close(fd) || !res || rename(tmp_file, file_name)) {
+                unlink(tmp_file);
+                res = 0;
+            }
+        }
+    }
+    free(file_name);
+    free(tmp_file);
+    return res;
+}
+
+int chunk_load(char * directory, unsigned long long hash, unsigned long long hash2, size_t len, char * buf) {
+    char * file_name = (char *) malloc(strlen(directory) + 1 + CHUNK_NAME_SIZE);
+    size_t done = 0;
+    ssize_t count;
+    char extra;
+    int fd;
+    sprintf(file_name, "%s/%016llx%016llx", directory, hash, hash2);
+    fd = open(file_name, O_RDONLY);
+    free(file_name);
+    if(fd < 0) return 0;
+    while(done < len && ((count = read(fd, buf + done, len - done)) > 0 || (count < 0 && errno == EINTR)))
+        if(count > 0) done += count;
+    // a longer file is a different chunk
+    if(done == len && read(fd, &extra, 1) != 0) done = 0;
+    close(fd);
+    return done == len;
+}
+
+static void init_gear(void) {
+    unsigned long long state = GEAR_SEED, value;
+    if(flag_gear_ready) return;
+    // splitmix64
+    for(int i = 0; i < 256; i++) {
+        value = (state += 0x9e3779b97f4a7c15ULL);
+        value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        value = (value ^ (value >> 27)) * 0x94d049bb133111ebULL;
+        gear[i] = value ^ (value >> 31);
+    }
+    flag_gear_ready = 1;
+}
+
+static unsigned long long hash2_bytes(const char * data, size_t len) {
+    const unsigned char * p = (const unsigned char *) data;
+    unsigned long long hash = len * HASH2_PRIME, word;
+    size_t i = 0;
+    for(; i + 8 <= len; i += 8) {
+        word = 0;
+        for(int j = 7; j >= 0; j--)
+            word = (word << 8) | p[i + j];
+        hash = (hash ^ (word * HASH2_MIX)) * HASH2_PRIME;
+        hash ^= hash >> 29;
+    }
+    for(; i < len; i++)
+        hash = (hash ^ p[i]) * HASH2_PRIME;
+    hash ^= hash >> 33;
+    hash *= HASH2_MIX;
+    return hash ^ (hash >> 33);
+}
+
+static int chunk_equal(const void * value, const char * key, size_t len) {
+    const Chunk * chunk = (const Chunk *) value;
+    const ChunkKey * chunk_key = (const ChunkKey *) key;
+    return chunk->hash2 == chunk_key->hash2 && (!chunk_key->data || !memcmp(chunk->data, chunk_key->data, len));
+}
+
+static int write_full(int fd, const char * data, size_t len) {
+    ssize_t written;
+    while(len) {
+        if((written = write(fd, data, len)) < 0) {
+            if(errno == EINTR) continue;
+            return 0;
+        }
+        data += written;
+        len -= written;
+    }
+    return 1;
+}
@@ -0,0 +1,84 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "hash_index.h"
+#include "pool.h"
+
+#ifndef CHUNK_STORE_H
+#define CHUNK_STORE_H
+
+// bounds of the chunk length(only the last chunk of a payload may be shorter than the minimum)
+#define CHUNK_MIN_SIZE (4 * 1024)
+#define CHUNK_MAX_SIZE (64 * 1024)
+// bits of the boundary mask, so chunks are about 2^CHUNK_AVG_BITS bytes long
+#define CHUNK_AVG_BITS 14
+// length of the name of a chunk(two 64-bit content hashes in hex) with its '\0'
+#define CHUNK_NAME_SIZE 33
+// chunk files, that nothing refers to, are removed only after they are this old(seconds)
+/* another device may have pushed a history, that refers to them, but wasn't pulled yet */
+#define CHUNK_PRUNE_AGE (24 * 60 * 60)
+
+// piece of a payload, that is stored once however many payloads contain it
+typedef struct _chunk {
+    char * data; // never changes, so other threads may read it while they hold a reference
+    size_t len;
+    unsigned long long hash, hash2; // two independent content hashes(together they are the name)
+    int refs; // payloads(and history writes in flight) using the chunk
+    int flag_saved; // chunk file is written
+    int flag_saving; // chunk is handed to a history write, that is not finished yet
+    int flag_mapped; // data lies in the mapping of the store(see chunk_store_add_mapped), not in its arena
+} Chunk;
+
+// content-addressed store of the chunks of big payloads
+/* payloads are cut at content-defined boundaries(a gear rolling hash over the last bytes */
+/* decides, not the offset), so an insertion or a deletion in a long text changes only the */
+/* chunks around it, and near-identical payloads share all the other chunks */
+/* only the index thread touches the store */
+typedef struct _chunk_store {
+    HashIndex * index; // chunks by content
+    Pool chunks_pool; // all chunks are allocated from here
+    Arena data; // and all their data from here
+    size_t min_len; // payloads at least this long are chunked
+    size_t count; // live chunks
+    size_t bytes; // bytes of their data
+    char * mapping; // mapped file, that the data of some chunks lies in(NULL if there is none)
+    size_t mapping_size;
+    size_t mapped; // chunks in the mapping(it is unmapped with the last one)
+} ChunkStore;
+
+// initialize an empty store, that chunks payloads of at least min_len bytes
+void chunk_store_init(ChunkStore *, size_t);
+// length of the first chunk of len bytes of the buffer(the content-defined cut point)
+size_t chunk_cut(const char *, size_t);
+// get the chunk with len bytes of the data(it is added, unless the store has it already)
+/* the chunk gets one more reference */
+Chunk * chunk_store_add(ChunkStore *, const char *, size_t);
+// get the chunk with the name and len bytes of the data, that stays where it is(in a mapped file)
+/* nothing is read or copied: the name is trusted; the chunk gets one more reference and is */
+/* marked saved as flag_saved says; the mapping has to be handed over with chunk_store_keep_mapping */
+Chunk * chunk_store_add_mapped(ChunkStore *, char *, size_t, unsigned long long, unsigned long long, int);
+// hand the mapping(data and size), that the mapped chunks lie in, over to the store
+/* it is unmapped right away, if no chunk lies in it, or else with the last of them */
+/* the store takes one mapping only */
+void chunk_store_keep_mapping(ChunkStore *, char *, size_t);
+// find the chunk by its name(NULL if the store doesn't have it)
+Chunk * chunk_store_find(ChunkStore *, unsigned long long, unsigned long long, size_t);
+// drop one reference to the chunk(it is freed with the last one)
+void chunk_release(ChunkStore *, Chunk *);
+// free all the chunks at once
+void chunk_store_free(ChunkStore *);
+// write the name of the chunk into the buffer(at least CHUNK_NAME_SIZE bytes)
+void chunk_name(Chunk *, char *);
+// read the two hashes from a chunk name(return 1 on success and 0 otherwise)
+int parse_chunk_name(const char *, unsigned long long *, unsigned long long *);
+// write the chunk into its file in the directory(an existing file is kept)
+/* the file is written aside and renamed, so a reader never sees a partial chunk; with */
+/* flag_sync it is synced before the rename(the directory is synced by the caller, once */
+/* for all the chunks of a write, see sync_directory) */
+/* return 1 on success and 0 otherwise */
+int chunk_save(char *, Chunk *, int);
+// read the chunk with the name and len bytes from its file in the directory into the buffer
+/* return 1 if the file has exactly len bytes and 0 otherwise */
+int chunk_load(char *, unsigned long long, unsigned long long, size_t, char *);
+
+#endif
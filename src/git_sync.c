@@ -0,0 +1,148 @@
+#include <sys/epoll.h>
+#include "git_sync.h"
+
+// start the next queued request(if git is idle)
+static void run_next(GitSync *);
+// spawn the script of the running request(a failure to start is reported like a failed run)
+static void spawn(GitSync *);
+// the git script exited
+static void script_done(Reactor *, ReactorChild *, void *);
+// pull_timer handler
+static void pull_due(Reactor *, void *, uint32_t);
+// push_timer handler
+static void push_due(Reactor *, void *, uint32_t);
+// delay multiplied by 2^failures(capped at GIT_SYNC_MAX_BACKOFF times)
+static long backoff(long, int);
+
+int git_sync_init(GitSync * git, Reactor * reactor, char ** pull_args, char ** push_args, long pull_interval, long push_delay, long timeout, GitSyncPrepare prepare, GitSyncDone done, void * context) {
+    git->reactor = reactor;
+    reactor_child_init(&git->child);
+    git->queue_start = git->queue_size = 0;
+    git->running = 0;
+    git->flag_push_armed = git->flag_changed = 0;
+    git->pull_failures = git->push_failures = 0;
+    git->pull_args = pull_args;
+    git->push_args = push_args;
+    git->pull_interval = pull_interval;
+    git->push_delay = push_delay;
+    git->timeout = timeout;
+    git->prepare = prepare;
+    git->done = done;
+    git->context = context;
+    git->push_timer.fd = -1;
+    // the timers are one-shot: they are re-armed when their request finishes
+    if(!reactor_add(reactor, &git->pull_timer, reactor_timer_fd(0, 0), EPOLLIN, &pull_due, git))
+        return 0;
+    if(!reactor_add(reactor, &git->push_timer, reactor_timer_fd(0, 0), EPOLLIN, &push_due, git) ||
+        !reactor_timer_set(git->push_timer.fd, 0, 0)) {
+        reactor_remove(reactor, &git->pull_timer);
+        reactor_remove(reactor, &git->push_timer);
+        return 0;
+    }
+    return 1;
+}
+
+void git_sync_changed(GitSync * git) {
+    git->flag_changed = 1;
+    // the first change after a push starts the collection window, later ones just join it
+    if(git->flag_push_armed) return;
+    // a failed push is retried with its backoff anyway
+    if(git->push_failures) return;
+    if(reactor_timer_set(git->push_timer.fd, git->push_delay > 0 ? git->push_delay : 1, 0))
+        git->flag_push_armed = 1;
+}
+
+int git_sync_request(GitSync * git, int request) {
+    for(int i = 0; i < git->queue_size; i++)
+        if(git->queue[(git->queue_start + i) % GIT_SYNC_QUEUE_SIZE] == request)
+            return 1;
+    if(git->queue_size == GIT_SYNC_QUEUE_SIZE) return 0;
+    git->queue[(git->queue_start + git->queue_size++) % GIT_SYNC_QUEUE_SIZE] = request;
+    run_next(git);
+    return 1;
+}
+
+void git_sync_free(GitSync * git) {
+    reactor_child_kill(git->reactor, &git->child);
+    reactor_remove(git->reactor, &git->pull_timer);
+    reactor_remove(git->reactor, &git->push_timer);
+    git->running = 0;
+    git->queue_size = 0;
+}
+
+static void run_next(GitSync * git) {
+    int request;
+    while(!git->running && git->queue_size) {
+        request = git->queue[git->queue_start];
+        git->queue_start = (git->queue_start + 1) % GIT_SYNC_QUEUE_SIZE;
+        git->queue_size--;
+        git->running = request;
+        if(request == GIT_SYNC_PUSH) {
+            // everything changed up to now goes into this commit
+            git->flag_changed = 0;
+            // the push waits(as running) until it is prepared
+            if(git->prepare && !(*git->prepare)(git, git->context))
+                return;
+        }
+        spawn(git);
+    }
+}
+
+void git_sync_prepared(GitSync * git) {
+    if(git->running != GIT_SYNC_PUSH || git->child.pid) return;
+    spawn(git);
+}
+
+static void spawn(GitSync * git) {
+    if(reactor_spawn(git->reactor, &git->child, git->running == GIT_SYNC_PULL ? git->pull_args : git->push_args, git->timeout, &script_done, git))
+        return;
+    // couldn't even start: report it like a failed run
+    git->child.status = -1;
+    script_done(git->reactor, &git->child, git);
+}
+
+static void script_done(Reactor * reactor, ReactorChild * child, void * context) {
+    GitSync * git = (GitSync *) context;
+    int request = git->running, ok = reactor_child_ok(child);
+    git->running = 0;
+    if(request == GIT_SYNC_PULL) {
+        git->pull_failures = ok ? 0 : git->pull_failures + 1;
+        reactor_timer_set(git->pull_timer.fd, backoff(git->pull_interval, git->pull_failures), 0);
+    } else if(!ok) {
+        // retry the push(with all changes since) after the backoff
+        git->push_failures++;
+        git->flag_changed = 1;
+        if(reactor_timer_set(git->push_timer.fd, backoff(git->push_delay, git->push_failures), 0))
+            git->flag_push_armed = 1;
+    } else {
+        git->push_failures = 0;
+        // changes, that came during the push, start a new collection window
+        if(git->flag_changed)
+            git_sync_changed(git);
+    }
+    if(git->done)
+        (*git->done)(git, request, ok, git->context);
+    run_next(git);
+}
+
+static void pull_due(Reactor * reactor, void * context, uint32_t events) {
+    GitSync * git = (GitSync *) context;
+    if(!reactor_timer_read(git->pull_timer.fd)) return;
+    git_sync_request(git, GIT_SYNC_PULL);
+}
+
+static void push_due(Reactor * reactor, void * context, uint32_t events) {
+    GitSync * git = (GitSync *) context;
+    if(!reactor_timer_read(git->push_timer.fd)) return;
+    git->flag_push_armed = 0;
+    if(git->flag_changed)
+        git_sync_request(git, GIT_SYNC_PUSH);
+}
+
+static long backoff(long delay, int failures) {
+    long multiplier = 1;
+    if(delay < 1) delay = 1;
+    while(failures-- > 0 && multiplier < GIT_SYNC_MAX_BACKOFF)
+        multiplier *= 2;
+    return delay * multiplier;
+}
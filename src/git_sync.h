@@ -0,0 +1,62 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "reactor.h"
+
+#ifndef GIT_SYNC_H
+#define GIT_SYNC_H
+
+// git sync requests
+#define GIT_SYNC_PULL 1 // fetch the history of the other devices
+#define GIT_SYNC_PUSH 2 // commit the local history and push it
+// maximum number of queued requests(requests of the same type are coalesced anyway)
+#define GIT_SYNC_QUEUE_SIZE 4
+// failed requests are retried after their delay doubled for every failure in a row,-
+// up to this many times the delay
+#define GIT_SYNC_MAX_BACKOFF 64
+
+struct _git_sync;
+// called right before a push is started(e.g. to write the history file)
+/* return 1 to start the push at once, or 0 to start it later through git_sync_prepared */
+typedef int (*GitSyncPrepare)(struct _git_sync *, void *);
+// called when a request has finished(its type and 1 if it was successful)
+typedef void (*GitSyncDone)(struct _git_sync *, int, int, void *);
+
+// background git worker driven by the reactor
+/* the git scripts run as child processes one at a time, so the capture path */
+/* never waits for git; changes arriving while a push is pending or running */
+/* are coalesced into the next single commit */
+typedef struct _git_sync {
+    Reactor * reactor;
+    ReactorChild child; // git script, that is running
+    ReactorSource pull_timer; // next pull(re-armed after every pull)
+    ReactorSource push_timer; // next push(armed by the first change after a push)
+    int queue[GIT_SYNC_QUEUE_SIZE]; // pending requests(FIFO, no duplicates)
+    int queue_start, queue_size;
+    int running; // request, that is running or being prepared(0 if idle)
+    int flag_push_armed; // push_timer is armed
+    int flag_changed; // there are changes, that are not pushed yet
+    int pull_failures, push_failures; // failures in a row
+    char ** pull_args; // pull script and its arguments
+    char ** push_args; // push script and its arguments
+    long pull_interval; // milliseconds between pulls
+    long push_delay; // milliseconds, that changes are collected for before a push
+    long timeout; // milliseconds before a hanging script is killed
+    GitSyncPrepare prepare;
+    GitSyncDone done;
+    void * context; // context of the callbacks
+} GitSync;
+
+// initialize the worker and register its timers(the first pull is started at once)
+/* return 1 on success and 0 otherwise */
+int git_sync_init(GitSync *, Reactor *, char **, char **, long, long, long, GitSyncPrepare, GitSyncDone, void *);
+// note a change of the history(it will be pushed after push_delay, with all later ones)
+void git_sync_changed(GitSync *);
+// queue the request and start it if git is idle(a queued request of the same type absorbs it)
+/* return 1 if the request is queued or running and 0 if the queue is full */
+int git_sync_request(GitSync *, int);
+// start the push, that the prepare callback has deferred
+void git_sync_prepared(GitSync *);
+// kill the running script and unregister the timers
+void git_sync_free(GitSync *);
+
+#endif
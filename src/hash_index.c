@@ -0,0 +1,93 @@
+#include "hash_index.h"
+
+// FNV-1a 64-bit prime
+#define HASH_PRIME 1099511628211ULL
+// grow once the table is more than 7/10 full
+#define HASH_MAX_LOAD(capacity) ((capacity) / 10 * 7)
+
+static void hash_index_grow(HashIndex *);
+
+unsigned long long hash_bytes(const char * str, size_t len) {
+    return hash_bytes_update(HASH_SEED, str, len);
+}
+
+unsigned long long hash_bytes_update(unsigned long long hash, const char * str, size_t len) {
+    const unsigned char * p = (const unsigned char *) str;
+    for(size_t i = 0; i < len; i++) {
+        hash ^= p[i];
+        hash *= HASH_PRIME;
+    }
+    return hash;
+}
+
+HashIndex * hash_index_create(size_t size, int (*equal_func)(const void *, const char *, size_t)) {
+    HashIndex * index = (HashIndex *) malloc(sizeof(HashIndex));
+    index->capacity = 16;
+    while(HASH_MAX_LOAD(index->capacity) < size)
+        index->capacity *= 2;
+    index->slots = (HashSlot *) calloc(index->capacity, sizeof(HashSlot));
+    index->size = 0;
+    index->equal_func = equal_func;
+    return index;
+}
+
+void * hash_index_find(HashIndex * index, const char * key, size_t len, unsigned long long hash) {
+    size_t mask = index->capacity - 1;
+    for(size_t i = hash & mask; index->slots[i].value; i = (i + 1) & mask) {
+        HashSlot * slot = &index->slots[i];
+        if(slot->hash == hash && slot->len == len && (*index->equal_func)(slot->value, key, len))
+            return slot->value;
+    }
+    return NULL;
+}
+
+void hash_index_insert(HashIndex * index, void * value, size_t len, unsigned long long hash) {
+    size_t mask, i;
+    if(index->size + 1 > HASH_MAX_LOAD(index->capacity))
+        hash_index_grow(index);
+    mask = index->capacity - 1;
+    for(i = hash & mask; index->slots[i].value; i = (i + 1) & mask);
+    index->slots[i].hash = hash;
+    index->slots[i].len = len;
+    index->slots[i].value = value;
+    index->size++;
+}
+
+int hash_index_remove(HashIndex * index, void * value, unsigned long long hash) {
+    size_t mask = index->capacity - 1, i, j, home;
+    for(i = hash & mask; index->slots[i].value != value; i = (i + 1) & mask)
+        if(!index->slots[i].value) return 0;
+    // backward shift deletion: pull later entries of the cluster into the hole,-
+    // so that no tombstones are needed and probe sequences stay short
+    for(j = (i + 1) & mask; index->slots[j].value; j = (j + 1) & mask) {
+        home = index->slots[j].hash & mask;
+        // entry at j may fill the hole at i, only if its home slot is not in (i, j]
+        if(((j - home) & mask) >= ((j - i) & mask)) {
+            index->slots[i] = index->slots[j];
+            i = j;
+        }
+    }
+    index->slots[i].value = NULL;
+    index->size--;
+    return 1;
+}
+
+void hash_index_free(HashIndex * index) {
+    if(!index) return;
+    free(index->slots);
+    free(index);
+}
+
+static void hash_index_grow(HashIndex * index) {
+    HashSlot * old_slots = index->slots;
+    size_t old_capacity = index->capacity, mask, j;
+    index->capacity *= 2;
+    index->slots = (HashSlot *) calloc(index->capacity, sizeof(HashSlot));
+    mask = index->capacity - 1;
+    for(size_t i = 0; i < old_capacity; i++) {
+        if(!old_slots[i].value) continue;
+        for(j = old_slots[i].hash & mask; index->slots[j].value; j = (j + 1) & mask);
+        index->slots[j] = old_slots[i];
+    }
+    free(old_slots);
+}
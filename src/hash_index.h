@@ -0,0 +1,44 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifndef HASH_INDEX_H
+#define HASH_INDEX_H
+
+// initial value of the content hash(FNV-1a 64-bit offset basis)
+#define HASH_SEED 14695981039346656037ULL
+
+// hash index slot
+/* value == NULL marks an empty slot */
+typedef struct _hash_slot {
+    unsigned long long hash;
+    size_t len;
+    void * value;
+} HashSlot;
+
+// open-addressing(linear probing) hash index keyed by content hash plus length
+typedef struct _hash_index {
+    HashSlot * slots;
+    size_t capacity; // always a power of two
+    size_t size;
+    // returns 1 if the value holds exactly len bytes of key
+    int (*equal_func)(const void * value, const char * key, size_t len);
+} HashIndex;
+
+// hash len bytes of the buffer
+unsigned long long hash_bytes(const char *, size_t);
+// continue hashing from the previous hash value(for streamed input)
+unsigned long long hash_bytes_update(unsigned long long, const char *, size_t);
+// create an empty index with room for at least given number of values
+HashIndex * hash_index_create(size_t, int (*equal_func)(const void *, const char *, size_t));
+// find the value stored with the key(NULL if there is none)
+/* equal_func(i.e. full comparison) only runs when both hash and length match */
+void * hash_index_find(HashIndex *, const char *, size_t, unsigned long long);
+// insert the value with already computed hash and length of its key
+/* the caller makes sure that the key is not in the index yet */
+void hash_index_insert(HashIndex *, void *, size_t, unsigned long long);
+// remove exactly this value from the index(return 1 if it was there)
+int hash_index_remove(HashIndex *, void *, unsigned long long);
+// free the index(values are not touched)
+void hash_index_free(HashIndex *);
+
+#endif
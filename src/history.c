@@ -0,0 +1,518 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <ctype.h>
+#include <string.h>
+#include <limits.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "history.h"
+
+// line at p is a record header("NN:")
+#define IS_HEADER(p, end) ((p) + 3 <= (end) && isdigit((unsigned char) (p)[0]) && isdigit((unsigned char) (p)[1]) && (p)[2] == ':')
+// longest header, that is parsed("NN: ", three 64-bit numbers, HISTORY_CHUNKED and the length)
+#define HEADER_MAX 128
+
+// line at p is a header, possibly preceded by backslashes(so it has to be escaped with one more)
+static int is_escapable(char *, char *);
+// start of the line after the one at p
+static char * next_line(char *, char *);
+// write the records of the items to the stream
+static void write_history(Item *, FILE *);
+// newest capture of every device among the items(return their number, HISTORY_MAX_DEVICES + 1 if there are too many)
+static int collect_versions(Item *, HistoryVersion *);
+// copy the line at p into the buffer as a string(it is cut to the size of the buffer)
+static void copy_line(char *, char *, char *, size_t);
+// newest merged capture of the device(LLONG_MIN if none was merged yet)
+static long long seen_version(HistoryFile *, unsigned long long);
+// remember the newest merged capture of the device
+static void set_version(HistoryFile *, unsigned long long, long long);
+// close the file written aside and rename it over file_name(synced, if flag_sync is set)
+/* return 1 on success and 0 otherwise(the file written aside is removed then) */
+static int commit_file(FILE *, char *, char *, int);
+// unmap the history file(release function of its backing)
+static void unmap_history(Backing *);
+// compare function for sorting and finding chunk names(pairs of hashes)
+static int compare_names(const void *, const void *);
+
+void history_file_init(HistoryFile * history, char * file_name) {
+    history->file_name = file_name;
+    history->chunks_dir = NULL;
+    history->dev = 0;
+    history->ino = 0;
+    history->size = -1;
+    history->mtime.tv_sec = history->mtime.tv_nsec = 0;
+    history->versions_count = 0;
+}
+
+Backing * map_history(char * file_name) {
+    struct stat st;
+    Backing * backing;
+    void * data;
+    int fd = open(file_name, O_RDONLY);
+    if(fd < 0) return NULL;
+    if(fstat(fd, &st) || !st.st_size || (data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+        close(fd);
+        return NULL;
+    }
+    close(fd); // the mapping stays valid without the descriptor
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+    backing = (Backing *) malloc(sizeof(Backing));
+    backing->data = (char *) data;
+    backing->size = st.st_size;
+    backing->refs = 0;
+    backing->release_func = &unmap_history;
+    backing->prev = backing->next = NULL;
+    return backing;
+}
+
+int read_history_versions(Backing * map, size_t * offset, HistoryVersion * versions) {
+    char * end = map->data + map->size, * p = map->data + *offset, * line;
+    size_t line_size = sizeof(HISTORY_VERSIONS) + HISTORY_MAX_DEVICES * 48;
+    int count = 0, used;
+    if((size_t) (end - p) < strlen(HISTORY_VERSIONS) || memcmp(p, HISTORY_VERSIONS, strlen(HISTORY_VERSIONS))) return 0;
+    line = (char *) malloc(line_size);
+    copy_line(line, p, end, line_size);
+    *offset = next_line(p, end) - map->data;
+    for(char * q = line + strlen(HISTORY_VERSIONS); count < HISTORY_MAX_DEVICES &&
+        sscanf(q, " %llx:%lld%n", &versions[count].device, &versions[count].seq, &used) == 2; q += used)
+        count++;
+    free(line);
+    return count;
+}
+
+int next_history_record(Backing * map, size_t * offset, HistoryRecord * record) {
+    char * end = map->data + map->size, * p = map->data + *offset, header[HEADER_MAX];
+    // find the header and skip it
+    while(p < end && !IS_HEADER(p, end))
+        p = next_line(p, end);
+    if(p >= end) return 0;
+    // "NN: device seq hash", or just "NN:" in the files of older versions
+    copy_line(header, p, end, sizeof(header));
+    if(sscanf(header + 3, " %llx %lld", &record->device, &record->seq) != 2)
+        record->device = record->seq = 0;
+    record->flag_chunked = sscanf(header + 3, " %*x %*d %*x " HISTORY_CHUNKED " %zu", &record->chunked_len) == 1;
+    p = next_line(p, end);
+    // the element lasts until the next header
+    record->start = p;
+    record->flag_escaped = 0;
+    while(p < end && !IS_HEADER(p, end)) {
+        if(*p == '\\' && is_escapable(p, end))
+            record->flag_escaped = 1;
+        p = next_line(p, end);
+    }
+    record->len = p - record->start;
+    // last character in each record is added newline, so skip it
+    if(record->len && record->start[record->len - 1] == '\n')
+        record->len--;
+    *offset = p - map->data;
+    return 1;
+}
+
+size_t unescape_record(HistoryRecord * record, char * str) {
+    char * p = record->start, * end = record->start + record->len, * line_end;
+    size_t len = 0;
+    while(p < end) {
+        if(*p == '\\' && is_escapable(p, end))
+            p++;
+        line_end = next_line(p, end);
+        memcpy(str + len, p, line_end - p);
+        len += line_end - p;
+        p = line_end;
+    }
+    return len;
+}
+
+void read_clip_history(Queue * items, HistoryFile * history) {
+    struct stat st;
+    Backing * map;
+    HistoryRecord * records = NULL, * record;
+    HistoryVersion versions[HISTORY_MAX_DEVICES];
+    char ** copies = NULL;
+    size_t offset = 0;
+    int count = 0, size = 0, versions_count, flag_new = 0;
+    long long oldest_new = LLONG_MIN;
+
+    // skip the file, if it is the same as at the last read
+    if(stat(history->file_name, &st)) return;
+    if(st.st_dev == history->dev && st.st_ino == history->ino && st.st_size == history->size &&
+        st.st_mtim.tv_sec == history->mtime.tv_sec && st.st_mtim.tv_nsec == history->mtime.tv_nsec)
+    {
+        return;
+    }
+    history->dev = st.st_dev;
+    history->ino = st.st_ino;
+    history->size = st.st_size;
+    history->mtime = st.st_mtim;
+    if(!(map = map_history(history->file_name))) return;
+
+    // devices with captures, that are not merged yet, and the oldest of their last merged ones
+    /* without the vector(an old or a crowded file) every record is read */
+    if((versions_count = read_history_versions(map, &offset, versions))) {
+        for(int i = 0; i < versions_count; i++)
+            if(versions[i].seq > seen_version(history, versions[i].device)) {
+                if(!flag_new || seen_version(history, versions[i].device) < oldest_new)
+                    oldest_new = seen_version(history, versions[i].device);
+                flag_new = 1;
+            }
+        if(!flag_new) {
+            unmap_history(map);
+            return;
+        }
+    }
+    // collect new records(newest first), until the ones, that every device has merged already
+    while(count < items->capacity) {
+        if(count == size) {
+            size = size ? size * 2 : 16;
+            records = (HistoryRecord *) realloc(records, size * sizeof(HistoryRecord));
+            copies = (char **) realloc(copies, size * sizeof(char *));
+        }
+        record = &records[count];
+        if(!next_history_record(map, &offset, record)) break;
+        if(versions_count && record->seq <= oldest_new) break;
+        if(versions_count && record->seq <= seen_version(history, record->device)) continue;
+        // old headers have no stamp: every record gets one of its own, older than everything in the queue,-
+        // in the file order(they are read newest first)
+        if(!record->device && !record->seq)
+            record->seq = --items->oldest_seq;
+        copies[count] = NULL;
+        if(record->flag_chunked) {
+            // its chunks are not here(a broken sync), so the record can't be merged
+            if(!history->chunks_dir || !(copies[count] = load_chunked_record(record, items->chunk_store, history->chunks_dir))) continue;
+            record->start = copies[count];
+            record->len = record->chunked_len;
+        } else if(record->flag_escaped) {
+            // escaped element has to be copied without the escape characters
+            copies[count] = (char *) malloc(record->len);
+            record->len = unescape_record(record, copies[count]);
+            record->start = copies[count];
+        }
+        count++;
+    }
+    // merge them oldest first, each goes to its place by its stamp(overflowing items are evicted)
+    for(int i = count - 1; i >= 0; i--) {
+        merge_item(items, records[i].start, records[i].len, copies[i] ? NULL : map, hash_bytes(records[i].start, records[i].len),
+            records[i].device, records[i].seq);
+        free(copies[i]);
+    }
+    for(int i = 0; i < versions_count; i++)
+        set_version(history, versions[i].device, versions[i].seq);
+    free(records);
+    free(copies);
+    // nothing points into the mapping
+    if(!map->refs)
+        unmap_history(map);
+}
+
+void history_mark_merged(HistoryFile * history, Item * items_start) {
+    HistoryVersion versions[HISTORY_MAX_DEVICES];
+    int versions_count = collect_versions(items_start, versions);
+    for(int i = 0; i < versions_count && i < HISTORY_MAX_DEVICES; i++)
+        set_version(history, versions[i].device, versions[i].seq);
+}
+
+char * history_chunks_dir(char * file_name) {
+    char * slash = strrchr(file_name, '/');
+    size_t dir_len = slash ? (size_t) (slash - file_name + 1) : 0;
+    char * dir = (char *) malloc(dir_len + strlen("chunks") + 1);
+    memcpy(dir, file_name, dir_len);
+    strcpy(dir + dir_len, "chunks");
+    return dir;
+}
+
+char * load_chunked_record(HistoryRecord * record, ChunkStore * store, char * chunks_dir) {
+    char * p = record->start, * end = record->start + record->len, line[CHUNK_NAME_SIZE + 24];
+    char * payload = (char *) malloc(record->chunked_len ? record->chunked_len : 1);
+    unsigned long long hash, hash2;
+    size_t len, offset = 0;
+    Chunk * chunk;
+    // one "name len" line per chunk
+    for(; p < end; p = next_line(p, end)) {
+        copy_line(line, p, end, sizeof(line));
+        if(!parse_chunk_name(line, &hash, &hash2) || sscanf(line + CHUNK_NAME_SIZE - 1, " %zu", &len) != 1 ||
+            len > record->chunked_len - offset)
+        {
+            break;
+        }
+        // a chunk, that is in memory already, doesn't have to be read
+        if(store && (chunk = chunk_store_find(store, hash, hash2, len)))
+            memcpy(payload + offset, chunk->data, len);
+        else if(!chunk_load(chunks_dir, hash, hash2, len, payload + offset))
+            break;
+        offset += len;
+    }
+    if(p < end || offset != record->chunked_len) {
+        free(payload);
+        return NULL;
+    }
+    return payload;
+}
+
+int unsaved_chunks(Item * items_start, Chunk *** chunks) {
+    int count = 0, size = 0;
+    *chunks = NULL;
+    for(Item * item = items_start; item; item = item->next)
+        for(int i = 0; i < item->chunks_count; i++) {
+            if(item->chunks[i]->flag_saved || item->chunks[i]->flag_saving) continue;
+            if(count == size)
+                *chunks = (Chunk **) realloc(*chunks, (size = size ? size * 2 : 16) * sizeof(Chunk *));
+            // the write holds a reference, so the chunk outlives the items, that are evicted meanwhile
+            item->chunks[i]->flag_saving = 1;
+            item->chunks[i]->refs++;
+            (*chunks)[count++] = item->chunks[i];
+        }
+    return count;
+}
+
+void release_chunks(ChunkStore * store, Chunk ** chunks, int count, int flag_saved) {
+    for(int i = 0; i < count; i++) {
+        chunks[i]->flag_saving = 0;
+        if(flag_saved)
+            chunks[i]->flag_saved = 1;
+        chunk_release(store, chunks[i]);
+    }
+    free(chunks);
+}
+
+void forget_saved_chunks(Item * items_start) {
+    for(Item * item = items_start; item; item = item->next)
+        for(int i = 0; i < item->chunks_count; i++)
+            item->chunks[i]->flag_saved = 0;
+}
+
+void prune_chunks(char * data, size_t len, char * chunks_dir) {
+    Backing image;
+    HistoryRecord record;
+    HistoryVersion versions[HISTORY_MAX_DEVICES];
+    unsigned long long * names = NULL, name[2];
+    size_t offset = 0, count = 0, size = 0, dir_len = strlen(chunks_dir);
+    char line[CHUNK_NAME_SIZE + 24], * path, * p, * end;
+    struct dirent * entry;
+    struct stat st;
+    time_t now = time(NULL);
+    DIR * dir;
+    // names of the chunks, that the image refers to
+    image.data = data;
+    image.size = len;
+    read_history_versions(&image, &offset, versions);
+    while(next_history_record(&image, &offset, &record)) {
+        if(!record.flag_chunked) continue;
+        end = record.start + record.len;
+        for(p = record.start; p < end; p = next_line(p, end)) {
+            copy_line(line, p, end, sizeof(line));
+            if(!parse_chunk_name(line, &name[0], &name[1])) continue;
+            if(count == size)
+                names = (unsigned long long *) realloc(names, (size = size ? size * 2 : 64) * 2 * sizeof(unsigned long long));
+            names[2 * count] = name[0];
+            names[2 * count + 1] = name[1];
+            count++;
+        }
+    }
+    if(count)
+        qsort(names, count, 2 * sizeof(unsigned long long), &compare_names);
+    if((dir = opendir(chunks_dir))) {
+        path = (char *) malloc(dir_len + 1 + NAME_MAX + 1);
+        while((entry = readdir(dir))) {
+            // chunk files and the temporary files of the writes, that didn't finish
+            if(strlen(entry->d_name) < CHUNK_NAME_SIZE - 1 || !parse_chunk_name(entry->d_name, &name[0], &name[1]) ||
+                (entry->d_name[CHUNK_NAME_SIZE - 1] && strcmp(entry->d_name + CHUNK_NAME_SIZE - 1, ".tmp")))
+            {
+                continue;
+            }
+            if(!entry->d_name[CHUNK_NAME_SIZE - 1] && count && bsearch(name, names, count, 2 * sizeof(unsigned long long), &compare_names))
+                continue;
+            sprintf(path, "%s/%s", chunks_dir, entry->d_name);
+            if(!stat(path, &st) && now - st.st_mtime > CHUNK_PRUNE_AGE)
+                unlink(path);
+        }
+        free(path);
+        closedir(dir);
+    }
+    free(names);
+}
+
+long write_to_file(Item * items_start, char * HISTORY_CLIP_FILE, int flag_sync) {
+    char * tmp_file = (char *) malloc(strlen(HISTORY_CLIP_FILE) + strlen(".tmp") + 1);
+    FILE * fp;
+    long bytes;
+    strcpy(tmp_file, HISTORY_CLIP_FILE);
+    strcat(tmp_file, ".tmp");
+    if(!(fp = fopen(tmp_file, "w"))) {
+        free(tmp_file);
+        return -1;
+    }
+    write_history(items_start, fp);
+    bytes = ftell(fp);
+    if(!commit_file(fp, tmp_file, HISTORY_CLIP_FILE, flag_sync))
+        bytes = -1;
+    free(tmp_file);
+    return bytes;
+}
+
+char * history_image(Item * items_start, size_t * len) {
+    char * data = NULL;
+    FILE * fp = open_memstream(&data, len);
+    if(!fp) return NULL;
+    write_history(items_start, fp);
+    if(fclose(fp)) {
+        free(data);
+        return NULL;
+    }
+    return data;
+}
+
+long write_history_image(char * data, size_t len, char * HISTORY_CLIP_FILE, int flag_sync) {
+    char * tmp_file = (char *) malloc(strlen(HISTORY_CLIP_FILE) + strlen(".tmp") + 1);
+    FILE * fp;
+    long bytes = (long) len;
+    strcpy(tmp_file, HISTORY_CLIP_FILE);
+    strcat(tmp_file, ".tmp");
+    if(!(fp = fopen(tmp_file, "w"))) {
+        free(tmp_file);
+        return -1;
+    }
+    if(fwrite(data, 1, len, fp) != len) {
+        fclose(fp);
+        unlink(tmp_file);
+        bytes = -1;
+    } else if(!commit_file(fp, tmp_file, HISTORY_CLIP_FILE, flag_sync))
+        bytes = -1;
+    free(tmp_file);
+    return bytes;
+}
+
+int sync_directory(char * dir_name) {
+    int fd = open(dir_name, O_RDONLY | O_DIRECTORY), res;
+    if(fd < 0) return 0;
+    res = !fsync(fd);
+    close(fd);
+    return res;
+}
+
+static int commit_file(FILE * fp, char * tmp_file, char * file_name, int flag_sync) {
+    char * slash = strrchr(file_name, '/'), * dir_name;
+    int res;
+    // the data has to be on the disk before the rename is, or a crash may leave an empty file under the name
+    if(fflush(fp) || (flag_sync && fdatasync(fileno(fp)))) {
+        fclose(fp);
+        unlink(tmp_file);
+        return 0;
+    }
+    if(fclose(fp) || rename(tmp_file, file_name)) {
+        unlink(tmp_file);
+        return 0;
+    }
+    if(!flag_sync) return 1;
+    if(!slash) return sync_directory(".");
+    dir_name = strndup(file_name, slash == file_name ? 1 : (size_t) (slash - file_name));
+    res = sync_directory(dir_name);
+    free(dir_name);
+    return res;
+}
+
+static void write_history(Item * tmp, FILE * fp) {
+    HistoryVersion versions[HISTORY_MAX_DEVICES];
+    int count = 0, versions_count = collect_versions(tmp, versions), i;
+    size_t span_start;
+    char name[CHUNK_NAME_SIZE];
+    // with too many devices readers have to read every record
+    if(versions_count <= HISTORY_MAX_DEVICES) {
+        fputs(HISTORY_VERSIONS, fp);
+        for(i = 0; i < versions_count; i++)
+            fprintf(fp, " %llx:%lld", versions[i].device, versions[i].seq);
+        fputc('\n', fp);
+    }
+    while(tmp) {
+        if(tmp->chunks) {
+            // only the names of the chunks, their data is in the chunk files
+            fprintf(fp, "%02d: %llx %lld %llx " HISTORY_CHUNKED " %zu\n", count % 100, tmp->device, tmp->seq, tmp->hash, tmp->len);
+            for(i = 0; i < tmp->chunks_count; i++) {
+                chunk_name(tmp->chunks[i], name);
+                fprintf(fp, "%s %zu\n", name, tmp->chunks[i]->len);
+            }
+            tmp = tmp->next;
+            count++;
+            continue;
+        }
+        // only the record header format matters, not its number
+        fprintf(fp, "%02d: %llx %lld %llx\n", count % 100, tmp->device, tmp->seq, tmp->hash);
+        // write the element in spans, escaping lines that look like record headers
+        span_start = 0;
+        for(size_t i = 0; i + 3 <= tmp->len; i++) {
+            if((i == 0 || (tmp->elem)[i - 1] == '\n') && is_escapable(tmp->elem + i, tmp->elem + tmp->len))
+            {
+                fwrite(tmp->elem + span_start, 1, i - span_start, fp);
+                fputc('\\', fp);
+                span_start = i;
+            }
+        }
+        fwrite(tmp->elem + span_start, 1, tmp->len - span_start, fp);
+        fputc('\n', fp);
+        tmp = tmp->next;
+        count++;
+    }
+}
+
+static int collect_versions(Item * item, HistoryVersion * versions) {
+    int versions_count = 0, i;
+    // the queue is sorted by seq, so the first capture of a device is its newest one
+    for(; item; item = item->next) {
+        for(i = 0; i < versions_count && versions[i].device != item->device; i++);
+        if(i < versions_count) continue;
+        if(versions_count == HISTORY_MAX_DEVICES) return versions_count + 1;
+        versions[versions_count].device = item->device;
+        versions[versions_count++].seq = item->seq;
+    }
+    return versions_count;
+}
+
+static int is_escapable(char * p, char * end) {
+    while(p < end && *p == '\\')
+        p++;
+    return IS_HEADER(p, end);
+}
+
+static char * next_line(char * p, char * end) {
+    // memchr is vectorized by libc, so this scans 16-32 bytes per step
+    char * nl = (char *) memchr(p, '\n', end - p);
+    return nl ? nl + 1 : end;
+}
+
+static void copy_line(char * buf, char * p, char * end, size_t size) {
+    size_t len = next_line(p, end) - p;
+    if(len >= size) len = size - 1;
+    memcpy(buf, p, len);
+    buf[len] = '\0';
+}
+
+static long long seen_version(HistoryFile * history, unsigned long long device) {
+    for(int i = 0; i < history->versions_count; i++)
+        if(history->versions[i].device == device)
+            return history->versions[i].seq;
+    return LLONG_MIN;
+}
+
+static void set_version(HistoryFile * history, unsigned long long device, long long seq) {
+    int i;
+    for(i = 0; i < history->versions_count && history->versions[i].device != device; i++);
+    if(i == history->versions_count) {
+        // a device over the limit is merged from all of its records every time
+        if(i == HISTORY_MAX_DEVICES) return;
+        history->versions_count++;
+        history->versions[i].device = device;
+        history->versions[i].seq = LLONG_MIN;
+    }
+    if(seq > history->versions[i].seq)
+        history->versions[i].seq = seq;
+}
+
+static int compare_names(const void * a, const void * b) {
+    const unsigned long long * arg1 = (const unsigned long long *) a, * arg2 = (const unsigned long long *) b;
+    if(arg1[0] != arg2[0]) return arg1[0] > arg2[0] ? 1 : -1;
+    return (arg1[1] > arg2[1]) - (arg1[1] < arg2[1]);
+}
+
+static void unmap_history(Backing * backing) {
+    munmap(backing->data, backing->size);
+    free(backing);
+}
@@ -0,0 +1,110 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <time.h>
+#include "queue.h"
+
+#ifndef HISTORY_H
+#define HISTORY_H
+
+// most devices, whose newest captures are tracked(a file with more of them is merged in full)
+#define HISTORY_MAX_DEVICES 32
+// first line of the history file, that lists the newest capture of every device in it
+/* it is an "NN:" header without an element, which older readers skip(they only keep records with lines) */
+#define HISTORY_VERSIONS "00:#versions"
+// word in the header of a record, whose element is a list of chunks
+#define HISTORY_CHUNKED "chunked"
+
+// newest capture of one device(an entry of the version vector)
+typedef struct _history_version {
+    unsigned long long device;
+    long long seq;
+} HistoryVersion;
+
+// text history file, as it was when it was read the last time
+/* format: an optional HISTORY_VERSIONS line with " device:seq" for every device(a "#versions" */
+/* line of earlier files is skipped as it is, they are merged in full), then */
+/* records, newest first: a "NN: device seq hash" header line(the id of the capture, */
+/* see Item) followed by the element and '\n'; lines of the element that look like */
+/* headers(after any '\\'s) get one more '\\'; old "NN:" headers are still read; */
+/* a chunked item is written as a "NN: device seq hash chunked len" header followed by */
+/* a "name len" line for each of its chunks, that are files in the chunks directory(see */
+/* chunk_save), so a big paste, that differs a little from another one, adds only a few */
+/* chunk files to the history(and to the git push) */
+typedef struct _history_file {
+    char * file_name;
+    char * chunks_dir; // directory of the chunk files(NULL: chunked records are skipped)
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    HistoryVersion versions[HISTORY_MAX_DEVICES]; // newest merged capture of every device
+    int versions_count;
+} HistoryFile;
+
+// one record of the mapped history file
+typedef struct _history_record {
+    char * start; // first byte of the element(inside the mapping)
+    size_t len; // length of the element as it is stored
+    int flag_escaped; // element has escaped lines, so it can't be used without copying
+    int flag_chunked; // element is a list of chunks
+    size_t chunked_len; // length of the payload of a chunked record
+    unsigned long long device; // id of the capture(device and seq are 0 for old headers)
+    long long seq;
+} HistoryRecord;
+
+// initialize the state of the history file(nothing is read yet)
+void history_file_init(HistoryFile *, char *);
+// map the whole history file read-only(NULL if it is empty or couldn't be mapped)
+/* the mapping is released when the last item pointing into it lets go of it */
+Backing * map_history(char *);
+// find the record at or after the offset and move the offset past it(return 0 at the end)
+int next_history_record(Backing *, size_t *, HistoryRecord *);
+// copy the element of the record without the escape characters(returns its length)
+size_t unescape_record(HistoryRecord *, char *);
+// read the version vector at the start of the mapped file and move the offset past it
+/* return the number of versions(0 if there is no vector or it has too many devices) */
+int read_history_versions(Backing *, size_t *, HistoryVersion *);
+// merge the captures of other devices from the history file into the queue
+/* only records newer than the last merged capture of their device are read, and as the */
+/* records are sorted, reading stops at the oldest device that has something new, so the */
+/* cost follows the change, not the history; unescaped records are not copied: items */
+/* point right into the mapped file until they are moved; nothing is read, if the file */
+/* didn't change since the last call */
+void read_clip_history(Queue *, HistoryFile *);
+// take the captures of the items as merged from the history file(e.g. after a snapshot was restored)
+/* so that the next read_clip_history reads only the records, that are newer than them */
+void history_mark_merged(HistoryFile *, Item *);
+// directory of the chunk files of the history file("chunks" next to it, the result is malloc'ed)
+char * history_chunks_dir(char *);
+// assemble the payload of a chunked record from the store(or from the chunk files in the directory)
+/* return the payload(malloc'ed) or NULL if a chunk is missing */
+char * load_chunked_record(HistoryRecord *, ChunkStore *, char *);
+// chunks of the items, that are not saved yet(each one gets a reference and flag_saving)
+/* they have to be saved before a history file, that refers to them, is written */
+/* return their number, the array(malloc'ed, NULL if there are none) is stored */
+int unsaved_chunks(Item *, Chunk ***);
+// let go of the chunks, that unsaved_chunks returned, after the write(flag_saved: it succeeded)
+void release_chunks(ChunkStore *, Chunk **, int, int);
+// make the next write check the chunk files of the items again(a pull may have removed some)
+void forget_saved_chunks(Item *);
+// remove the chunk files in the directory, that the history image doesn't refer to
+/* only files older than CHUNK_PRUNE_AGE go, so chunks of the devices, that pushed a history */
+/* referring to them, but were not merged yet, stay */
+void prune_chunks(char *, size_t, char *);
+// write to history file
+/* the file is written aside and renamed over the old one, */
+/* so that mappings of the old file(and readers of it) stay valid */
+/* with flag_sync the new file is synced before the rename and its directory after it, so a */
+/* crash leaves either the old or the new history, never a partial one */
+/* return the number of bytes written and -1 on error */
+long write_to_file(Item *, char *, int);
+// build the contents of the history file in memory(NULL on error), its length is stored
+/* so that the file can be written by another thread, while the queue keeps changing */
+char * history_image(Item *, size_t *);
+// write the image built by history_image the same way as write_to_file does(with flag_sync too)
+long write_history_image(char *, size_t, char *, int);
+// sync the directory, so that the files renamed into it survive a crash(return 1 on success and 0 otherwise)
+int sync_directory(char *);
+
+#endif
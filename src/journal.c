@@ -0,0 +1,338 @@
+#define _GNU_SOURCE // IOV_MAX
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <stddef.h>
+#include <limits.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include "journal.h"
+
+// size of the record of the item in the journal
+#define RECORD_SIZE(item) ((off_t) sizeof(JournalRecord) + (off_t) (item)->len)
+
+// read the journal and apply its records to the queue(flag_legacy: records of the old format, from the start)
+static int replay(Journal *, Queue *, int);
+// checksum of the record with the hash of its payload(0 if it has none)
+static uint64_t record_checksum(JournalRecord *, unsigned long long);
+// read the header of the journal, or write it into an empty one
+/* return 1 for a journal of this format, 0 for one of the old format and -1 on error */
+static int check_header(Journal *);
+// rewrite the journal of the old format from the replayed queue
+static int convert_legacy(Journal *, Queue *);
+// replay listener, that forgets evicted items
+static void replay_listener(void *, Queue *, int, Item *);
+// compare function for the id index
+static int id_equal(const void *, const char *, size_t);
+// write all the items of the queue as INSERT records into the file(runs in the child)
+static int write_compacted(char *, Queue *);
+// append the records written since the compaction started and replace the journal
+static int finish_compaction(Journal *);
+// write all the buffers to the fd
+static int write_all(int, struct iovec *, int);
+// cut the torn bytes of a failed append off the file(or mark the journal broken), return 0
+static int append_failed(Journal *);
+
+int journal_open(Journal * journal, char * file_name, Queue * queue) {
+    int format = -1;
+    journal->file_name = file_name;
+    journal->compaction_pid = 0;
+    journal->flag_broken = 0;
+    journal->compaction_file = (char *) malloc(strlen(file_name) + strlen(".compact") + 1);
+    strcpy(journal->compaction_file, file_name);
+    strcat(journal->compaction_file, ".compact");
+    if((journal->fd = open(file_name, O_RDWR | O_CREAT | O_APPEND, 0644)) < 0 || (format = check_header(journal)) < 0 ||
+        !replay(journal, queue, !format) || (!format && !convert_legacy(journal, queue)))
+    {
+        if(journal->fd >= 0) close(journal->fd);
+        free(journal->compaction_file);
+        return 0;
+    }
+    // a compaction, that didn't finish before the previous exit, is useless now
+    unlink(journal->compaction_file);
+    // the header of a new journal(or the cut of a torn record) is made durable right away
+    journal->synced_size = 0;
+    journal_sync(journal);
+    return 1;
+}
+
+void journal_listener(void * context, Queue * queue, int event, Item * item) {
+    Journal * journal = (Journal *) context;
+    uint32_t flag_end = (item == queue->end && item != queue->start) ? JOURNAL_FLAG_END : 0;
+    if(event == QUEUE_INSERTED) {
+        journal_append(journal, JOURNAL_INSERT | flag_end, item);
+        journal->live_bytes += RECORD_SIZE(item);
+    } else if(event == QUEUE_MOVED)
+        journal_append(journal, JOURNAL_MOVE | flag_end, item);
+    else if(event == QUEUE_EVICTED) {
+        journal_append(journal, JOURNAL_EVICT, item);
+        journal->live_bytes -= RECORD_SIZE(item);
+    }
+}
+
+int journal_append(Journal * journal, uint32_t type, Item * item) {
+    JournalRecord record;
+    struct iovec iov[IOV_MAX];
+    int count = 1, pieces;
+    if(journal->flag_broken) return 0;
+    record.type = type;
+    record.len = ((type & 0xff) == JOURNAL_INSERT) ? (uint32_t) item->len : 0;
+    record.id = item->id;
+    // the item keeps the content hash of its payload, so the checksum costs nothing per byte
+    record.checksum = record_checksum(&record, record.len ? item->hash : 0);
+    iov[0].iov_base = &record;
+    iov[0].iov_len = sizeof(record);
+    // the payload goes out piece by piece(a chunked one has many), IOV_MAX pieces per writev
+    pieces = record.len ? item_pieces(item) : 0;
+    for(int i = 0; i < pieces; i++) {
+        iov[count].iov_base = item_piece(item, i, &iov[count].iov_len);
+        if(++count == IOV_MAX && i + 1 < pieces) {
+            if(!write_all(journal->fd, iov, count)) return append_failed(journal);
+            count = 0;
+        }
+    }
+    if(!write_all(journal->fd, iov, count)) return append_failed(journal);
+    journal->size += sizeof(record) + record.len;
+    return 1;
+}
+
+int journal_sync(Journal * journal) {
+    if(journal->synced_size == journal->size) return 1;
+    if(fdatasync(journal->fd)) return 0;
+    journal->synced_size = journal->size;
+    return 1;
+}
+
+void journal_maintain(Journal * journal, Queue * queue) {
+    off_t dead = journal->size - journal->live_bytes;
+    int status;
+    pid_t pid;
+    if(journal->compaction_pid) {
+        // compaction is running: check whether it is done
+        if(waitpid(journal->compaction_pid, &status, WNOHANG) != journal->compaction_pid) return;
+        journal->compaction_pid = 0;
+        if(!WIFEXITED(status) || WEXITSTATUS(status) || !finish_compaction(journal))
+            unlink(journal->compaction_file);
+        return;
+    }
+    // a broken journal is replaced by a compacted one as soon as possible
+    if(!journal->flag_broken && (dead < JOURNAL_COMPACT_MIN_DEAD || dead <= journal->live_bytes * JOURNAL_COMPACT_RATIO)) return;
+    // the child gets a copy-on-write snapshot of the queue and writes it out,-
+    // while this process keeps appending to the old journal
+    journal->compaction_start = journal->size;
+    pid = fork();
+    if(pid < 0) return;
+    if(!pid) _exit(write_compacted(journal->compaction_file, queue) ? 0 : 1);
+    journal->compaction_pid = pid;
+}
+
+void journal_close(Journal * journal) {
+    int status;
+    if(journal->compaction_pid) {
+        if(waitpid(journal->compaction_pid, &status, 0) != journal->compaction_pid ||
+            !WIFEXITED(status) || WEXITSTATUS(status) || !finish_compaction(journal))
+        {
+            unlink(journal->compaction_file);
+        }
+        journal->compaction_pid = 0;
+    }
+    journal_sync(journal);
+    close(journal->fd);
+    free(journal->compaction_file);
+}
+
+static int replay(Journal * journal, Queue * queue, int flag_legacy) {
+    JournalRecord record;
+    HashIndex * ids = hash_index_create(queue->capacity, &id_equal);
+    FILE * fp = fdopen(dup(journal->fd), "rb");
+    char * payload = NULL, * grown;
+    size_t payload_size = 0;
+    struct stat st;
+    int flag_failed = 0;
+    // records of the old format end before the checksum
+    size_t record_size = flag_legacy ? offsetof(JournalRecord, checksum) : sizeof(record);
+    off_t valid_end = flag_legacy ? 0 : (off_t) sizeof(JournalHeader);
+    Item * item;
+    if(!fp || fstat(journal->fd, &st) || fseeko(fp, valid_end, SEEK_SET)) {
+        if(fp) fclose(fp);
+        hash_index_free(ids);
+        return 0;
+    }
+    queue_add_listener(queue, &replay_listener, ids);
+    while(fread(&record, record_size, 1, fp) == 1) {
+        int flag_end = (record.type & JOURNAL_FLAG_END) != 0;
+        if((record.type & 0xff) == JOURNAL_INSERT) {
+            // a torn or garbage header may claim any length: one, that runs past the file, is a torn tail
+            if(record.len > st.st_size - valid_end - (off_t) record_size) break;
+            if(record.len > payload_size) {
+                if(!(grown = (char *) realloc(payload, record.len))) {
+                    flag_failed = 1;
+                    break;
+                }
+                payload = grown;
+                payload_size = record.len;
+            }
+            if(fread(payload, 1, record.len, fp) != record.len) break; // torn payload
+            // a record, that was written only partly(or not at all) before a crash, ends the journal
+            if(!flag_legacy && record.checksum != record_checksum(&record, hash_bytes(payload, record.len))) break;
+            // the record carries the length, so a payload with '\0' in it comes back whole
+            if(insert_item_backed(queue, payload, record.len, NULL, flag_end)) {
+                item = flag_end ? queue->end : queue->start;
+                item->id = record.id;
+                hash_index_insert(ids, item, sizeof(record.id), record.id);
+            }
+            if(record.id >= queue->next_id)
+                queue->next_id = record.id + 1;
+        } else if(!flag_legacy && record.checksum != record_checksum(&record, 0)) break;
+        else if((item = (Item *) hash_index_find(ids, (char *) &record.id, sizeof(record.id), record.id))) {
+            if((record.type & 0xff) == JOURNAL_MOVE)
+                move_item(queue, item, flag_end);
+            else if((record.type & 0xff) == JOURNAL_EVICT)
+                delete_item(queue, item);
+        }
+        valid_end += record_size + ((record.type & 0xff) == JOURNAL_INSERT ? record.len : 0);
+    }
+    fclose(fp);
+    free(payload);
+    queue_remove_listener(queue, &replay_listener, ids);
+    hash_index_free(ids);
+    // out of memory is not a torn record: the rest of the journal is kept
+    if(flag_failed) return 0;
+    // cut off the torn record(if any), so that new records follow the last complete one
+    if(lseek(journal->fd, 0, SEEK_END) != valid_end && ftruncate(journal->fd, valid_end)) return 0;
+    journal->size = valid_end;
+    journal->live_bytes = 0;
+    for(item = queue->start; item; item = item->next)
+        journal->live_bytes += RECORD_SIZE(item);
+    return 1;
+}
+
+static uint64_t record_checksum(JournalRecord * record, unsigned long long payload_hash) {
+    return hash_bytes_update(payload_hash, (const char *) record, offsetof(JournalRecord, checksum));
+}
+
+static int check_header(Journal * journal) {
+    JournalHeader header;
+    ssize_t count = pread(journal->fd, &header, sizeof(header), 0);
+    if(count < 0) return -1;
+    if(!count) {
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, JOURNAL_MAGIC, sizeof(header.magic));
+        header.version = JOURNAL_VERSION;
+        return write(journal->fd, &header, sizeof(header)) == sizeof(header) ? 1 : -1;
+    }
+    if(count < (ssize_t) sizeof(header) || memcmp(header.magic, JOURNAL_MAGIC, sizeof(header.magic))) return 0;
+    // a journal of a newer format is left alone
+    return header.version == JOURNAL_VERSION ? 1 : -1;
+}
+
+static int convert_legacy(Journal * journal, Queue * queue) {
+    struct stat st;
+    int fd;
+    if(!write_compacted(journal->compaction_file, queue) || rename(journal->compaction_file, journal->file_name) ||
+        (fd = open(journal->file_name, O_RDWR | O_APPEND)) < 0)
+    {
+        unlink(journal->compaction_file);
+        return 0;
+    }
+    close(journal->fd);
+    journal->fd = fd;
+    if(fstat(fd, &st)) return 0;
+    journal->size = st.st_size;
+    return 1;
+}
+
+static void replay_listener(void * context, Queue * queue, int event, Item * item) {
+    if(event == QUEUE_EVICTED)
+        hash_index_remove((HashIndex *) context, item, item->id);
+}
+
+static int id_equal(const void * value, const char * key, size_t len) {
+    return ((const Item *) value)->id == *(const uint64_t *) key;
+}
+
+static int write_compacted(char * file_name, Queue * queue) {
+    FILE * fp = fopen(file_name, "wb");
+    JournalHeader header;
+    JournalRecord record;
+    size_t len;
+    char * piece;
+    int res;
+    if(!fp) return 0;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, JOURNAL_MAGIC, sizeof(header.magic));
+    header.version = JOURNAL_VERSION;
+    res = fwrite(&header, sizeof(header), 1, fp) == 1;
+    // oldest first, so that replaying the INSERTs rebuilds the same order
+    for(Item * item = queue->end; item && res; item = item->prev) {
+        record.type = JOURNAL_INSERT;
+        record.len = (uint32_t) item->len;
+        record.id = item->id;
+        record.checksum = record_checksum(&record, item->hash);
+        res = fwrite(&record, sizeof(record), 1, fp) == 1;
+        for(int i = 0; res && i < item_pieces(item); i++) {
+            piece = item_piece(item, i, &len);
+            res = fwrite(piece, 1, len, fp) == len;
+        }
+    }
+    if(fflush(fp) || fdatasync(fileno(fp))) res = 0;
+    return fclose(fp) == 0 && res;
+}
+
+static int finish_compaction(Journal * journal) {
+    char buf[64 * 1024];
+    struct iovec iov;
+    struct stat st;
+    ssize_t count;
+    off_t offset = journal->compaction_start;
+    int fd = open(journal->compaction_file, O_RDWR | O_APPEND);
+    if(fd < 0) return 0;
+    // records appended while the child was writing belong after the snapshot(torn bytes after them don't)
+    while(offset < journal->size) {
+        count = journal->size - offset < (off_t) sizeof(buf) ? journal->size - offset : (off_t) sizeof(buf);
+        if((count = pread(journal->fd, buf, count, offset)) <= 0) break;
+        iov.iov_base = buf;
+        iov.iov_len = count;
+        if(!write_all(fd, &iov, 1)) break;
+        offset += count;
+    }
+    if(offset < journal->size || fdatasync(fd) || fstat(fd, &st) || rename(journal->compaction_file, journal->file_name)) {
+        close(fd);
+        return 0;
+    }
+    close(journal->fd);
+    journal->fd = fd;
+    journal->size = journal->synced_size = st.st_size;
+    journal->flag_broken = 0;
+    return 1;
+}
+
+static int write_all(int fd, struct iovec * iov, int count) {
+    ssize_t written;
+    while(count) {
+        if((written = writev(fd, iov, count)) < 0) {
+            if(errno == EINTR) continue;
+            return 0;
+        }
+        // skip the fully written buffers and move into the partially written one
+        while(count && (size_t) written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if(count) {
+            iov->iov_base = (char *) iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+    return 1;
+}
+
+static int append_failed(Journal * journal) {
+    // replay stops at the first bad checksum, so the torn bytes would hide every later record
+    if(ftruncate(journal->fd, journal->size))
+        journal->flag_broken = 1;
+    return 0;
+}
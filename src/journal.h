@@ -0,0 +1,78 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "queue.h"
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+// journal record types
+#define JOURNAL_INSERT 1 // new item(the payload follows the record)
+#define JOURNAL_MOVE 2 // item with the id was moved
+#define JOURNAL_EVICT 3 // item with the id was evicted
+// record flag: item was linked at the end of the queue, not at the start
+#define JOURNAL_FLAG_END 0x100
+// compact once dead records take more than this many bytes...
+#define JOURNAL_COMPACT_MIN_DEAD (1024 * 1024)
+// ...and more than live records do
+#define JOURNAL_COMPACT_RATIO 1
+
+// first bytes of a journal file(a file without them is a journal of the old format, see journal_open)
+#define JOURNAL_MAGIC "CLIPJRNL"
+#define JOURNAL_VERSION 2
+
+// journal file header
+typedef struct _journal_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+} JournalHeader;
+
+// journal record header(all numbers in host byte order)
+typedef struct _journal_record {
+    uint32_t type;
+    uint32_t len; // payload length(only JOURNAL_INSERT has payload)
+    uint64_t id; // id of the item
+    uint64_t checksum; // hash of the fields above and of the payload(see record_checksum in journal.c)
+} JournalRecord;
+
+// append-only binary history journal
+/* every change of the queue is appended as one record, so a capture costs */
+/* O(its own length), and the file is rewritten only by the compaction */
+/* the appends are not synced one by one: journal_sync makes everything appended so far */
+/* durable with one fdatasync, so the changes of a whole window share it(group commit); */
+/* a crash can only lose or tear the records after the last sync, and the replay stops at */
+/* the first record, whose checksum doesn't match, and cuts it off with all, that follows; */
+/* an append, that fails halfway, is cut off right away, so the later records stay readable */
+typedef struct _journal {
+    char * file_name;
+    int fd;
+    off_t size; // bytes in the journal file
+    off_t synced_size; // bytes, that were synced(see journal_sync)
+    off_t live_bytes; // bytes of the INSERT records of the items that are still in the queue
+    pid_t compaction_pid; // child process, that is compacting the journal(0 if none)
+    off_t compaction_start; // journal size, when the compaction was started
+    char * compaction_file; // file, where the compacted journal is written
+    int flag_broken; // a torn append couldn't be cut off: nothing is appended, until a compaction replaces the file
+} Journal;
+
+// open(or create) the journal and replay it into the empty queue
+/* a torn record at the end of the file(e.g. after a crash) is cut off; a journal of the */
+/* old format(records without checksums) is replayed and rewritten in the new one */
+/* return 1 on success and 0 if the journal couldn't be opened */
+int journal_open(Journal *, char *, Queue *);
+// queue listener, that appends a record for every change
+void journal_listener(void *, Queue *, int, Item *);
+// append one record(payload is written only for JOURNAL_INSERT)
+/* return 1 on success and 0 otherwise(the file is left as it was before the append) */
+int journal_append(Journal *, uint32_t, Item *);
+// sync the records appended since the last sync(return 1 on success and 0 otherwise)
+int journal_sync(Journal *);
+// start the background compaction if there are too many dead records,-
+// and finish it if the compacting child is done
+void journal_maintain(Journal *, Queue *);
+// wait for the compaction(if running), sync and close the journal
+void journal_close(Journal *);
+
+#endif
@@ -0,0 +1,228 @@
+#define _GNU_SOURCE // IOV_MAX
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <string.h>
+#include <strings.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/uio.h>
+#include <sys/eventfd.h>
+#include "logger.h"
+
+// level names, as they appear in the lines
+static const char * level_names[] = {"DEBUG", "INFO", "WARN", "ERROR"};
+
+// body of the flush thread
+static void * flush_main(void *);
+// write the ready lines(at most IOV_MAX) and hand their slots back, return the number written
+static size_t flush_lines(Logger *);
+// move the file to file_name.1 and start a new one
+static void rotate(Logger *);
+// write the timestamp and the level of the line, return its length
+static int format_prefix(char *, int);
+// write all the buffers to the fd
+static int write_all(int, struct iovec *, int);
+
+int logger_start(Logger * logger, char * file_name, int level, off_t max_bytes) {
+    sigset_t all, old;
+    size_t i;
+    logger->file_name = file_name;
+    logger->level = level;
+    logger->max_bytes = max_bytes;
+    logger->size = 0;
+    logger->dropped_reported = 0;
+    logger->mask = LOG_RING_SIZE - 1;
+    logger->rotated_name = (char *) malloc(strlen(file_name) + strlen(".1") + 1);
+    strcpy(logger->rotated_name, file_name);
+    strcat(logger->rotated_name, ".1");
+    if(!(logger->slots = (LogSlot *) malloc(LOG_RING_SIZE * sizeof(LogSlot)))) {
+        free(logger->rotated_name);
+        return 0;
+    }
+    // slot i is free for ticket i
+    for(i = 0; i < LOG_RING_SIZE; i++)
+        atomic_init(&logger->slots[i].seq, i);
+    atomic_init(&logger->tail, 0);
+    atomic_init(&logger->head, 0);
+    atomic_init(&logger->dropped, 0);
+    atomic_init(&logger->flag_stop, 0);
+    logger->wake_fd = -1;
+    if((logger->fd = open(file_name, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644)) < 0 ||
+        (logger->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+    {
+        logger_stop(logger);
+        return 0;
+    }
+    // the flush thread never takes the signals, that the main thread reads from its signalfd
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    if(pthread_create(&logger->thread, NULL, &flush_main, logger)) {
+        pthread_sigmask(SIG_SETMASK, &old, NULL);
+        close(logger->wake_fd);
+        logger->wake_fd = -1;
+        logger_stop(logger);
+        return 0;
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    return 1;
+}
+
+void log_write(Logger * logger, int level, const char * format, ...) {
+    size_t pos, seq;
+    LogSlot * slot;
+    va_list args;
+    int len, count;
+    uint64_t one = 1;
+    if(level < logger->level || !logger->slots) return;
+    pos = atomic_load_explicit(&logger->tail, memory_order_relaxed);
+    // take the ticket, whose slot is free(its seq is the ticket itself)
+    for(;;) {
+        slot = &logger->slots[pos & logger->mask];
+        seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        if(seq == pos) {
+            if(atomic_compare_exchange_weak_explicit(&logger->tail, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed)) break;
+        } else if((intptr_t) (seq - pos) < 0) {
+            // the flush thread hasn't written this slot a lap ago yet: the ring is full
+            atomic_fetch_add_explicit(&logger->dropped, 1, memory_order_relaxed);
+            return;
+        } else pos = atomic_load_explicit(&logger->tail, memory_order_relaxed);
+    }
+    len = format_prefix(slot->text, level);
+    va_start(args, format);
+    count = vsnprintf(slot->text + len, LOG_LINE_SIZE - 1 - len, format, args);
+    va_end(args);
+    // a longer message is cut, there is always room for '\n'
+    if(count > 0)
+        len += count < LOG_LINE_SIZE - 2 - len ? count : LOG_LINE_SIZE - 2 - len;
+    slot->text[len++] = '\n';
+    slot->len = (size_t) len;
+    // the line is written before the flush thread can see the slot as ready
+    atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+    // the flush thread sleeps LOG_FLUSH_MS unless the ring is getting full or something went wrong
+    if(level >= LOG_ERROR || pos + 1 - atomic_load_explicit(&logger->head, memory_order_relaxed) == LOG_RING_SIZE / 2)
+        if(write(logger->wake_fd, &one, sizeof(one)) < 0) {} // only fails if the counter is saturated, which still wakes up
+}
+
+void logger_stop(Logger * logger) {
+    uint64_t one = 1;
+    if(logger->wake_fd >= 0) {
+        atomic_store(&logger->flag_stop, 1);
+        if(write(logger->wake_fd, &one, sizeof(one)) >= 0)
+            pthread_join(logger->thread, NULL);
+        close(logger->wake_fd);
+    }
+    // the flush thread is gone, lines logged meanwhile are written by this one
+    if(logger->fd >= 0)
+        while(flush_lines(logger));
+    if(logger->fd >= 0)
+        close(logger->fd);
+    free(logger->slots);
+    free(logger->rotated_name);
+    logger->slots = NULL;
+    logger->rotated_name = NULL;
+    logger->wake_fd = logger->fd = -1;
+}
+
+int log_level(const char * name) {
+    for(int i = LOG_DEBUG; i <= LOG_ERROR; i++)
+        if(!strcasecmp(name, level_names[i])) return i;
+    return LOG_INFO;
+}
+
+static void * flush_main(void * context) {
+    Logger * logger = (Logger *) context;
+    struct pollfd fd;
+    uint64_t count, dropped;
+    int flag_stop;
+    fd.fd = logger->wake_fd;
+    fd.events = POLLIN;
+    for(;;) {
+        if(poll(&fd, 1, LOG_FLUSH_MS) < 0 && errno != EINTR) break;
+        if(read(logger->wake_fd, &count, sizeof(count)) < 0) {} // EAGAIN: woken by the timeout
+        flag_stop = atomic_load(&logger->flag_stop);
+        while(flush_lines(logger) == IOV_MAX);
+        // the drops are reported as a line of their own(it goes out with the next flush)
+        dropped = atomic_load_explicit(&logger->dropped, memory_order_relaxed);
+        if(dropped > logger->dropped_reported) {
+            log_write(logger, LOG_WARN, "%llu log lines were dropped(the ring was full)", (unsigned long long) (dropped - logger->dropped_reported));
+            logger->dropped_reported = dropped;
+        }
+        if(flag_stop) break;
+    }
+    return NULL;
+}
+
+static size_t flush_lines(Logger * logger) {
+    struct iovec iov[IOV_MAX];
+    size_t start = atomic_load_explicit(&logger->head, memory_order_relaxed), head = start, count = 0;
+    off_t bytes = 0;
+    LogSlot * slot;
+    // the ready lines in ticket order(a slot, that is still being written, ends the batch)
+    while(count < IOV_MAX) {
+        slot = &logger->slots[head & logger->mask];
+        if(atomic_load_explicit(&slot->seq, memory_order_acquire) != head + 1) break;
+        iov[count].iov_base = slot->text;
+        iov[count].iov_len = slot->len;
+        bytes += slot->len;
+        count++;
+        head++;
+    }
+    if(!count) return 0;
+    if(logger->max_bytes && logger->size && logger->size + bytes > logger->max_bytes)
+        rotate(logger);
+    // lines, that can't be written, are lost(there is nowhere to report it)
+    if(logger->fd >= 0 && write_all(logger->fd, iov, (int) count))
+        logger->size += bytes;
+    // the slots are free for the tickets a lap later
+    for(size_t i = start; i < head; i++)
+        atomic_store_explicit(&logger->slots[i & logger->mask].seq, i + logger->mask + 1, memory_order_release);
+    atomic_store_explicit(&logger->head, head, memory_order_release);
+    return count;
+}
+
+static void rotate(Logger * logger) {
+    close(logger->fd);
+    rename(logger->file_name, logger->rotated_name);
+    logger->fd = open(logger->file_name, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+    logger->size = 0;
+}
+
+static int format_prefix(char * text, int level) {
+    // the date part changes once a second, so every thread keeps its last one
+    static __thread time_t second = -1;
+    static __thread char date[32];
+    struct timespec ts;
+    struct tm tm;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    if(ts.tv_sec != second) {
+        localtime_r(&ts.tv_sec, &tm);
+        strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", &tm);
+        second = ts.tv_sec;
+    }
+    return sprintf(text, "%s.%03ld %-5s ", date, ts.tv_nsec / 1000000, level_names[level]);
+}
+
+static int write_all(int fd, struct iovec * iov, int count) {
+    ssize_t written;
+    while(count) {
+        if((written = writev(fd, iov, count)) < 0) {
+            if(errno == EINTR) continue;
+            return 0;
+        }
+        // skip the fully written buffers and move into the partially written one
+        while(count && (size_t) written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if(count) {
+            iov->iov_base = (char *) iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+    return 1;
+}
@@ -0,0 +1,67 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include "ring.h"
+
+#ifndef LOGGER_H
+#define LOGGER_H
+
+// message levels(messages below the level of the logger are dropped right away)
+#define LOG_DEBUG 0
+#define LOG_INFO 1
+#define LOG_WARN 2
+#define LOG_ERROR 3
+// longest line(with the timestamp and '\n'), longer messages are cut
+#define LOG_LINE_SIZE 256
+// lines, that may wait for the flush(later ones are dropped and counted)
+#define LOG_RING_SIZE 1024
+// milliseconds between the flushes while the ring is filling slowly
+#define LOG_FLUSH_MS 200
+
+// one line in the ring
+typedef struct _log_slot {
+    atomic_size_t seq; // ticket, that the slot is ready for(see log_write)
+    size_t len;
+    char text[LOG_LINE_SIZE];
+} LogSlot;
+
+// asynchronous log file
+/* any thread formats its line(timestamp, level, message) right into a slot of a bounded */
+/* lock-free multi-producer ring: a slot is taken with one compare-and-swap and published */
+/* with one release store, so logging costs no lock and no system call; the flush thread */
+/* writes the ready lines with one writev every LOG_FLUSH_MS(or once the ring is half */
+/* full, or right after an error) and moves the file to FILE.1 once it outgrows max_bytes */
+/* a full ring drops the line instead of blocking the caller(the count is logged later) */
+typedef struct _logger {
+    LogSlot * slots;
+    size_t mask; // LOG_RING_SIZE - 1
+    _Alignas(RING_CACHE_LINE) atomic_size_t tail; // next ticket to take(by any thread)
+    _Alignas(RING_CACHE_LINE) atomic_size_t head; // next line to write(written by the flush thread)
+    atomic_uint_least64_t dropped; // lines lost, because the ring was full
+    uint64_t dropped_reported;
+    int level; // lowest level, that is logged
+    char * file_name;
+    char * rotated_name; // file_name.1
+    int fd;
+    off_t size; // bytes in the file
+    off_t max_bytes; // size, that the file is rotated at(0: never)
+    int wake_fd; // eventfd, that wakes the flush thread early
+    atomic_int flag_stop;
+    pthread_t thread;
+} Logger;
+
+// open(truncate) the log file and start the flush thread
+/* arguments: logger, file name, level, size of the file to rotate at in bytes(0: never) */
+/* return 1 on success and 0 otherwise */
+int logger_start(Logger *, char *, int, off_t);
+// format the message(printf-like) into the ring, if its level is logged
+void log_write(Logger *, int, const char *, ...) __attribute__((format(printf, 3, 4)));
+// write what is left in the ring, stop the flush thread and close the file
+void logger_stop(Logger *);
+// level of the name("debug", "info", "warn" or "error"), LOG_INFO if it is unknown
+int log_level(const char *);
+
+#endif
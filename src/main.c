@@ -10,13 +10,78 @@
 #include <fcntl.h>
 #include <ctype.h>
 #include <time.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
 #include "avl_tree.h"
-
-// clipboard item structure
-typedef struct _item {
-    char * elem;
-    struct _item * prev, * next;
-} Item;
+#include "queue.h"
+#include "journal.h"
+#include "history.h"
+#include "snapshot.h"
+#include "capture.h"
+#include "reactor.h"
+#include "git_sync.h"
+#include "stats.h"
+#include "ring.h"
+#include "persist.h"
+#include "trigram_index.h"
+#include "query_server.h"
+#include "logger.h"
+
+// upper bound for the customly selected clipboard size
+#define MAX_CLIPBOARD_SIZE 100000
+// captures, that may wait for the index thread(later ones are dropped)
+#define CAPTURE_RING_SIZE 64
+// history writes in flight(only one push is prepared at a time)
+#define PERSIST_RING_SIZE 4
+// longest name of a capture source(it is shown in every listed entry)
+#define SOURCE_NAME_MAX 31
+
+// state of the event loop(handlers get it as their context)
+/* the daemon is a pipeline of three threads connected by lock-free rings: */
+/*   - capture thread: runs the readers of all the sources, each faster while it changes(see CaptureWorker) */
+/*   - index thread(this loop): inserts the captures, appends the journal, runs git */
+/*   - persistence thread: writes the text history file(see PersistWorker) */
+/* so a slow reader, a big history write or a git run never holds up the other stages; */
+/* the git scripts are child processes watched through pidfds, the cadences are timerfds */
+typedef struct _daemon_loop {
+    Reactor reactor;
+    ReactorSource signals; // SIGINT and SIGTERM stop the loop, SIGUSR2 dumps the stats,-
+    // SIGUSR1(sent by the reader script) is dropped
+    ReactorSource captured; // new captures in capture_ring
+    ReactorSource persisted; // written history files in persisted_ring
+    ReactorSource flush_timer; // writes the history file FLUSH_DELAY after a change(in text mode),-
+    // or syncs the journal SYNC_WINDOW after one(in journal mode)
+    GitSync git; // git worker(pulls every PULL_INTERVAL, pushes DELAY seconds after a change)
+    CaptureWorker capture; // capture thread
+    CaptureSource sources[CAPTURE_MAX_SOURCES]; // the clipboard reader first, then the CAPTURE_SOURCES
+    int sources_count;
+    char * source_names[CAPTURE_MAX_SOURCES + 1]; // names of the sources by their number("-" for 0, see Item)
+    char * source_args[CAPTURE_MAX_SOURCES][2]; // reader commands of the CAPTURE_SOURCES
+    PersistWorker persist; // persistence thread(in text mode)
+    Ring capture_ring; // CaptureEntry pointers from the capture thread
+    Ring persist_ring; // PersistRequest pointers to the persistence thread
+    Ring persisted_ring; // the same requests coming back written
+    Stats stats; // per-stage latencies and counters
+    Queue * items;
+    Journal * journal; // NULL in text mode
+    TrigramIndex * search; // substring index of the items
+    QueryServer * query; // query socket server(NULL if there is no QUERY_SOCKET)
+    HistoryFile * history_file;
+    char * chunks_dir; // directory of the chunk files of the history file
+    char * capture_args[4]; // reader command
+    char * pull_args[4]; // git pull command
+    char * push_args[4]; // git sync command
+    char * HISTORY_CLIP_FILE;
+    Logger * logger; // log file(written by its own thread)
+    char * STATS_FILE; // where the stats are dumped(NULL: nowhere)
+    long FLUSH_DELAY; // milliseconds, that changes are collected for before the history file is written
+    long SYNC_WINDOW; // milliseconds of journal appends, that share one fdatasync(-1: nothing is synced)
+    int flag_inserted; // dirty bit to check if the history file is behind the queue
+    int flag_flush_armed; // flush_timer is armed
+    int flag_persisting; // the persistence thread is writing the history file
+    int flag_push_waiting; // the push waits for the history file to be written
+    int flag_merged; // the first pull was merged(the history file isn't written before, so it can't lose the remote's records)
+} DaemonLoop;
 
 // convert string to integer
 int str_to_int(char *);
@@ -24,59 +89,57 @@ int str_to_int(char *);
 void str_reverse(char *, int);
 // convert integer to string
 char * int_to_str(int);
-// compare function for avl_tree
-int my_compare(const void *, const void *);
 // custom print function for AVL tree nodes
 void * my_print(void *);
-// create Item structure element
-Item * create_item(char *);
-// helper to insert the node with the key
-int insert_item(Item **, Item **, char *, int *, int, int);
-// helper to delete the node with the key in it
-void delete_item(Item **, Item **, char *, int *);
-// find item in the queue
-Item * find_item(Item *, char *);
-// simply iterate through list and print items
-void iterate_n_print(Item *);
-// parse tmp.txt file
-char * parse_file(char *);
-// write to history file
-void write_to_file(Item *, char *);
-// write to log file
-void log_file_write(char *, char *);
 // free queue and arguments
-void free_queue(Item *, char **, int);
-// SIGINT handler
-void sig_handler(int);
-// run another program
-void run_exec(char **, char **, Item *, char *, int, int, int);
+void free_queue(Queue *, char **, int);
+// signalfd handler
+void on_signal(Reactor *, void *, uint32_t);
+// capture_ring handler: insert the captures
+void on_captured(Reactor *, void *, uint32_t);
+// persisted_ring handler: the history file is written, so the push can go on
+void on_persisted(Reactor *, void *, uint32_t);
+// flush_timer handler: write the history file(or sync the journal)
+void on_flush_timer(Reactor *, void *, uint32_t);
+// a git pull or push finished
+void on_git_done(GitSync *, int, int, void *);
+// make sure the history file(in text mode) is written before it is pushed
+int on_git_push(GitSync *, void *);
+// arm flush_timer(unless it is armed already or there is nothing to flush)
+void schedule_flush(DaemonLoop *);
+// hand the history image over to the persistence thread(if the history file is behind the queue)
+/* return 1 if the history file is being written and 0 otherwise */
+int start_flush(DaemonLoop *);
+// write the history file(and its new chunks) right away, in this thread
+/* return 1 on success and 0 otherwise */
+int write_history_now(DaemonLoop *);
+// dump the stats into STATS_FILE(return 1 on success and 0 otherwise)
+int dump_stats(DaemonLoop *);
+// the queue was changed by a capture
+void queue_changed(DaemonLoop *);
+// add the sources of the CAPTURE_SOURCES list, that is cut up in place(see main)
+/* the default poll intervals and timeout are used for the numbers, that an entry leaves out */
+/* return 1 on success and 0 if the list is malformed or too long */
+int parse_sources(DaemonLoop *, char *, long, long, long);
+// an entry was promoted through the query socket
+void on_query_promoted(QueryServer *, void *);
 // copy one string to another
 char * str_copy(char *);
 // free 2D array
 void free_2d_array(char **, int);
-// read clipboard history from file
-void read_clip_history(Item **, Item **, char *, int *, int);
-// append one string to another
-void str_append(char **, char *, int *);
-// free only the queue, without freeing args
-void free_only_queue(Item *);
+// get the value of optional NAME=value argument(or the default value, if it is not given)
+char * get_option(int, char **, char *, char *);
 
 
 int main(int argc, char ** argv) {
     /* queue related variables */
-    Item * items_start = NULL, * items_end = NULL; // start and end of the items queue
-    int current_queue_size = 0;
+    Queue items; // clipboard items queue
     int size_of_clipboard;
     /* daemon related variables */
-    char ** args_for_exec; // exec arguments to run another program
-    char * clip_contents;
-    time_t exec_time;
-    FILE * fp_pid, * fp_log;
+    FILE * fp_pid;
     char * str_daemon_pid;
-    int flag_inserted; // dirty bit to check if tree was changed
     char * parent_pid; // pid of the parent of the process that will run execl()
     int fd_out, fd_err; // file descriptors for STDOUT and STDERR
-    int args_exec_size; // size of arguments sent to exec
     /* argument variables */
     int args_size = 10;
     char * CURRENT_CLIP_FILE; // file to write the current clipboard contents
@@ -87,12 +150,48 @@ int main(int argc, char ** argv) {
     int DELAY; // delay in seconds
     char * DAEMON_PID; // file where the daemon's PID will be stored
     char * LOG_FILE; // log file
+    Logger logger;
     char * STDOUT; // file, where all stdout messages will be redirected
     char * STDERR; // file, where all stderr messages will be redirected
     char * GIT_SYNCH; // git synchronization script
     char * BASE_DIR; // base dir of the project
     char * GIT_CLONE; // git cloning script
     char ** args_to_free; // string arguments that should be freed
+    /* optional NAME=value arguments */
+    // HISTORY_MODE "text": rewrite HISTORY_CLIP_FILE FLUSH_DELAY_MS after a change(default),-
+    // "journal": HISTORY_CLIP_FILE is an append-only binary journal, see journal.h
+    int flag_journal;
+    Journal journal;
+    HistoryFile history_file; // text history file(in text mode)
+    TrigramIndex search_index; // substring index of the queue
+    // CAPTURE_MODE "file": CLIP_READ_SCRIPT writes CURRENT_CLIP_FILE and signals back(default),-
+    // "pipe": CLIP_PIPE_SCRIPT prints the clipboard to stdout, which is read through a pipe
+    int flag_pipe_capture;
+    char * CLIP_PIPE_SCRIPT; // script that prints the current clipboard contents(in pipe mode)
+    char * CAPTURE_SOURCES; // more sources(e.g. the PRIMARY selection) as "name:script[:min_ms[:max_ms[:timeout_ms]]],..."
+    int POLL_INTERVAL; // seconds between two clipboard reads, while the clipboard is idle
+    int POLL_MIN_MS; // milliseconds between two clipboard reads right after a change(doubled while idle)
+    int FLUSH_DELAY_MS; // milliseconds from a change to the history file write(DELAY is for the push)
+    // milliseconds, whose journal appends share one fdatasync("off": nothing is synced),-
+    // in text mode every history write is synced, and FLUSH_DELAY_MS is its window
+    char * SYNC_WINDOW;
+    int SYNC_WINDOW_MS;
+    int CAPTURE_TIMEOUT; // seconds after which a hanging clipboard reader is killed
+    int GIT_TIMEOUT; // seconds after which a hanging git script is killed
+    int PULL_INTERVAL; // seconds between two git pulls(doubled on every failure in a row)
+    char * STATS_FILE; // JSON file, where the stats are dumped on SIGUSR2 and on exit
+    char * DEVICE_ID; // name of this device in the shared history(the host name by default)
+    int MAX_MEMORY_MB; // megabytes, that the history may take(0: only the clipboard size limits it)
+    int CHUNK_MIN_KB; // kilobytes, from which on payloads are chunked and deduplicated(0: never)
+    ChunkStore chunk_store; // shared chunks of the big payloads
+    char * chunks_dir; // where the chunks of the text history file are written
+    char * QUERY_SOCKET; // Unix socket, where the history can be listed, searched and promoted(see query_server.h)
+    char * SNAPSHOT_FILE; // binary snapshot of the history, that a clean exit leaves for the next start(in text mode)
+    int LOG_LEVEL; // lowest level, that is logged("debug" logs every capture)
+    int LOG_MAX_KB; // kilobytes, at which LOG_FILE is moved to LOG_FILE.1(0: never)
+    char host_name[256];
+    DaemonLoop loop;
+    sigset_t signals_set;
 
     /* parse arguments */
     if(argc < 13) { // not enough arguments
@@ -103,8 +202,8 @@ int main(int argc, char ** argv) {
     // if customly selected clipboard size < 1, change size back to 1
     if(size_of_clipboard < 1)
         size_of_clipboard = 1;
-    else if(size_of_clipboard > 25)
-        size_of_clipboard = 25;
+    else if(size_of_clipboard > MAX_CLIPBOARD_SIZE)
+        size_of_clipboard = MAX_CLIPBOARD_SIZE;
     CURRENT_CLIP_FILE = (char *) malloc((strlen(argv[2]) + 1) * sizeof(char));
     strncpy(CURRENT_CLIP_FILE, argv[2], strlen(argv[2]));
     CURRENT_CLIP_FILE[strlen(argv[2])] = '\0';
@@ -136,6 +235,51 @@ int main(int argc, char ** argv) {
     GIT_CLONE = (char *) malloc((strlen(argv[12]) + 1) * sizeof(char));
     strncpy(GIT_CLONE, argv[12], strlen(argv[12]));
     GIT_CLONE[strlen(argv[12])] = '\0';
+    flag_journal = !strcmp(get_option(argc, argv, "HISTORY_MODE", "text"), "journal");
+    flag_pipe_capture = !strcmp(get_option(argc, argv, "CAPTURE_MODE", "file"), "pipe");
+    CLIP_PIPE_SCRIPT = get_option(argc, argv, "CLIP_PIPE_SCRIPT", NULL);
+    CAPTURE_SOURCES = get_option(argc, argv, "CAPTURE_SOURCES", NULL);
+    POLL_INTERVAL = str_to_int(get_option(argc, argv, "POLL_INTERVAL", "5"));
+    POLL_MIN_MS = str_to_int(get_option(argc, argv, "POLL_MIN_MS", "250"));
+    FLUSH_DELAY_MS = str_to_int(get_option(argc, argv, "FLUSH_DELAY_MS", "1000"));
+    SYNC_WINDOW = get_option(argc, argv, "SYNC_WINDOW_MS", "100");
+    SYNC_WINDOW_MS = strcmp(SYNC_WINDOW, "off") ? str_to_int(SYNC_WINDOW) : -1;
+    CAPTURE_TIMEOUT = str_to_int(get_option(argc, argv, "CAPTURE_TIMEOUT", "10"));
+    GIT_TIMEOUT = str_to_int(get_option(argc, argv, "GIT_TIMEOUT", "120"));
+    PULL_INTERVAL = str_to_int(get_option(argc, argv, "PULL_INTERVAL", "60"));
+    STATS_FILE = get_option(argc, argv, "STATS_FILE", NULL);
+    MAX_MEMORY_MB = str_to_int(get_option(argc, argv, "MAX_MEMORY_MB", "0"));
+    CHUNK_MIN_KB = str_to_int(get_option(argc, argv, "CHUNK_MIN_KB", "64"));
+    QUERY_SOCKET = get_option(argc, argv, "QUERY_SOCKET", NULL);
+    SNAPSHOT_FILE = get_option(argc, argv, "SNAPSHOT_FILE", NULL);
+    LOG_LEVEL = log_level(get_option(argc, argv, "LOG_LEVEL", "info"));
+    LOG_MAX_KB = str_to_int(get_option(argc, argv, "LOG_MAX_KB", "1024"));
+    if(!(DEVICE_ID = get_option(argc, argv, "DEVICE_ID", NULL))) {
+        if(gethostname(host_name, sizeof(host_name))) strcpy(host_name, "localhost");
+        host_name[sizeof(host_name) - 1] = '\0';
+        DEVICE_ID = host_name;
+    }
+    if(POLL_INTERVAL < 1) POLL_INTERVAL = 1;
+    if(POLL_MIN_MS < 1) POLL_MIN_MS = 1;
+    if(FLUSH_DELAY_MS < 1) FLUSH_DELAY_MS = 1;
+    if(SYNC_WINDOW_MS == 0) SYNC_WINDOW_MS = 1;
+    if(DELAY < 1) DELAY = 1;
+    if(PULL_INTERVAL < 1) PULL_INTERVAL = 1;
+    if(MAX_MEMORY_MB < 0) MAX_MEMORY_MB = 0;
+    if(flag_pipe_capture && !CLIP_PIPE_SCRIPT) {
+        printf("CAPTURE_MODE=pipe needs CLIP_PIPE_SCRIPT\n");
+        return 0;
+    }
+    // the clipboard is source 1, the names point into the list
+    loop.sources_count = 1;
+    loop.source_names[0] = "-";
+    loop.source_names[1] = "clipboard";
+    if(CAPTURE_SOURCES && *CAPTURE_SOURCES &&
+        !parse_sources(&loop, CAPTURE_SOURCES, POLL_MIN_MS, POLL_INTERVAL * 1000L, CAPTURE_TIMEOUT * 1000L)) {
+        printf("CAPTURE_SOURCES should be name:script[:min_ms[:max_ms[:timeout_ms]]],... with at most %d sources and names of up to %d characters\n",
+            CAPTURE_MAX_SOURCES - 1, SOURCE_NAME_MAX);
+        return 0;
+    }
     // initialize args_to_free array
     args_to_free = (char **) malloc(args_size * sizeof(char *));
     args_to_free[0] = CURRENT_CLIP_FILE;
@@ -149,8 +293,16 @@ int main(int argc, char ** argv) {
     args_to_free[8] = BASE_DIR;
     args_to_free[9] = GIT_CLONE;
     
-    /* initialize an AVL tree(set custom compare function to it) */
-    //assign_compare_func(&my_compare);
+    /* initialize the queue(it keeps its own AVL trees by content and by capture time) */
+    queue_init(&items, size_of_clipboard);
+    // captures are stamped with the id of this device, so that devices merge each other's history
+    items.device = hash_bytes(DEVICE_ID, strlen(DEVICE_ID));
+    // with a memory budget rarely used big items are evicted first, not just the oldest one
+    queue_set_budget(&items, (size_t) MAX_MEMORY_MB * 1024 * 1024);
+    // big pastes become lists of shared chunks, so near-identical ones cost little memory and disk
+    chunk_store_init(&chunk_store, (size_t) CHUNK_MIN_KB * 1024);
+    if(CHUNK_MIN_KB)
+        queue_set_chunk_store(&items, &chunk_store);
 
     /* create our daemon */
     pid_t pid;
@@ -173,14 +325,14 @@ int main(int argc, char ** argv) {
     //chdir("/");
 
     /* open the log file */
-    if(!(fp_log = fopen(LOG_FILE, "w"))) {
+    // messages are formatted into a ring and written by the logger's thread, so logging costs no system call
+    if(!logger_start(&logger, LOG_FILE, LOG_LEVEL, (off_t) LOG_MAX_KB * 1024)) {
         printf("Couldn't open log file: %s\n", LOG_FILE);
         // free all allocated resources
-        free_queue(items_start, args_to_free, args_size);
+        free_queue(&items, args_to_free, args_size);
         exit(1);
     }
-    fwrite("__START__\n", 1, strlen("__START__\n"), fp_log);
-    fclose(fp_log);
+    log_write(&logger, LOG_INFO, "__START__");
 
     // close all open file descriptors(except log file descriptor)
     // as I only have std{in,out} and stderr as open file descriptors, so I will close them
@@ -191,9 +343,10 @@ int main(int argc, char ** argv) {
 
     // write the daemon PID to the daemon_pid.txt file, to kill in the future(if needed)
     if(!(fp_pid = fopen(DAEMON_PID, "w"))) {
-        log_file_write("Couldn't open DAEMON_PID file.", LOG_FILE);
+        log_write(&logger, LOG_ERROR, "Couldn't open DAEMON_PID file.");
+        logger_stop(&logger);
         // free all allocated resources
-        free_queue(items_start, args_to_free, args_size);
+        free_queue(&items, args_to_free, args_size);
         exit(1);
     }
     str_daemon_pid = int_to_str(getpid());
@@ -209,390 +362,389 @@ int main(int argc, char ** argv) {
     close(fd_out);
     close(fd_err);
 
-    /* running the loop that will read from clipboard and edit file */
-    // the clipboard history will be written to the HISTORY_CLIP_FILE file-
-    // every DELAY minute-ish
-    signal(SIGINT, sig_handler); // terminate on SIGINT
-    exec_time = time(NULL);
+    /* open the journal(in journal mode) and restore the queue from it */
+    history_file_init(&history_file, HISTORY_CLIP_FILE);
+    // the chunks directory is next to the history file, so git syncs it along
+    chunks_dir = history_chunks_dir(HISTORY_CLIP_FILE);
+    if(!flag_journal) {
+        mkdir(chunks_dir, 0755);
+        history_file.chunks_dir = chunks_dir;
+        // the snapshot of the last exit is mapped instead of parsing the history file,-
+        // which is then read only for the records, that are newer than it
+        if(SNAPSHOT_FILE && load_snapshot(&items, SNAPSHOT_FILE) >= 0)
+            history_mark_merged(&history_file, items.start);
+        // the saved history is in the queue before the first capture, however the first pull goes,-
+        // so the first write never replaces it with the new captures alone
+        read_clip_history(&items, &history_file);
+    }
+    if(flag_journal) {
+        if(!journal_open(&journal, HISTORY_CLIP_FILE, &items)) {
+            log_write(&logger, LOG_ERROR, "Couldn't open history journal.");
+            logger_stop(&logger);
+            free_queue(&items, args_to_free, args_size);
+            exit(1);
+        }
+        queue_add_listener(&items, &journal_listener, &journal);
+    }
+    // the index follows every insertion and eviction from now on
+    trigram_index_init(&search_index, &items);
+    queue_add_listener(&items, &trigram_index_listener, &search_index);
+
+    /* set up the event loop */
     parent_pid = int_to_str(getpid());
-    flag_inserted = 0; // dirty bit to check if tree was changed
-    while(1) {
-        // pull from git repo
-        args_for_exec = (char **) malloc(4 * sizeof(char *));
-        args_for_exec[0] = str_copy(GIT_CLONE);
-        args_for_exec[1] = str_copy(BASE_DIR);
-        args_for_exec[2] = str_copy(parent_pid);
-        args_for_exec[3] = (char *) NULL;
-        args_exec_size = 4;
-        run_exec(args_to_free, args_for_exec, items_start, LOG_FILE, args_size, args_exec_size, 0);
-        free_2d_array(args_for_exec, args_exec_size);
-        // synch history file with linked list
-        read_clip_history(&items_start, &items_end, HISTORY_CLIP_FILE, &current_queue_size, size_of_clipboard);
-
-        // run exec to read current clipboard(execl(CLIP_READ_SCRIPT, CLIP_READ_SCRIPT, CURRENT_CLIP_FILE, parent_pid, (char *) NULL))
-        args_for_exec = (char **) malloc(4 * sizeof(char *));
-        args_for_exec[0] = str_copy(CLIP_READ_SCRIPT);
-        args_for_exec[1] = str_copy(CURRENT_CLIP_FILE);
-        args_for_exec[2] = str_copy(parent_pid);
-        args_for_exec[3] = (char *) NULL;
-        args_exec_size = 4;
-        run_exec(args_to_free, args_for_exec, items_start, LOG_FILE, args_size, args_exec_size, 5);
-        free_2d_array(args_for_exec, args_exec_size);
-        // read the current contents of the clipboard and write them into AVL tree
-        clip_contents = parse_file(CURRENT_CLIP_FILE);
-        if(insert_item(&items_start, &items_end, clip_contents, &current_queue_size, size_of_clipboard, 0))
-            flag_inserted = 1;
-        free(clip_contents);
-
-        /* write into the history file */
-        // write to the history file, only if clipboard was updated
-        // if DELAY minutes have passed since the previous write, write this AVL tree values into file
-        if(flag_inserted && (long) time(NULL) - (long) exec_time > (long) DELAY) {
-            write_to_file(items_start, HISTORY_CLIP_FILE);
-            
-            /* synch with git repo */
-            // run exec to synch with git repo(execl(GIT_SYNCH, GIT_SYNCH, BASE_DIR, parent_pid, (char *) NULL))
-            args_for_exec = (char **) malloc(4 * sizeof(char *));
-            args_for_exec[0] = str_copy(GIT_SYNCH);
-            args_for_exec[1] = str_copy(BASE_DIR);
-            args_for_exec[2] = str_copy(parent_pid);
-            args_for_exec[3] = (char *) NULL;
-            args_exec_size = 4;
-            run_exec(args_to_free, args_for_exec, items_start, LOG_FILE, args_size, args_exec_size, 0);
-            free_2d_array(args_for_exec, args_exec_size);
-            
-            /* maintenance stuff */
-            exec_time = time(NULL); // reset execution time
-            flag_inserted = 0; // reset dirty bit
+    loop.items = &items;
+    loop.journal = flag_journal ? &journal : NULL;
+    loop.search = &search_index;
+    loop.history_file = &history_file;
+    loop.chunks_dir = chunks_dir;
+    loop.HISTORY_CLIP_FILE = HISTORY_CLIP_FILE;
+    loop.logger = &logger;
+    loop.STATS_FILE = STATS_FILE;
+    stats_init(&loop.stats, reactor_now());
+    queue_add_listener(&items, &stats_listener, &loop.stats);
+    loop.FLUSH_DELAY = FLUSH_DELAY_MS;
+    loop.SYNC_WINDOW = SYNC_WINDOW_MS;
+    loop.flag_inserted = loop.flag_flush_armed = loop.flag_persisting = loop.flag_push_waiting = 0;
+    loop.flag_merged = flag_journal; // the journal never merges
+    // CLIP_PIPE_SCRIPT prints the clipboard, CLIP_READ_SCRIPT CURRENT_CLIP_FILE parent_pid writes it
+    loop.capture_args[0] = flag_pipe_capture ? CLIP_PIPE_SCRIPT : CLIP_READ_SCRIPT;
+    loop.capture_args[1] = flag_pipe_capture ? NULL : CURRENT_CLIP_FILE;
+    loop.capture_args[2] = parent_pid;
+    loop.capture_args[3] = NULL;
+    // GIT_CLONE BASE_DIR and GIT_SYNCH BASE_DIR
+    loop.pull_args[0] = GIT_CLONE;
+    loop.push_args[0] = GIT_SYNCH;
+    loop.pull_args[1] = loop.push_args[1] = BASE_DIR;
+    loop.pull_args[2] = loop.push_args[2] = NULL;
+    loop.signals.fd = loop.captured.fd = loop.persisted.fd = loop.flush_timer.fd = -1;
+    loop.git.pull_timer.fd = loop.git.push_timer.fd = -1;
+    reactor_child_init(&loop.git.child);
+    sigemptyset(&signals_set);
+    sigaddset(&signals_set, SIGINT);
+    sigaddset(&signals_set, SIGTERM);
+    sigaddset(&signals_set, SIGUSR1);
+    sigaddset(&signals_set, SIGUSR2);
+    // the signals are blocked before the threads are started, so that they inherit the mask;-
+    // the rings own their eventfds, so the reactor gets duplicates of them
+    if(!reactor_init(&loop.reactor) ||
+        !reactor_add(&loop.reactor, &loop.signals, reactor_signal_fd(&signals_set), EPOLLIN, &on_signal, &loop) ||
+        !ring_init(&loop.capture_ring, CAPTURE_RING_SIZE) ||
+        !ring_init(&loop.persist_ring, PERSIST_RING_SIZE) ||
+        !ring_init(&loop.persisted_ring, PERSIST_RING_SIZE) ||
+        !reactor_add(&loop.reactor, &loop.captured, dup(loop.capture_ring.event_fd), EPOLLIN, &on_captured, &loop) ||
+        !reactor_add(&loop.reactor, &loop.persisted, dup(loop.persisted_ring.event_fd), EPOLLIN, &on_persisted, &loop) ||
+        !reactor_add(&loop.reactor, &loop.flush_timer, reactor_timer_fd(0, 0), EPOLLIN, &on_flush_timer, &loop) ||
+        !reactor_timer_set(loop.flush_timer.fd, 0, 0) ||
+        !git_sync_init(&loop.git, &loop.reactor, loop.pull_args, loop.push_args, PULL_INTERVAL * 1000L, DELAY * 1000L, GIT_TIMEOUT * 1000L, &on_git_push, &on_git_done, &loop) ||
+        (!flag_journal && !persist_worker_start(&loop.persist, &loop.persist_ring, &loop.persisted_ring, HISTORY_CLIP_FILE, chunks_dir, SYNC_WINDOW_MS >= 0))) {
+        log_write(&logger, LOG_ERROR, "Couldn't set up the event loop.");
+        logger_stop(&logger);
+        free_queue(&items, args_to_free, args_size);
+        exit(1);
+    }
+    // queries are answered by this thread between the captures
+    loop.query = NULL;
+    if(QUERY_SOCKET) {
+        loop.query = (QueryServer *) malloc(sizeof(QueryServer));
+        if(query_server_start(loop.query, &loop.reactor, QUERY_SOCKET, &items, &search_index, &on_query_promoted, &loop)) {
+            queue_add_listener(&items, &query_server_listener, loop.query);
+            loop.query->source_names = loop.source_names;
+            loop.query->sources_count = loop.sources_count;
+        } else {
+            log_write(&logger, LOG_ERROR, "Couldn't open the query socket.");
+            free(loop.query);
+            loop.query = NULL;
         }
     }
+    // the first polls and the first pull fire at once
+    capture_source_init(&loop.sources[0], loop.capture_args, flag_pipe_capture ? NULL : CURRENT_CLIP_FILE,
+        POLL_MIN_MS, POLL_INTERVAL * 1000L, CAPTURE_TIMEOUT * 1000L);
+    loop.sources[0].flag_skip_newline = !flag_pipe_capture;
+    if(!capture_worker_start(&loop.capture, &loop.capture_ring, loop.sources, loop.sources_count)) {
+        log_write(&logger, LOG_ERROR, "Couldn't start the capture thread.");
+        logger_stop(&logger);
+        free_queue(&items, args_to_free, args_size);
+        exit(1);
+    }
+
+    /* running the loop that will read from clipboard and edit file */
+    // the clipboard history will be written to the HISTORY_CLIP_FILE file FLUSH_DELAY_MS milliseconds-
+    // and pushed DELAY seconds after the clipboard was updated
+    if(!reactor_run(&loop.reactor))
+        log_write(&logger, LOG_ERROR, "Error: epoll_wait().");
+
+    /* stop the threads and the children and write what is not written yet */
+    capture_worker_stop(&loop.capture);
+    on_captured(&loop.reactor, &loop, EPOLLIN); // captures, that are still in the ring
+    if(loop.query) {
+        queue_remove_listener(&items, &query_server_listener, loop.query);
+        query_server_stop(loop.query);
+        free(loop.query);
+    }
+    git_sync_free(&loop.git);
+    if(!flag_journal)
+        persist_worker_stop(&loop.persist);
+    on_persisted(&loop.reactor, &loop, EPOLLIN); // only frees the requests(git is stopped already)
+    reactor_remove(&loop.reactor, &loop.captured);
+    reactor_remove(&loop.reactor, &loop.persisted);
+    reactor_remove(&loop.reactor, &loop.flush_timer);
+    reactor_remove(&loop.reactor, &loop.signals);
+    reactor_free(&loop.reactor);
+    if(loop.flag_inserted && !flag_journal)
+        write_history_now(&loop);
+    if(SNAPSHOT_FILE && !flag_journal && write_snapshot(&items, SNAPSHOT_FILE) < 0)
+        log_write(&logger, LOG_ERROR, "Couldn't write the snapshot file.");
+    if(STATS_FILE)
+        dump_stats(&loop);
 
     /* write SUCCESS into the log file and close it */
-    log_file_write("__SUCCESS__", LOG_FILE);
+    log_write(&logger, LOG_INFO, "__SUCCESS__");
+    logger_stop(&logger);
 
     /* free all allocated resources */
-    free_queue(items_start, args_to_free, args_size);
+    if(flag_journal)
+        journal_close(&journal);
+    ring_free(&loop.capture_ring);
+    ring_free(&loop.persist_ring);
+    ring_free(&loop.persisted_ring);
+    trigram_index_free(&search_index);
+    free_queue(&items, args_to_free, args_size);
+    chunk_store_free(&chunk_store);
+    free(chunks_dir);
     free(parent_pid);
     
     return 0;
 }
 
-// daemon related
-char * parse_file(char * CURRENT_CLIP_FILE) {
-    char * str = NULL, c;
-    int count = 0, len = 1;
-    FILE * fp = fopen(CURRENT_CLIP_FILE, "r");
-    // read the file
-    c = fgetc(fp); // first character is '\n', so skip it
-    if(c == EOF) return NULL;
-    while((c = (char) fgetc(fp)) && c != EOF) {
-        if(count == len - 1)
-            str = (char *) realloc(str, (len *= 2) * sizeof(char));
-        str[count] = c;
-        count++;
-    }
-    str[count] = '\0';
-    return str;
+// event loop related
+void on_signal(Reactor * reactor, void * context, uint32_t events) {
+    DaemonLoop * loop = (DaemonLoop *) context;
+    struct signalfd_siginfo info;
+    while(read(loop->signals.fd, &info, sizeof(info)) == sizeof(info))
+        if(info.ssi_signo == SIGINT || info.ssi_signo == SIGTERM)
+            reactor_stop(reactor);
+        else if(info.ssi_signo == SIGUSR2 && loop->STATS_FILE && !dump_stats(loop))
+            log_write(loop->logger, LOG_ERROR, "Couldn't write the stats file.");
 }
 
-void write_to_file(Item * items_start, char * HISTORY_CLIP_FILE) {
-    Item * tmp = items_start;
-    FILE * fp = fopen(HISTORY_CLIP_FILE, "w");
-    char str[5], prev = '\0';
-    int count = 0;
-    while(tmp) {
-        str[0] = (char) (count / 10 + 48);
-        str[1] = (char) (count % 10 + 48);
-        str[2] = ':';
-        str[3] = '\n';
-        str[4] = '\0';
-        fwrite(str, 1, strlen(str), fp);
-        for(int i = 0; i < strlen(tmp->elem); i++) {
-            if((i == 0 || prev == '\n') && i <= strlen(tmp->elem) - 3 && isdigit((tmp->elem)[i]) &&
-                isdigit((tmp->elem)[i + 1]) && (tmp->elem)[i + 2] == ':')
-            {
-                fputc('\\', fp);
-            }
-            fputc((tmp->elem)[i], fp);
-            prev = (tmp->elem)[i];
+void on_captured(Reactor * reactor, void * context, uint32_t events) {
+    DaemonLoop * loop = (DaemonLoop *) context;
+    CaptureEntry * entry;
+    uint64_t insert_start;
+    off_t journal_size;
+    int flag_changed;
+    ring_clear_event(&loop->capture_ring);
+    while((entry = (CaptureEntry *) ring_pop(&loop->capture_ring))) {
+        // a reader, that couldn't even be started, has no run time
+        if(entry->capture_time)
+            stats_record(&loop->stats, STATS_CAPTURE, entry->capture_time);
+        if(entry->flag_failed) {
+            loop->stats.failures[STATS_CAPTURE]++;
+            log_write(loop->logger, LOG_WARN, entry->flag_timed_out ? "Reader of %s timed out." : "Reader of %s failed.", loop->source_names[entry->source]);
+            capture_entry_free(&entry->backing);
+            continue;
         }
-        fputc('\n', fp);
-        tmp = tmp->next;
-        count++;
+        loop->stats.captures++;
+        stats_record(&loop->stats, STATS_PARSE, entry->parse_time);
+        // the new item points right into the capture buffer
+        insert_start = reactor_now();
+        journal_size = loop->journal ? loop->journal->size : 0;
+        // the item is tagged with the source, that copied it(one history for all of them)
+        loop->items->source = entry->source;
+        if((flag_changed = insert_item_backed(loop->items, entry->backing.data, entry->backing.size, &entry->backing, 0)))
+            queue_changed(loop);
+        else
+            loop->stats.unchanged++;
+        loop->items->source = 0;
+        stats_record(&loop->stats, STATS_INSERT, reactor_now() - insert_start);
+        log_write(loop->logger, LOG_DEBUG, "capture(%s): %zu bytes(%s), %s in %.1f ms", loop->source_names[entry->source], entry->backing.size,
+            flag_changed ? item_mime(loop->items->start) : "-", flag_changed ? "inserted" : "unchanged", entry->capture_time / 1e6);
+        if(loop->journal && loop->journal->size > journal_size)
+            loop->stats.bytes_written += loop->journal->size - journal_size;
+        // nothing points into the capture(it was a duplicate)
+        if(!entry->backing.refs)
+            capture_entry_free(&entry->backing);
     }
-    fclose(fp);
+    // in journal mode the changes are already appended, just compact when needed
+    if(loop->journal)
+        journal_maintain(loop->journal, loop->items);
 }
 
-void log_file_write(char * argv, char * LOG_FILE) {
-    FILE * fp_log = fopen(LOG_FILE, "a");
-    fwrite(argv, 1, strlen(argv), fp_log);
-    fputc('\n', fp_log);
-    fclose(fp_log);
-}
-
-void sig_handler(int para_sig) {
-    exit(1);
-}
-
-void run_exec(char ** args_to_free, char ** args_for_exec, Item * items_start, char * LOG_FILE, int args_size, int args_exec_size, int timeout) {
-    int pid, signal_received;
-    sigset_t signals_set;
-    sigemptyset(&signals_set); // reset the signals set
-    sigaddset(&signals_set, SIGUSR1);
-    sigprocmask(SIG_BLOCK, &signals_set, NULL);
-    // run the clipboard reading script
-    pid = fork();
-    if(pid < 0) { // error when forking
-        log_file_write("Forking error: before first exec().", LOG_FILE);
-        // free all allocated resources
-        free_queue(items_start, args_to_free, args_size);
-        free_2d_array(args_for_exec, args_exec_size);
-        exit(1);
-    }
-    if(!pid) { // child process
-        // run clipboard reading script
-        sleep(timeout); // sleep, so that parcellite doesn't return "core dumped" error
-        //execl(CLIP_READ_SCRIPT, CLIP_READ_SCRIPT, CURRENT_CLIP_FILE, parent_pid, (char *) NULL);
-        execv(args_for_exec[0], args_for_exec);
-        exit(1); // if execl() could not run
-    }
-    // wait until SIGUSR1 is sent from execl() program
-    if(sigwait(&signals_set, &signal_received)) {
-        log_file_write("Error: sigwait().", LOG_FILE);
-        free_queue(items_start, args_to_free, args_size);
-        free_2d_array(args_for_exec, args_exec_size);
-        exit(1);
+void on_persisted(Reactor * reactor, void * context, uint32_t events) {
+    DaemonLoop * loop = (DaemonLoop *) context;
+    PersistRequest * request;
+    ring_clear_event(&loop->persisted_ring);
+    while((request = (PersistRequest *) ring_pop(&loop->persisted_ring))) {
+        if(request->bytes < 0) {
+            loop->stats.failures[STATS_WRITE]++;
+            log_write(loop->logger, LOG_ERROR, "Couldn't write the history file.");
+        } else {
+            loop->stats.bytes_written += request->bytes;
+            log_write(loop->logger, LOG_DEBUG, "history file: %ld bytes written in %.1f ms", request->bytes, request->write_time / 1e6);
+        }
+        stats_record(&loop->stats, STATS_WRITE, request->write_time);
+        release_chunks(loop->items->chunk_store, request->chunks, request->chunks_count, request->bytes >= 0);
+        free(request);
+        loop->flag_persisting = 0;
     }
-    if(signal_received != SIGUSR1) {
-        char * str = int_to_str(signal_received);
-        log_file_write("Incorrect signal:", LOG_FILE);
-        log_file_write(str, LOG_FILE);
-        free(str);
-        free_queue(items_start, args_to_free, args_size);
-        free_2d_array(args_for_exec, args_exec_size);
-        exit(1);
+    if(loop->flag_persisting) return;
+    if(!loop->flag_push_waiting) {
+        // changes, that came during the write, get their own flush
+        if(loop->flag_inserted)
+            schedule_flush(loop);
+        return;
     }
+    // the push goes out with everything, that is in the queue by now
+    if(start_flush(loop)) return;
+    loop->flag_push_waiting = 0;
+    git_sync_prepared(&loop->git);
 }
 
-void read_clip_history(Item ** items_start, Item ** items_end, char * file_name, int * current_queue_size, int size_of_clipboard) {
-    int line_count = 0, str_len = 0, new_queue_size = 0;
-    char * str = NULL, * line = NULL;
-    FILE * fp = fopen(file_name, "r");
-    Item * new_items_start = NULL, * new_items_end = NULL;
-    size_t line_len = 0;
-
-    // read new clipboard
-    while((line_count = getline(&line, &line_len, fp))) {
-        if(line_count < 0 || (isdigit(line[0]) && isdigit(line[1]) && line[2] == ':')) { // EOF or new record
-            // insert into linked list
-            if(str) {
-                str[strlen(str) - 1] = '\0'; // last character in each record is added newline, so delete it
-                if(*items_start && !strcmp(str, (*items_start)->elem)) { // after this point, clipboard doesn't change
-                    free(str);
-                    free(line);
-                    break;
-                }
-                insert_item(&new_items_start, &new_items_end, str, &new_queue_size, size_of_clipboard, 1);
-            }
-            // reset the string
-            str_len = 0;
-            free(str);
-            str = NULL;
-            // if EOF was reached
-            if(line_count < 0) {
-                free(line);
-                break;
-            }
-        } else str_append(&str, line, &str_len);
-        free(line);
-        line_len = 0;
-        line = NULL;
+void on_flush_timer(Reactor * reactor, void * context, uint32_t events) {
+    DaemonLoop * loop = (DaemonLoop *) context;
+    uint64_t start;
+    if(!reactor_timer_read(loop->flush_timer.fd)) return;
+    loop->flag_flush_armed = 0;
+    if(!loop->journal) {
+        start_flush(loop);
+        return;
     }
-    fclose(fp);
-    // attach newly added items to the start of the queue(if they exist)
-    if(*items_start) {
-        // connect the end of the new list to the start of old
-        (*items_start)->prev = new_items_end;
-        if(new_items_end) { // new list exists
-            new_items_end->next = *items_start;
-            *items_start = new_items_start;
-        }
-        // check if number of new elements exceeds the allowed clipboard size
-        if(*current_queue_size + new_queue_size > size_of_clipboard) {
-            Item * tmp = *items_end;
-            for(int i = *current_queue_size + new_queue_size; i > size_of_clipboard; i--) {
-                tmp = tmp->prev;
-                free(tmp->next->elem);
-                free(tmp->next);
-                tmp->next = NULL;
-            }
-            *items_end = tmp;
-            *current_queue_size = size_of_clipboard;
-        } else
-            *current_queue_size += new_queue_size;
-    } else {
-        *items_start = new_items_start;
-        *items_end = new_items_end;
-        *current_queue_size = new_queue_size;
+    // group commit: every append since the last sync becomes durable at once
+    start = reactor_now();
+    if(!journal_sync(loop->journal)) {
+        loop->stats.failures[STATS_SYNC]++;
+        log_write(loop->logger, LOG_ERROR, "Couldn't sync the history journal.");
     }
+    stats_record(&loop->stats, STATS_SYNC, reactor_now() - start);
 }
 
-/*void read_clip_history(Item ** items_start, Item ** items_end, char * file_name, int * current_queue_size, int size_of_clipboard) {
-    int line_count = 0, str_len = 0, new_queue_size = 0;
-    char * str = NULL, * line = NULL;
-    FILE * fp = fopen(file_name, "r");
-    Item * new_items_start = NULL, * new_items_end = NULL;
-    size_t line_len = 0;
-
-    // read new clipboard
-    while((line_count = getline(&line, &line_len, fp))) {
-        if(line_count < 0 || (isdigit(line[0]) && isdigit(line[1]) && line[2] == ':')) { // EOF or new record
-            // insert into linked list
-            if(str) {
-                str[strlen(str) - 1] = '\0'; // last character in each record is added newline, so delete it
-                insert_item(&new_items_start, &new_items_end, str, &new_queue_size, size_of_clipboard, 1);
-            }
-            // reset the string
-            str_len = 0;
-            free(str);
-            str = NULL;
-            // if EOF was reached
-            if(line_count < 0) {
-                free(line);
-                break;
-            }
-        } else str_append(&str, line, &str_len);
-        free(line);
-        line_len = 0;
-        line = NULL;
+void on_git_done(GitSync * git, int request, int ok, void * context) {
+    DaemonLoop * loop = (DaemonLoop *) context;
+    int stage = request == GIT_SYNC_PULL ? STATS_GIT_PULL : STATS_GIT_PUSH;
+    stats_record(&loop->stats, stage, reactor_now() - git->child.started);
+    if(!ok) {
+        loop->stats.failures[stage]++;
+        log_write(loop->logger, LOG_WARN, request == GIT_SYNC_PULL ? "git pull failed or timed out(retrying with backoff)." : "git sync failed or timed out(retrying with backoff).");
+    } else
+        log_write(loop->logger, LOG_DEBUG, request == GIT_SYNC_PULL ? "git pull done" : "git sync done");
+    // merge what the other devices have captured(the journal is only written by this daemon)
+    /* a failed pull may still have changed the file(read_clip_history skips an unchanged one) */
+    if(request == GIT_SYNC_PULL && !loop->journal) {
+        if(ok) forget_saved_chunks(loop->items->start);
+        read_clip_history(loop->items, loop->history_file);
+        // the captures, that came meanwhile, can be written now
+        if(!loop->flag_merged) {
+            loop->flag_merged = 1;
+            if(loop->flag_inserted)
+                schedule_flush(loop);
+        }
     }
-    fclose(fp);
-    // attach newly added items to the start of the queue(if they exist)
-    free_only_queue(*items_start);
-    *items_start = new_items_start;
-    *items_end = new_items_end;
-    *current_queue_size = new_queue_size;
-}*/
-
-// AVL related
-int my_compare(const void * a, const void * b) {
-    Item * arg1 = (Item *) a;
-    Item * arg2 = (Item *) b;
-    if(strcmp(arg1->elem, arg2->elem) < 0) return -1;
-    if(strcmp(arg1->elem, arg2->elem) > 0) return 1;
-    else return 0;
 }
 
-void * my_print(void * key) {
-    printf("%s\n", ((Item *) key)->elem);
+int on_git_push(GitSync * git, void * context) {
+    DaemonLoop * loop = (DaemonLoop *) context;
+    if(!start_flush(loop)) return 1;
+    loop->flag_push_waiting = 1;
+    return 0;
 }
 
-Item * create_item(char * str) {
-    Item * new_item = (Item *) malloc(sizeof(Item));
-    char * new_str = (char *) malloc((strlen(str) + 1) * sizeof(char));
-    memset(new_str, '\0', strlen(str) + 1);
-    strncpy(new_str, str, strlen(str));
-    new_item->elem = new_str;
-    new_item->prev = NULL;
-    new_item->next = NULL;
-    return new_item;
+void schedule_flush(DaemonLoop * loop) {
+    if(loop->flag_flush_armed) return;
+    if(loop->journal && (loop->SYNC_WINDOW < 0 || loop->journal->synced_size == loop->journal->size)) return;
+    if(reactor_timer_set(loop->flush_timer.fd, loop->journal ? loop->SYNC_WINDOW : loop->FLUSH_DELAY, 0))
+        loop->flag_flush_armed = 1;
 }
 
-int insert_item(Item ** items_start, Item ** items_end, char * str, int * current_queue_size, int size_of_clipboard, int flag_reversed) {
-    Item * new_item, * item_exists;
-    if(!str || !strlen(str)) return 0; // string is empty
-    new_item = create_item(str);
-    // if there are no items in the queue
-    if(!(item_exists = find_item(*items_start, new_item->elem))) {
-        if(!(*items_start)) {
-            *items_start = new_item;
-            *items_end = new_item;
-        } else {
-            // delete the last item, if it is an overflow of clipboard
-            if(*current_queue_size >= size_of_clipboard)
-                delete_item(items_start, items_end, (*items_end)->elem, current_queue_size);
-            // insert new item
-            if(!flag_reversed) {
-                // add to the start of the queue and connect pointers
-                new_item->next = *items_start;
-                (*items_start)->prev = new_item;
-                *items_start = new_item;
-            } else {
-                // add to the end of the queue and connect pointers
-                new_item->prev = *items_end;
-                (*items_end)->next = new_item;
-                *items_end = new_item;
-            }
-        }
-        (*current_queue_size)++; // increment the size of the queue
-    } else {
-        free(new_item->elem);
-        free(new_item);
-        if(item_exists == *items_start) return 0;
-        delete_item(items_start, items_end, item_exists->elem, current_queue_size);
-        insert_item(items_start, items_end, str, current_queue_size, size_of_clipboard, flag_reversed);
+int start_flush(DaemonLoop * loop) {
+    PersistRequest * request;
+    // one write at a time: the changes since are written after it(see on_persisted)
+    /* nothing is written before the first pull is merged(see on_git_done) */
+    if(loop->flag_persisting || !loop->flag_inserted || !loop->flag_merged || loop->journal) return loop->flag_persisting;
+    loop->flag_inserted = 0; // reset dirty bit
+    // the image is a snapshot of the queue, so the queue can change while it is written
+    request = (PersistRequest *) malloc(sizeof(PersistRequest));
+    request->chunks_count = unsaved_chunks(loop->items->start, &request->chunks);
+    if(!(request->data = history_image(loop->items->start, &request->len)) || !ring_push(&loop->persist_ring, request)) {
+        loop->stats.failures[STATS_WRITE]++;
+        log_write(loop->logger, LOG_ERROR, "Couldn't write the history file.");
+        release_chunks(loop->items->chunk_store, request->chunks, request->chunks_count, 0);
+        free(request->data);
+        free(request);
+        return 0;
     }
+    loop->flag_persisting = 1;
     return 1;
 }
 
-void delete_item(Item ** items_start, Item ** items_end, char * str, int * current_queue_size) {
-    Item * it = create_item(str);
-    Item * found_item = find_item(*items_start, it->elem);
-    // if such a key exists, delete it
-    if(found_item) {
-        // change start and end pointers(if needed)
-        if(*items_start == found_item)
-            *items_start = found_item->next;
-        if(*items_end == found_item)
-            *items_end = found_item->prev;
-        // change next and prev pointers
-        if(found_item->prev)
-            found_item->prev->next = found_item->next;
-        if(found_item->next)
-            found_item->next->prev = found_item->prev;
-        free(found_item->elem);
-        free(found_item);
-        (*current_queue_size)--; // decrement the size of the queue
-    }
-    free(it);
+int write_history_now(DaemonLoop * loop) {
+    Chunk ** chunks;
+    int count = unsaved_chunks(loop->items->start, &chunks), i;
+    int flag_sync = loop->SYNC_WINDOW >= 0;
+    for(i = 0; i < count && chunk_save(loop->chunks_dir, chunks[i], flag_sync); i++);
+    if(i == count && i && flag_sync && !sync_directory(loop->chunks_dir)) i = 0;
+    release_chunks(loop->items->chunk_store, chunks, count, i == count);
+    return i == count && write_to_file(loop->items->start, loop->HISTORY_CLIP_FILE, flag_sync) >= 0;
 }
 
-Item * find_item(Item * items_start, char * str) {
-    Item * tmp = items_start;
-    while(tmp) {
-        if(!strcmp(tmp->elem, str)) return tmp;
-        tmp = tmp->next;
+int dump_stats(DaemonLoop * loop) {
+    loop->stats.skipped = atomic_load(&loop->capture.skipped);
+    loop->stats.dropped = atomic_load(&loop->capture_ring.full);
+    loop->stats.max_backlog = atomic_load(&loop->capture_ring.max_depth);
+    loop->stats.memory_bytes = queue_memory(loop->items);
+    return stats_dump(&loop->stats, loop->STATS_FILE, reactor_now());
+}
+
+void queue_changed(DaemonLoop * loop) {
+    loop->flag_inserted = 1;
+    schedule_flush(loop);
+    git_sync_changed(&loop->git);
+}
+
+void on_query_promoted(QueryServer * server, void * context) {
+    queue_changed((DaemonLoop *) context);
+}
+
+int parse_sources(DaemonLoop * loop, char * list, long min_interval, long max_interval, long timeout) {
+    char * entry, * name, * script, * number, * list_state, * entry_state;
+    long numbers[3];
+    CaptureSource * source;
+    for(entry = strtok_r(list, ",", &list_state); entry; entry = strtok_r(NULL, ",", &list_state)) {
+        name = strtok_r(entry, ":", &entry_state);
+        script = strtok_r(NULL, ":", &entry_state);
+        if(!script || strlen(name) > SOURCE_NAME_MAX || strchr(name, ' ') || loop->sources_count == CAPTURE_MAX_SOURCES) return 0;
+        numbers[0] = min_interval;
+        numbers[1] = max_interval;
+        numbers[2] = timeout;
+        for(int i = 0; i < 3 && (number = strtok_r(NULL, ":", &entry_state)); i++)
+            numbers[i] = str_to_int(number);
+        source = &loop->sources[loop->sources_count];
+        loop->source_args[loop->sources_count][0] = script;
+        loop->source_args[loop->sources_count][1] = NULL;
+        capture_source_init(source, loop->source_args[loop->sources_count], NULL, numbers[0], numbers[1], numbers[2]);
+        loop->source_names[++loop->sources_count] = name;
     }
-    return NULL;
+    return 1;
 }
 
-void iterate_n_print(Item * items_start) {
-    int counter = 0;
-    Item * tmp = items_start;
-    while(tmp) {
-        printf("%d:\n", counter);
-        printf("%s\n", tmp->elem);
-        tmp = tmp->next;
+// AVL related
+void * my_print(void * key) {
+    size_t len;
+    char * piece;
+    for(int i = 0; i < item_pieces((Item *) key); i++) {
+        piece = item_piece((Item *) key, i, &len);
+        fwrite(piece, 1, len, stdout);
     }
+    putchar('\n');
+    return NULL;
 }
 
-void free_queue(Item * items_start, char ** args_to_free, int size) {
-    free_only_queue(items_start);
+void free_queue(Queue * items, char ** args_to_free, int size) {
+    free_only_queue(items);
     for(int i = 0; i < size; i++)
         free(args_to_free[i]);
     free(args_to_free);
 }
 
-void free_only_queue(Item * items_start) {
-    Item * tmp = items_start, * next;
-    while(tmp) {
-        next = tmp->next;
-        free(tmp->elem);
-        free(tmp);
-        tmp = next;
-    }
-}
-
 // misc
 int str_to_int(char * str) {
     int mult = 1, num = 0;
@@ -616,7 +768,6 @@ void str_reverse(char * str, int count) {
 char * int_to_str(int num) {
     char * str = NULL;
 	int para_num = num, count = 0, len = 1;
-	char tmp;
 	while(para_num) {
         if(count == len - 1)
             str = (char *) realloc(str, (len *= 2) * sizeof(char));
@@ -642,23 +793,11 @@ void free_2d_array(char ** array, int size) {
     free(array);
 }
 
-void str_append(char ** str1, char * str2, int * len1) {
-	int mult = 1, flag = 0, new_size;
-	if(*len1 == 0) {
-		new_size = strlen(str2) + 1;
-		*len1 = 1;
-		flag = 1;
-	} else
-		new_size = strlen(*str1) + strlen(str2) + 1;
-	for(int i = 0; i < 100; i++) {
-		if(*len1 * mult > new_size) break;
-		mult *= 2;
-	}
-	if(mult > 1)
-		*str1 = (char *) realloc(*str1, (*len1 *= mult) * sizeof(char));
-	if(flag) {
-		strncpy(*str1, str2, strlen(str2));
-		(*str1)[strlen(str2)] = '\0';
-	} else
-		strncat(*str1, str2, strlen(str2));
+char * get_option(int argc, char ** argv, char * name, char * default_value) {
+    size_t name_len = strlen(name);
+    // optional arguments follow the 12 required ones
+    for(int i = 13; i < argc; i++)
+        if(!strncmp(argv[i], name, name_len) && argv[i][name_len] == '=')
+            return argv[i] + name_len + 1;
+    return default_value;
 }
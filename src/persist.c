@@ -0,0 +1,70 @@
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include "persist.h"
+#include "history.h"
+#include "reactor.h"
+
+// body of the persistence thread
+static void * worker_main(void *);
+// write every request in the in ring
+static void write_requests(PersistWorker *);
+
+int persist_worker_start(PersistWorker * worker, Ring * in, Ring * out, char * file_name, char * chunks_dir, int flag_sync) {
+    worker->in = in;
+    worker->out = out;
+    worker->file_name = file_name;
+    worker->chunks_dir = chunks_dir;
+    worker->flag_sync = flag_sync;
+    if((worker->stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) return 0;
+    if(pthread_create(&worker->thread, NULL, &worker_main, worker)) {
+        close(worker->stop_fd);
+        return 0;
+    }
+    return 1;
+}
+
+void persist_worker_stop(PersistWorker * worker) {
+    uint64_t one = 1;
+    if(write(worker->stop_fd, &one, sizeof(one)) < 0) return;
+    pthread_join(worker->thread, NULL);
+    close(worker->stop_fd);
+}
+
+static void * worker_main(void * context) {
+    PersistWorker * worker = (PersistWorker *) context;
+    struct pollfd fds[2];
+    fds[0].fd = worker->in->event_fd;
+    fds[1].fd = worker->stop_fd;
+    fds[0].events = fds[1].events = POLLIN;
+    for(;;) {
+        if(poll(fds, 2, -1) < 0 && errno != EINTR) break;
+        ring_clear_event(worker->in);
+        write_requests(worker);
+        if(fds[1].revents & POLLIN) break;
+    }
+    return NULL;
+}
+
+static void write_requests(PersistWorker * worker) {
+    PersistRequest * request;
+    uint64_t start;
+    int i;
+    while((request = (PersistRequest *) ring_pop(worker->in))) {
+        start = reactor_now();
+        // the chunks go first, so the history file never refers to a chunk, that isn't there
+        /* their data never changes and the index thread keeps them alive until the request is back */
+        for(i = 0; i < request->chunks_count && chunk_save(worker->chunks_dir, request->chunks[i], worker->flag_sync); i++);
+        // one directory sync for all the new chunks
+        if(i == request->chunks_count && i && worker->flag_sync && !sync_directory(worker->chunks_dir)) i = 0;
+        request->bytes = i < request->chunks_count ? -1 : write_history_image(request->data, request->len, worker->file_name, worker->flag_sync);
+        if(request->bytes >= 0)
+            prune_chunks(request->data, request->len, worker->chunks_dir);
+        request->write_time = reactor_now() - start;
+        free(request->data);
+        request->data = NULL;
+        // the out ring can hold every request, that is in flight
+        ring_push(worker->out, request);
+    }
+}
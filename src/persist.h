@@ -0,0 +1,41 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "ring.h"
+#include "chunk_store.h"
+
+#ifndef PERSIST_H
+#define PERSIST_H
+
+// history file write handed from the index thread to the persistence thread
+typedef struct _persist_request {
+    char * data; // image of the history file(see history_image), freed by the persistence thread
+    size_t len;
+    Chunk ** chunks; // chunks, that are not saved yet, but the image refers to(see unsaved_chunks)
+    int chunks_count;
+    long bytes; // bytes written(-1 on error), set by the persistence thread
+    uint64_t write_time; // nanoseconds the write took
+} PersistRequest;
+
+// persistence thread
+/* it writes the history images it gets through the in ring and returns the requests */
+/* through the out ring, so the disk never blocks the capture or the index thread */
+typedef struct _persist_worker {
+    Ring * in; // requests to write
+    Ring * out; // written requests(its capacity must not be less than the in ring's)
+    char * file_name; // history file
+    char * chunks_dir; // directory of the chunk files(see history_chunks_dir)
+    int flag_sync; // sync the files before they are renamed(see write_to_file)
+    int stop_fd; // eventfd, that stops the thread once the in ring is drained
+    pthread_t thread;
+} PersistWorker;
+
+// start the persistence thread for the history file and its chunks directory(synced with flag_sync)
+/* every write is one group commit: the changes of a whole FLUSH_DELAY share its syncs */
+/* return 1 on success and 0 otherwise */
+int persist_worker_start(PersistWorker *, Ring *, Ring *, char *, char *, int);
+// write the requests, that are still in the in ring, then stop the thread and wait for it
+void persist_worker_stop(PersistWorker *);
+
+#endif
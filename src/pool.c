@@ -0,0 +1,144 @@
+#include "pool.h"
+
+// size of the block header(payloads after it stay aligned)
+#define BLOCK_HEADER POOL_ROUND_UP(sizeof(ArenaBlock))
+// every arena allocation starts with the pointer to its block
+#define ALLOC_HEADER POOL_ROUND_UP(sizeof(ArenaBlock *))
+
+// allocate a new arena block with the given usable size
+static ArenaBlock * create_block(Arena *, size_t);
+// unlink the block from the arena and free it(or keep it as spare)
+static void release_block(Arena *, ArenaBlock *);
+
+void pool_init(Pool * pool, size_t object_size, size_t objects_per_slab) {
+    pool->object_size = POOL_ROUND_UP(object_size < sizeof(void *) ? sizeof(void *) : object_size);
+    pool->objects_per_slab = objects_per_slab ? objects_per_slab : 1;
+    pool->free_list = NULL;
+    pool->slab_cursor = pool->slab_end = NULL;
+    pool->slabs = NULL;
+    pool->slabs_count = 0;
+}
+
+void * pool_alloc(Pool * pool) {
+    void * object;
+    if((object = pool->free_list)) {
+        pool->free_list = *(void **) object;
+        return object;
+    }
+    if(pool->slab_cursor == pool->slab_end) {
+        // start a new slab(its first POOL_ALIGN bytes link it to the previous one)
+        char * slab = (char *) malloc(POOL_ALIGN + pool->object_size * pool->objects_per_slab);
+        if(!slab) return NULL;
+        *(void **) slab = pool->slabs;
+        pool->slabs = slab;
+        pool->slabs_count++;
+        pool->slab_cursor = slab + POOL_ALIGN;
+        pool->slab_end = pool->slab_cursor + pool->object_size * pool->objects_per_slab;
+    }
+    object = pool->slab_cursor;
+    pool->slab_cursor += pool->object_size;
+    return object;
+}
+
+void pool_free(Pool * pool, void * object) {
+    if(!object) return;
+    *(void **) object = pool->free_list;
+    pool->free_list = object;
+}
+
+void pool_destroy(Pool * pool) {
+    void * slab = pool->slabs, * next;
+    while(slab) {
+        next = *(void **) slab;
+        free(slab);
+        slab = next;
+    }
+    pool_init(pool, pool->object_size, pool->objects_per_slab);
+}
+
+void arena_init(Arena * arena, size_t block_size) {
+    arena->blocks = arena->big = NULL;
+    arena->spare = NULL;
+    arena->block_size = POOL_ROUND_UP(block_size);
+    arena->bytes = 0;
+}
+
+void * arena_alloc(Arena * arena, size_t len) {
+    ArenaBlock * block = arena->blocks;
+    size_t size = ALLOC_HEADER + POOL_ROUND_UP(len);
+    char * ptr;
+    if(size > arena->block_size / 4) {
+        // big payload: a block of its own, that is never bumped into(it is freed with the payload)
+        if(!(block = create_block(arena, size))) return NULL;
+        block->flag_big = 1;
+        block->next = arena->big;
+        if(arena->big) arena->big->prev = block;
+        arena->big = block;
+    } else if(!block || block->size - block->used < size) {
+        // current block is full: start a new current block
+        if(arena->spare) {
+            block = arena->spare;
+            arena->spare = NULL;
+            block->used = block->live = 0;
+        } else if(!(block = create_block(arena, arena->block_size))) return NULL;
+        block->prev = NULL;
+        block->next = arena->blocks;
+        if(arena->blocks) arena->blocks->prev = block;
+        arena->blocks = block;
+        // previous current block may already be empty
+        if(block->next && !block->next->live)
+            release_block(arena, block->next);
+    }
+    ptr = (char *) block + BLOCK_HEADER + block->used;
+    block->used += size;
+    block->live++;
+    *(ArenaBlock **) ptr = block;
+    return ptr + ALLOC_HEADER;
+}
+
+void arena_free(Arena * arena, void * ptr) {
+    ArenaBlock * block;
+    if(!ptr) return;
+    block = *(ArenaBlock **) ((char *) ptr - ALLOC_HEADER);
+    if(--block->live) return;
+    if(block == arena->blocks)
+        block->used = 0; // current block: just start bumping from the beginning again
+    else
+        release_block(arena, block);
+}
+
+void arena_destroy(Arena * arena) {
+    ArenaBlock * lists[2] = {arena->blocks, arena->big}, * block, * next;
+    for(int i = 0; i < 2; i++)
+        for(block = lists[i]; block; block = next) {
+            next = block->next;
+            free(block);
+        }
+    free(arena->spare);
+    arena_init(arena, arena->block_size);
+}
+
+static ArenaBlock * create_block(Arena * arena, size_t size) {
+    ArenaBlock * block = (ArenaBlock *) malloc(BLOCK_HEADER + size);
+    if(!block) return NULL;
+    block->prev = block->next = NULL;
+    block->size = size;
+    block->used = block->live = 0;
+    block->flag_big = 0;
+    arena->bytes += BLOCK_HEADER + size;
+    return block;
+}
+
+static void release_block(Arena * arena, ArenaBlock * block) {
+    if(block->prev) block->prev->next = block->next;
+    else if(block->flag_big) arena->big = block->next;
+    else arena->blocks = block->next;
+    if(block->next) block->next->prev = block->prev;
+    // keep one regular block around, so that the arena doesn't malloc/free on every boundary
+    if(!arena->spare && !block->flag_big) {
+        arena->spare = block;
+        return;
+    }
+    arena->bytes -= BLOCK_HEADER + block->size;
+    free(block);
+}
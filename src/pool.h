@@ -0,0 +1,61 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifndef POOL_H
+#define POOL_H
+
+// alignment of everything, that pools and arenas hand out
+#define POOL_ALIGN 16
+#define POOL_ROUND_UP(size) (((size) + POOL_ALIGN - 1) & ~((size_t) POOL_ALIGN - 1))
+
+// pool of fixed-size objects, carved out of big slabs
+/* freed objects are kept in the free list and reused before the slabs grow, */
+/* so a long running process never fragments the heap with them */
+typedef struct _pool {
+    size_t object_size; // size of one object(rounded up to POOL_ALIGN)
+    size_t objects_per_slab;
+    void * free_list; // freed objects, linked through their first word
+    char * slab_cursor, * slab_end; // not yet used part of the newest slab
+    void * slabs; // all slabs, linked through their first word
+    size_t slabs_count;
+} Pool;
+
+// block of the arena(allocations follow the header)
+typedef struct _arena_block {
+    struct _arena_block * prev, * next;
+    size_t size; // usable bytes after the header
+    size_t used; // bytes handed out so far
+    size_t live; // number of allocations, that were not freed yet
+    int flag_big; // the block holds one big payload(it is in the big list and never current)
+} ArenaBlock;
+
+// bump allocator for variable-size payloads(e.g. strings)
+/* every allocation remembers its block, and a block is released as soon as */
+/* all of its allocations are freed, so memory follows the live payloads; */
+/* a big payload gets a block of its own, that goes back to the system with it */
+typedef struct _arena {
+    ArenaBlock * blocks; // regular blocks, the current one(where allocations are bumped) first
+    ArenaBlock * big; // blocks of the big payloads
+    ArenaBlock * spare; // one empty block kept for reuse
+    size_t block_size;
+    size_t bytes; // bytes reserved from the system
+} Arena;
+
+// initialize the pool of objects of the given size
+void pool_init(Pool *, size_t, size_t);
+// get an object from the pool(contents are undefined)
+void * pool_alloc(Pool *);
+// give the object back to the pool
+void pool_free(Pool *, void *);
+// free all objects at once by releasing the slabs
+void pool_destroy(Pool *);
+// initialize the arena with the given block size
+void arena_init(Arena *, size_t);
+// get len bytes from the arena(payloads bigger than a quarter of a block get a block of their own)
+void * arena_alloc(Arena *, size_t);
+// give the allocation back to its block
+void arena_free(Arena *, void *);
+// free all allocations at once by releasing the blocks
+void arena_destroy(Arena *);
+
+#endif
@@ -0,0 +1,92 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "query_server.h"
+
+/* command line client of the daemon's query socket(see the protocol in query_server.h) */
+/* usage: query_client.out SOCKET list [offset] [count] */
+/*                                get <index>|@<id>           (prints the entry as it is, e.g. for xclip) */
+/*                                search <text>... */
+/*                                promote <index>|@<id> */
+
+// print one entry of a listing: its position, id, capture time, source and the shown start of it on one line
+/* an entry without shown bytes(a binary one) is printed as its type and length */
+static void print_entry(int index, unsigned long long id, long long time_value, size_t len, char * mime, char * source, char * data, size_t shown) {
+    char date[32];
+    time_t capture_time = (time_t) time_value;
+    strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", localtime(&capture_time));
+    printf("%d @%llu %s %s ", index, id, date, source);
+    if(!shown && len) {
+        printf("[%s, %zu bytes]\n", mime, len);
+        return;
+    }
+    for(size_t i = 0; i < shown; i++)
+        putchar(data[i] == '\n' || data[i] == '\t' ? ' ' : data[i]);
+    printf("%s\n", shown < len ? "..." : "");
+}
+
+int main(int argc, char ** argv) {
+    struct sockaddr_un address;
+    char request[QUERY_MAX_LINE], header[QUERY_HEADER_SIZE], mime[QUERY_HEADER_SIZE], source[QUERY_HEADER_SIZE], * data = NULL;
+    size_t request_len, len, shown, data_size = 0;
+    unsigned long long id;
+    long long time_value;
+    int fd, count, index, flag_raw;
+    FILE * fp;
+    if(argc < 3 || (strcmp(argv[2], "list") && argc < 4)) {
+        fprintf(stderr, "usage: %s SOCKET list [offset] [count] | get <index>|@<id> | search <text>... | promote <index>|@<id>\n", argv[0]);
+        return 1;
+    }
+    /* the request is the upper-cased command and its arguments on one line */
+    request_len = 0;
+    for(int i = 2; i < argc; i++) {
+        len = strlen(argv[i]);
+        if(request_len + len + 2 > sizeof(request) || strchr(argv[i], '\n')) {
+            fprintf(stderr, "the request doesn't fit into one line\n");
+            return 1;
+        }
+        if(i > 2) request[request_len++] = ' ';
+        for(size_t j = 0; j < len; j++)
+            request[request_len++] = i == 2 && argv[i][j] >= 'a' && argv[i][j] <= 'z' ? argv[i][j] - 'a' + 'A' : argv[i][j];
+    }
+    request[request_len++] = '\n';
+    flag_raw = !strcmp(argv[2], "get");
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, argv[1], sizeof(address.sun_path) - 1);
+    if((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 || connect(fd, (struct sockaddr *) &address, sizeof(address))) {
+        perror(argv[1]);
+        return 1;
+    }
+    if(write(fd, request, request_len) != (ssize_t) request_len || !(fp = fdopen(fd, "r"))) {
+        perror("write");
+        return 1;
+    }
+    if(!fgets(header, sizeof(header), fp) || strncmp(header, "OK ", 3)) {
+        fprintf(stderr, "%s", *header ? header : "no response\n");
+        return 1;
+    }
+    count = atoi(header + 3);
+    for(int i = 0; i < count; i++) {
+        if(!fgets(header, sizeof(header), fp) || sscanf(header, "%d %llu %lld %zu %zu %s %s", &index, &id, &time_value, &len, &shown, mime, source) != 7) {
+            fprintf(stderr, "broken response\n");
+            return 1;
+        }
+        if(shown > data_size)
+            data = (char *) realloc(data, (data_size = shown));
+        if(fread(data, 1, shown, fp) != shown) {
+            fprintf(stderr, "broken response\n");
+            return 1;
+        }
+        if(flag_raw) fwrite(data, 1, shown, stdout);
+        else print_entry(index, id, time_value, len, mime, source, data, shown);
+    }
+    free(data);
+    fclose(fp);
+    return 0;
+}
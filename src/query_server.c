@@ -0,0 +1,422 @@
+#define _GNU_SOURCE // accept4
+#include <unistd.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <sys/epoll.h>
+#include "query_server.h"
+
+// entries, that LIST answers with, if the count is not given
+#define DEFAULT_LIST_COUNT 20
+
+// listening socket handler: take the new clients
+static void on_accept(Reactor *, void *, uint32_t);
+// client socket handler: read the requests and send what the socket can take
+static void on_client(Reactor *, void *, uint32_t);
+// handle the complete request lines of the client, until its output gets stuck
+static void handle_requests(QueryClient *);
+// build the response to one request line in server->iov
+static void handle_request(QueryServer *, char *, size_t);
+// find the entry by "<index>" or "@<id>"(NULL if there is no such entry)
+static Item * find_entry(QueryServer *, char *);
+// append formatted text to the response
+static void add_text(QueryServer *, const char *, ...);
+// append the header and the first shown bytes of the item to the response
+static void add_entry(QueryServer *, Item *, int, size_t);
+// number of bytes of the item, that fit into max bytes without cutting a character
+static size_t preview_len(Item *, size_t);
+// send the response to the client and keep what the socket didn't take(return 0 if the client is gone)
+static int send_response(QueryClient *);
+// keep the unsent part of the response: copy it, but pin a long payload at its end
+static void keep_rest(QueryClient *, struct iovec *, int);
+// send the kept output(return 0 if the client is gone)
+static int flush_client(QueryClient *);
+// the client has output, that the socket didn't take yet
+static int has_output(QueryClient *);
+// append bytes to the kept output
+static void append_out(QueryClient *, const char *, size_t);
+// append len bytes of the payload of the item from the offset to the kept output
+static void append_payload(QueryClient *, Item *, size_t, size_t);
+// contiguous bytes of the payload of the item from the offset(their number is stored)
+static char * payload_at(Item *, size_t, size_t *);
+// disconnect the client and free its slot
+static void close_client(QueryClient *);
+// compare function for the id index
+static int id_equal(const void *, const char *, size_t);
+
+int query_server_start(QueryServer * server, Reactor * reactor, char * socket_file, Queue * queue, TrigramIndex * search, QueryChanged changed, void * context) {
+    struct sockaddr_un address;
+    int fd;
+    server->reactor = reactor;
+    server->socket_file = socket_file;
+    server->queue = queue;
+    server->search = search;
+    server->changed = changed;
+    server->context = context;
+    server->source_names = NULL;
+    server->sources_count = 0;
+    server->listener.fd = -1;
+    if(strlen(socket_file) >= sizeof(address.sun_path)) return 0;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, socket_file);
+    if((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0) return 0;
+    // a file left by a daemon, that didn't exit cleanly, would make bind fail
+    unlink(socket_file);
+    // the daemon runs with umask 0, so the socket is closed to other users explicitly
+    if(bind(fd, (struct sockaddr *) &address, sizeof(address)) || chmod(socket_file, 0600) || listen(fd, QUERY_MAX_CLIENTS)) {
+        close(fd);
+        return 0;
+    }
+    if(!reactor_add(reactor, &server->listener, fd, EPOLLIN, &on_accept, server)) return 0;
+    server->clients = (QueryClient *) calloc(QUERY_MAX_CLIENTS, sizeof(QueryClient));
+    for(int i = 0; i < QUERY_MAX_CLIENTS; i++) {
+        server->clients[i].source.fd = -1;
+        server->clients[i].server = server;
+    }
+    server->by_id = hash_index_create(queue->capacity, &id_equal);
+    for(Item * item = queue->start; item; item = item->next)
+        hash_index_insert(server->by_id, item, sizeof(item->id), item->id);
+    return 1;
+}
+
+void query_server_listener(void * context, Queue * queue, int event, Item * item) {
+    QueryServer * server = (QueryServer *) context;
+    QueryClient * client;
+    if(event == QUEUE_INSERTED)
+        hash_index_insert(server->by_id, item, sizeof(item->id), item->id);
+    else if(event == QUEUE_EVICTED) {
+        hash_index_remove(server->by_id, item, item->id);
+        // a client, that is still waiting for the payload, gets its own copy before the item goes away
+        for(int i = 0; i < QUERY_MAX_CLIENTS; i++) {
+            client = &server->clients[i];
+            if(client->source.fd < 0 || client->pinned != item) continue;
+            append_payload(client, item, client->pinned_offset, client->pinned_len);
+            client->pinned = NULL;
+        }
+    }
+}
+
+void query_server_stop(QueryServer * server) {
+    if(server->listener.fd < 0) return;
+    for(int i = 0; i < QUERY_MAX_CLIENTS; i++)
+        if(server->clients[i].source.fd >= 0)
+            close_client(&server->clients[i]);
+    free(server->clients);
+    reactor_remove(server->reactor, &server->listener);
+    unlink(server->socket_file);
+    hash_index_free(server->by_id);
+    server->clients = NULL;
+    server->by_id = NULL;
+}
+
+static void on_accept(Reactor * reactor, void * context, uint32_t events) {
+    QueryServer * server = (QueryServer *) context;
+    QueryClient * client;
+    int fd, i;
+    while((fd = accept4(server->listener.fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        for(i = 0; i < QUERY_MAX_CLIENTS && server->clients[i].source.fd >= 0; i++);
+        if(i == QUERY_MAX_CLIENTS) {
+            close(fd); // no free slot
+            continue;
+        }
+        client = &server->clients[i];
+        client->in_len = 0;
+        client->out_len = client->out_sent = 0;
+        client->pinned = NULL;
+        reactor_add(reactor, &client->source, fd, EPOLLIN, &on_client, client);
+    }
+}
+
+static void on_client(Reactor * reactor, void * context, uint32_t events) {
+    QueryClient * client = (QueryClient *) context;
+    ssize_t len;
+    if(events & EPOLLOUT) {
+        if(!flush_client(client)) {
+            close_client(client);
+            return;
+        }
+        if(has_output(client)) return;
+        // everything is sent, so the requests, that waited for it, go on
+        reactor_modify(reactor, &client->source, EPOLLIN);
+        handle_requests(client);
+        return;
+    }
+    if(events & EPOLLIN) {
+        len = read(client->source.fd, client->in + client->in_len, QUERY_MAX_LINE - client->in_len);
+        if(len < 0 && (errno == EAGAIN || errno == EINTR)) return;
+        if(len <= 0) {
+            close_client(client);
+            return;
+        }
+        client->in_len += len;
+        handle_requests(client);
+        // a full buffer without a newline is not a request
+        if(client->source.fd >= 0 && client->in_len == QUERY_MAX_LINE && !has_output(client))
+            close_client(client);
+    } else close_client(client); // EPOLLHUP or EPOLLERR
+}
+
+static void handle_requests(QueryClient * client) {
+    char * newline;
+    size_t line_len;
+    while(!has_output(client) && (newline = (char *) memchr(client->in, '\n', client->in_len))) {
+        line_len = newline - client->in;
+        handle_request(client->server, client->in, line_len);
+        if(!send_response(client)) {
+            close_client(client);
+            return;
+        }
+        client->in_len -= line_len + 1;
+        memmove(client->in, newline + 1, client->in_len);
+    }
+    // the next requests wait, until the socket takes the rest of this response
+    if(has_output(client))
+        reactor_modify(client->server->reactor, &client->source, EPOLLOUT);
+}
+
+static void handle_request(QueryServer * server, char * line, size_t len) {
+    char * args, * end;
+    long offset, count;
+    Item * item;
+    int found;
+    server->iov_count = 0;
+    server->text_len = 0;
+    server->tail_item = NULL;
+    if(len && line[len - 1] == '\r') len--;
+    line[len] = '\0';
+    // the request name ends at the first space, the arguments follow it
+    if((args = (char *) memchr(line, ' ', len))) *args++ = '\0';
+    else args = line + len;
+    if(!strcmp(line, "LIST")) {
+        offset = strtol(args, &end, 10);
+        count = strtol(end, &end, 10);
+        if(end == args || !count) count = DEFAULT_LIST_COUNT;
+        if(offset < 0 || count < 0) {
+            add_text(server, "ERR bad range\n");
+            return;
+        }
+        if(count > QUERY_MAX_ENTRIES) count = QUERY_MAX_ENTRIES;
+        found = offset < server->queue->size ? server->queue->size - offset : 0;
+        if(found > count) found = count;
+        add_text(server, "OK %d\n", found);
+        item = found ? find_nth_item(server->queue, offset) : NULL;
+        for(int i = 0; i < found; i++, item = item->next)
+            add_entry(server, item, offset + i, preview_len(item, QUERY_PREVIEW_BYTES));
+    } else if(!strcmp(line, "GET")) {
+        if(!(item = find_entry(server, args))) {
+            add_text(server, "ERR no such entry\n");
+            return;
+        }
+        add_text(server, "OK 1\n");
+        add_entry(server, item, item_index(server->queue, item), item->len);
+    } else if(!strcmp(line, "SEARCH")) {
+        if(!*args) {
+            add_text(server, "ERR empty query\n");
+            return;
+        }
+        found = trigram_search(server->search, server->queue, args, line + len - args, server->results, QUERY_SEARCH_RESULTS);
+        add_text(server, "OK %d\n", found);
+        for(int i = 0; i < found; i++)
+            add_entry(server, server->results[i], item_index(server->queue, server->results[i]), preview_len(server->results[i], QUERY_PREVIEW_BYTES));
+    } else if(!strcmp(line, "PROMOTE")) {
+        if(!(item = find_entry(server, args))) {
+            add_text(server, "ERR no such entry\n");
+            return;
+        }
+        // the same as copying it again
+        if(move_item(server->queue, item, 0) && server->changed)
+            (*server->changed)(server, server->context);
+        add_text(server, "OK 1\n");
+        add_entry(server, item, 0, preview_len(item, QUERY_PREVIEW_BYTES));
+    } else add_text(server, "ERR unknown request\n");
+}
+
+static Item * find_entry(QueryServer * server, char * arg) {
+    char * end;
+    unsigned long long id;
+    long index;
+    if(*arg == '@') {
+        id = strtoull(arg + 1, &end, 10);
+        if(end == arg + 1) return NULL;
+        return (Item *) hash_index_find(server->by_id, (char *) &id, sizeof(id), id);
+    }
+    index = strtol(arg, &end, 10);
+    if(end == arg || index < 0 || index >= server->queue->size) return NULL;
+    return find_nth_item(server->queue, (int) index);
+}
+
+static void add_text(QueryServer * server, const char * format, ...) {
+    struct iovec * last = server->iov_count ? &server->iov[server->iov_count - 1] : NULL;
+    char * text = server->text + server->text_len;
+    va_list args;
+    int len;
+    va_start(args, format);
+    len = vsnprintf(text, QUERY_HEADER_SIZE, format, args);
+    va_end(args);
+    if(len >= QUERY_HEADER_SIZE) len = QUERY_HEADER_SIZE - 1;
+    server->text_len += len;
+    // text, that follows text, goes out in the same piece
+    if(last && (char *) last->iov_base + last->iov_len == text)
+        last->iov_len += len;
+    else {
+        server->iov[server->iov_count].iov_base = text;
+        server->iov[server->iov_count++].iov_len = len;
+    }
+    server->tail_item = NULL;
+}
+
+static void add_entry(QueryServer * server, Item * item, int index, size_t shown) {
+    int iov_size = sizeof(server->iov) / sizeof(server->iov[0]);
+    size_t left = shown, len;
+    char * source = server->source_names && item->source > 0 && item->source <= server->sources_count ? server->source_names[item->source] : "-";
+    add_text(server, "%d %llu %lld %zu %zu %s %s\n", index, item->id, (long long) item->time, item->len, shown, item_mime(item), source);
+    if(!shown) return;
+    // the payload is sent right from the item(from its chunks, or the backing, that it points into)
+    for(int i = 0; left && i < item_pieces(item) && server->iov_count < iov_size; i++) {
+        server->iov[server->iov_count].iov_base = item_piece(item, i, &len);
+        server->iov[server->iov_count++].iov_len = len < left ? len : left;
+        left -= len < left ? len : left;
+    }
+    server->tail_item = item;
+    server->tail_shown = shown;
+    server->tail_rest = left;
+}
+
+static size_t preview_len(Item * item, size_t max) {
+    size_t len = max, first_len;
+    char * first = item_piece(item, 0, &first_len);
+    // bytes of an image would only garble the listing
+    if(!ITEM_IS_TEXT(item->type)) return 0;
+    if(item->len <= max) return item->len;
+    // step back to the first byte of a character(the first chunk is longer than any preview)
+    while(len > 0 && len < first_len && ((unsigned char) first[len] & 0xc0) == 0x80)
+        len--;
+    return len;
+}
+
+static int send_response(QueryClient * client) {
+    QueryServer * server = client->server;
+    struct iovec * iov = server->iov;
+    struct msghdr message;
+    int left = server->iov_count;
+    ssize_t sent;
+    while(left) {
+        memset(&message, 0, sizeof(message));
+        message.msg_iov = iov;
+        message.msg_iovlen = left < IOV_MAX ? left : IOV_MAX;
+        if((sent = sendmsg(client->source.fd, &message, MSG_NOSIGNAL | MSG_DONTWAIT)) < 0) {
+            if(errno == EINTR) continue;
+            if(errno == EAGAIN || errno == EWOULDBLOCK) break;
+            return 0;
+        }
+        // skip the pieces, that were sent, and the sent start of the next one
+        while(left && (size_t) sent >= iov->iov_len) {
+            sent -= iov->iov_len;
+            iov++;
+            left--;
+        }
+        if(left) {
+            iov->iov_base = (char *) iov->iov_base + sent;
+            iov->iov_len -= sent;
+        }
+    }
+    // the payload, that didn't fit into iov, is never sent here
+    if(left || (server->tail_item && server->tail_rest))
+        keep_rest(client, iov, left);
+    return 1;
+}
+
+static void keep_rest(QueryClient * client, struct iovec * iov, int left) {
+    QueryServer * server = client->server;
+    Item * item = server->tail_item;
+    size_t rest = item ? server->tail_rest : 0;
+    // only the end of the response can wait in its item, the rest has to be copied to keep the order
+    if(item && left && rest + iov[left - 1].iov_len >= QUERY_PIN_MIN_BYTES)
+        rest += iov[--left].iov_len;
+    for(int i = 0; i < left; i++)
+        append_out(client, (char *) iov[i].iov_base, iov[i].iov_len);
+    if(!rest) return;
+    if(rest >= QUERY_PIN_MIN_BYTES) {
+        client->pinned = item;
+        client->pinned_offset = server->tail_shown - rest;
+        client->pinned_len = rest;
+    } else append_payload(client, item, server->tail_shown - rest, rest);
+}
+
+static int flush_client(QueryClient * client) {
+    ssize_t sent;
+    size_t len;
+    char * data;
+    while(client->out_sent < client->out_len) {
+        sent = send(client->source.fd, client->out + client->out_sent, client->out_len - client->out_sent, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if(sent < 0) {
+            if(errno == EINTR) continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        client->out_sent += sent;
+    }
+    client->out_len = client->out_sent = 0;
+    while(client->pinned && client->pinned_len) {
+        data = payload_at(client->pinned, client->pinned_offset, &len);
+        sent = send(client->source.fd, data, len < client->pinned_len ? len : client->pinned_len, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if(sent < 0) {
+            if(errno == EINTR) continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        client->pinned_offset += sent;
+        client->pinned_len -= sent;
+    }
+    client->pinned = NULL;
+    return 1;
+}
+
+static int has_output(QueryClient * client) {
+    return client->out_sent < client->out_len || client->pinned;
+}
+
+static void append_out(QueryClient * client, const char * data, size_t len) {
+    if(client->out_len + len > client->out_size) {
+        client->out_size = (client->out_len + len) * 2;
+        client->out = (char *) realloc(client->out, client->out_size);
+    }
+    memcpy(client->out + client->out_len, data, len);
+    client->out_len += len;
+}
+
+static void append_payload(QueryClient * client, Item * item, size_t offset, size_t len) {
+    if(client->out_len + len > client->out_size) {
+        client->out_size = (client->out_len + len) * 2;
+        client->out = (char *) realloc(client->out, client->out_size);
+    }
+    item_copy(item, offset, len, client->out + client->out_len);
+    client->out_len += len;
+}
+
+static char * payload_at(Item * item, size_t offset, size_t * len) {
+    char * piece;
+    for(int i = 0; ; i++) {
+        piece = item_piece(item, i, len);
+        if(offset < *len || i + 1 == item_pieces(item)) break;
+        offset -= *len;
+    }
+    *len -= offset;
+    return piece + offset;
+}
+
+static void close_client(QueryClient * client) {
+    reactor_remove(client->server->reactor, &client->source);
+    free(client->out);
+    client->out = NULL;
+    client->out_len = client->out_sent = client->out_size = 0;
+    client->pinned = NULL;
+    client->in_len = 0;
+}
+
+static int id_equal(const void * value, const char * key, size_t len) {
+    return ((const Item *) value)->id == *(const unsigned long long *) key;
+}
@@ -0,0 +1,91 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/uio.h>
+#include "queue.h"
+#include "reactor.h"
+#include "hash_index.h"
+#include "trigram_index.h"
+
+#ifndef QUERY_SERVER_H
+#define QUERY_SERVER_H
+
+// clients, that may be connected at once(later ones are turned away)
+#define QUERY_MAX_CLIENTS 64
+// longest request line
+#define QUERY_MAX_LINE 4096
+// bytes of every entry, that LIST and SEARCH show(GET sends the whole entry)
+#define QUERY_PREVIEW_BYTES 120
+// most entries, that one LIST answers with
+#define QUERY_MAX_ENTRIES 1000
+// most entries, that one SEARCH answers with
+#define QUERY_SEARCH_RESULTS 50
+// longest header line of an entry
+#define QUERY_HEADER_SIZE 160
+// a payload at least this long stays in its item, while the client can't take it(shorter ones are copied)
+#define QUERY_PIN_MIN_BYTES (64 * 1024)
+
+/* protocol: one request per line, every response starts with "OK <entries>\n" or "ERR <reason>\n" */
+/*   LIST [offset] [count]   - entries from the offset-th newest one(count defaults to 20) */
+/*   GET <index>|@<id>       - the whole entry by its position(0 is the newest) or its id */
+/*   SEARCH <text>           - entries, that contain the rest of the line, newest first */
+/*   PROMOTE <index>|@<id>   - move the entry to the start of the history, as if it was copied again */
+/* every entry is a header line "<index> <id> <time> <len> <shown> <mime> <source>\n" followed by <shown> bytes */
+/* of the payload(no newline after them, so binary payloads go through as they are); */
+/* LIST, SEARCH and PROMOTE show no bytes of a binary entry(see ITEM_IS_TEXT), only GET sends it; */
+/* <source> is the name of the capture source, that copied the entry last("-" if it came from elsewhere) */
+
+struct _query_server;
+// called after PROMOTE changed the queue(gets the server and the context)
+typedef void (*QueryChanged)(struct _query_server *, void *);
+
+// connection of one client
+/* responses are sent straight from the items(or their chunks); only what the socket couldn't take is kept: */
+/* copied into out, except a long payload at the end, that is sent from its item later */
+/* (and copied only if the item is evicted in the meantime) */
+typedef struct _query_client {
+    ReactorSource source; // fd is -1 if the slot is free
+    struct _query_server * server;
+    char in[QUERY_MAX_LINE]; // request bytes, that were read, but not handled yet
+    size_t in_len;
+    char * out; // unsent response bytes
+    size_t out_len, out_sent, out_size;
+    Item * pinned; // item, whose payload follows out(NULL if none)
+    size_t pinned_offset, pinned_len; // part of the payload, that is not sent yet(offset into the whole payload)
+} QueryClient;
+
+// Unix socket server, that answers queries about the queue from the index thread's reactor
+/* clients are non-blocking sockets in the same epoll set as the captures, and the capture */
+/* thread runs on its own, so a busy or stuck client never holds up the clipboard reads */
+typedef struct _query_server {
+    Reactor * reactor;
+    ReactorSource listener; // listening socket(fd is -1 if the server is not running)
+    char * socket_file;
+    Queue * queue;
+    TrigramIndex * search;
+    HashIndex * by_id; // items by their id
+    QueryClient * clients; // QUERY_MAX_CLIENTS slots(never freed while the reactor runs)
+    QueryChanged changed;
+    void * context;
+    char ** source_names; // names of the capture sources by their number(NULL: all entries show "-")
+    int sources_count;
+    /* response, that is being built(headers are written into text, payloads are referenced) */
+    struct iovec iov[2 * QUERY_MAX_ENTRIES + 2];
+    int iov_count;
+    char text[QUERY_MAX_ENTRIES * QUERY_HEADER_SIZE + QUERY_HEADER_SIZE];
+    size_t text_len;
+    Item * tail_item; // item, whose payload is the last part of the response(NULL if it ends with text)
+    size_t tail_shown; // bytes of its payload in the response
+    size_t tail_rest; // bytes of them at the end, that didn't fit into iov(a long chunked payload)
+    Item * results[QUERY_SEARCH_RESULTS];
+} QueryServer;
+
+// start listening on the socket file(an old file is replaced) and index the items of the queue
+/* arguments: server, reactor, socket file, queue, its search index, callback for PROMOTE and its context */
+/* return 1 on success and 0 otherwise */
+int query_server_start(QueryServer *, Reactor *, char *, Queue *, TrigramIndex *, QueryChanged, void *);
+// queue listener, that keeps the id index and the pinned payloads up to date
+void query_server_listener(void *, Queue *, int, Item *);
+// disconnect the clients, close the socket and remove its file
+void query_server_stop(QueryServer *);
+
+#endif
@@ -0,0 +1,660 @@
+#define _GNU_SOURCE // memmem
+#include <limits.h>
+#include "queue.h"
+#include "avl_typed.h"
+
+// number of items in one slab of the items pool
+#define ITEMS_PER_SLAB 256
+// size of one block of the strings arena
+#define STRINGS_BLOCK_SIZE (64 * 1024)
+
+// unlink the item from the queue, but don't free it
+static void unlink_item(Queue *, Item *);
+// link the item at the start(or at the end, if flag_reversed is set) of the queue
+static void link_item(Queue *, Item *, int);
+// link the item right before the other one(at the end, if it is NULL)
+static void link_item_before(Queue *, Item *, Item *);
+// the item's stamp is newer than (seq, device)
+static int stamp_newer(Item *, long long, unsigned long long);
+// give the item a capture time and sequence number for its new position
+static void stamp_item(Queue *, Item *, int);
+// evict items until a new item of len bytes fits(return 0 if it would never fit)
+static int make_room(Queue *, size_t);
+// evict the item with the lowest priority
+static void evict_lowest(Queue *);
+// give the item its GDSF priority and put it into by_priority(after its hits changed)
+static void prioritize_item(Queue *, Item *);
+// copy the elem of a backed item into the arena(or the chunk store) and let go of the backing
+static void materialize_item(Queue *, Item *);
+// take one more reference to the backing(the queue remembers the backings, that it uses)
+static void use_backing(Queue *, Backing *);
+// build by_content out of the items(it is built on its first use only)
+static void build_content_tree(Queue *);
+// keep len bytes of str as the item's payload: chunked if it is big enough, else copied into the arena
+static void store_payload(Queue *, Item *, char *, size_t);
+// memory, that the item is charged for in queue->bytes
+static size_t item_charge(Item *);
+// compare n bytes of the payload from the offset with str(like memcmp)
+static int compare_range(const Item *, size_t, const char *, size_t);
+// let go of one reference to the backing
+static void release_backing(Queue *, Backing *);
+// tell all the listeners about the event
+static void notify(Queue *, int, Item *);
+// compare function for the hash index
+static int item_equal(const void *, const char *, size_t);
+// compare functions for the AVL trees
+static int compare_content(const void *, const void *, void *);
+static int compare_time(const void *, const void *, void *);
+static int compare_priority(const void *, const void *, void *);
+
+// AVL tree operations with the compare functions inlined
+#define COMPARE_CONTENT(tree, a, b) compare_content((a), (b), NULL)
+#define COMPARE_TIME(tree, a, b) compare_time((a), (b), NULL)
+#define COMPARE_PRIORITY(tree, a, b) compare_priority((a), (b), NULL)
+AVL_TREE_DEFINE(content_tree, COMPARE_CONTENT)
+AVL_TREE_DEFINE(time_tree, COMPARE_TIME)
+AVL_TREE_DEFINE(priority_tree, COMPARE_PRIORITY)
+
+// memory, that the item is charged for
+#define ITEM_BYTES(len) ((len) + QUEUE_ITEM_OVERHEAD)
+
+void queue_init(Queue * queue, int capacity) {
+    queue->start = NULL;
+    queue->end = NULL;
+    queue->size = 0;
+    queue->capacity = capacity;
+    queue->index = hash_index_create(capacity, &item_equal);
+    queue->by_content = NULL;
+    queue->by_time = create_tree(&compare_time, NULL);
+    queue->by_priority = NULL;
+    queue->bytes = queue->max_bytes = 0;
+    queue->inflation = 0;
+    queue->newest_seq = queue->oldest_seq = 0;
+    queue->device = queue->source = 0;
+    pool_init(&queue->items_pool, sizeof(Item), ITEMS_PER_SLAB);
+    arena_init(&queue->strings, STRINGS_BLOCK_SIZE);
+    queue->chunk_store = NULL;
+    queue->next_id = 1;
+    queue->listeners_count = 0;
+    queue->backings = NULL;
+}
+
+void queue_set_budget(Queue * queue, size_t max_bytes) {
+    queue->max_bytes = max_bytes;
+    if(max_bytes && !queue->by_priority)
+        queue->by_priority = create_tree(&compare_priority, NULL);
+}
+
+void queue_set_chunk_store(Queue * queue, ChunkStore * store) {
+    queue->chunk_store = store;
+}
+
+size_t queue_memory(Queue * queue) {
+    return queue->bytes + (queue->chunk_store ? queue->chunk_store->bytes : 0);
+}
+
+int queue_add_listener(Queue * queue, QueueListener listener, void * context) {
+    if(queue->listeners_count == QUEUE_MAX_LISTENERS) return 0;
+    queue->listeners[queue->listeners_count] = listener;
+    queue->listener_contexts[queue->listeners_count] = context;
+    queue->listeners_count++;
+    return 1;
+}
+
+void queue_remove_listener(Queue * queue, QueueListener listener, void * context) {
+    for(int i = 0; i < queue->listeners_count; i++) {
+        if(queue->listeners[i] != listener || queue->listener_contexts[i] != context) continue;
+        for(int j = i + 1; j < queue->listeners_count; j++) {
+            queue->listeners[j - 1] = queue->listeners[j];
+            queue->listener_contexts[j - 1] = queue->listener_contexts[j];
+        }
+        queue->listeners_count--;
+        return;
+    }
+}
+
+Item * create_item(Queue * queue, char * str, size_t len, unsigned long long hash, Backing * backing) {
+    Item * new_item = (Item *) pool_alloc(&queue->items_pool);
+    new_item->chunks = NULL;
+    new_item->chunks_count = 0;
+    // a big payload is chunked right away, so that it shares memory with the similar ones
+    if(backing && queue->chunk_store && len >= queue->chunk_store->min_len)
+        backing = NULL;
+    if(backing) {
+        new_item->elem = str;
+        use_backing(queue, backing);
+    } else store_payload(queue, new_item, str, len);
+    new_item->backing = backing;
+    new_item->len = len;
+    new_item->type = payload_type(str, len);
+    new_item->hash = hash;
+    new_item->id = queue->next_id++;
+    new_item->source = 0;
+    new_item->hits = 0;
+    new_item->prev = NULL;
+    new_item->next = NULL;
+    return new_item;
+}
+
+int insert_item(Queue * queue, char * str, int flag_reversed) {
+    if(!str) return 0;
+    return insert_item_backed(queue, str, strlen(str), NULL, flag_reversed);
+}
+
+int insert_item_backed(Queue * queue, char * str, size_t len, Backing * backing, int flag_reversed) {
+    Item * item;
+    unsigned long long hash;
+    if(!str || !len) return 0; // string is empty
+    hash = hash_bytes(str, len);
+    // item is already in the queue, so just move it
+    if((item = (Item *) hash_index_find(queue->index, str, len, hash)))
+        return move_item(queue, item, flag_reversed);
+    if(!make_room(queue, len)) return 0;
+    item = create_item(queue, str, len, hash, backing);
+    stamp_item(queue, item, flag_reversed);
+    link_item(queue, item, flag_reversed);
+    hash_index_insert(queue->index, item, len, hash);
+    if(queue->by_content)
+        content_tree_insert(queue->by_content, item);
+    time_tree_insert(queue->by_time, item);
+    prioritize_item(queue, item);
+    queue->size++; // increment the size of the queue
+    queue->bytes += item_charge(item);
+    notify(queue, QUEUE_INSERTED, item);
+    return 1;
+}
+
+int move_item(Queue * queue, Item * item, int flag_reversed) {
+    if(item == queue->start) return 0;
+    time_tree_delete(queue->by_time, item);
+    if(queue->by_priority)
+        priority_tree_delete(queue->by_priority, item);
+    unlink_item(queue, item);
+    if(item->backing)
+        materialize_item(queue, item);
+    stamp_item(queue, item, flag_reversed);
+    link_item(queue, item, flag_reversed);
+    time_tree_insert(queue->by_time, item);
+    item->hits++;
+    prioritize_item(queue, item);
+    notify(queue, QUEUE_MOVED, item);
+    return 1;
+}
+
+int merge_item(Queue * queue, char * str, size_t len, Backing * backing, unsigned long long hash, unsigned long long device, long long seq) {
+    Item * item, * next, * prev;
+    int event = QUEUE_INSERTED;
+    time_t now = time(NULL);
+    if(!str || !len) return 0;
+    // Lamport receive rule: later local captures are stamped after this one
+    if(seq > queue->newest_seq)
+        queue->newest_seq = seq;
+    if((item = (Item *) hash_index_find(queue->index, str, len, hash))) {
+        // the queue already has the same capture, or the content was captured again later
+        if(stamp_newer(item, seq, device) || (item->seq == seq && item->device == device)) return 0;
+        time_tree_delete(queue->by_time, item);
+        if(queue->by_priority)
+            priority_tree_delete(queue->by_priority, item);
+        unlink_item(queue, item);
+        if(item->backing)
+            materialize_item(queue, item);
+        item->hits++;
+        event = QUEUE_MOVED;
+    } else if(!queue->by_priority && queue->size >= queue->capacity) {
+        // a capture older than the whole full queue would be evicted right away
+        if(stamp_newer(queue->end, seq, device)) return 0;
+        delete_item(queue, queue->end);
+    } else if(!make_room(queue, len)) return 0;
+    // find the place: the newer captures stay in front of it(usually there are none)
+    for(next = queue->start; next && stamp_newer(next, seq, device); next = next->next);
+    if(event == QUEUE_INSERTED) {
+        item = create_item(queue, str, len, hash, backing);
+        hash_index_insert(queue->index, item, len, hash);
+        if(queue->by_content)
+            content_tree_insert(queue->by_content, item);
+        queue->size++;
+        queue->bytes += item_charge(item);
+    }
+    item->seq = seq;
+    item->device = device;
+    item->source = 0;
+    // by_time order has to match the queue order, so the item takes the time of its newer neighbour
+    prev = next ? next->prev : queue->end;
+    if(prev)
+        item->time = prev->time;
+    else
+        item->time = (next && next->time > now) ? next->time : now;
+    if(!next && seq < queue->oldest_seq)
+        queue->oldest_seq = seq;
+    link_item_before(queue, item, next);
+    time_tree_insert(queue->by_time, item);
+    prioritize_item(queue, item);
+    notify(queue, event, item);
+    return 1;
+}
+
+Item * restore_item(Queue * queue, Item * from, Backing * backing) {
+    Item * item;
+    size_t charge = from->chunks ? ITEM_BYTES(from->chunks_count * sizeof(Chunk *)) : ITEM_BYTES(from->len);
+    if(queue->size >= queue->capacity || (queue->max_bytes && queue_memory(queue) + charge > queue->max_bytes)) return NULL;
+    item = (Item *) pool_alloc(&queue->items_pool);
+    *item = *from;
+    item->backing = NULL;
+    if(from->chunks) {
+        // the item takes over the references to the chunks
+        item->chunks = (Chunk **) arena_alloc(&queue->strings, from->chunks_count * sizeof(Chunk *));
+        memcpy(item->chunks, from->chunks, from->chunks_count * sizeof(Chunk *));
+        item->elem = NULL;
+    } else if(backing && (!queue->chunk_store || from->len < queue->chunk_store->min_len)) {
+        item->backing = backing;
+        use_backing(queue, backing);
+    } else store_payload(queue, item, from->elem, from->len);
+    item->id = queue->next_id++;
+    item->prev = item->next = NULL;
+    link_item(queue, item, 1);
+    hash_index_insert(queue->index, item, item->len, item->hash);
+    if(queue->by_content)
+        content_tree_insert(queue->by_content, item);
+    time_tree_insert(queue->by_time, item);
+    prioritize_item(queue, item);
+    queue->size++;
+    queue->bytes += item_charge(item);
+    if(item->seq > queue->newest_seq)
+        queue->newest_seq = item->seq;
+    queue->oldest_seq = item->seq;
+    return item;
+}
+
+void delete_item(Queue * queue, Item * item) {
+    if(!item) return;
+    notify(queue, QUEUE_EVICTED, item);
+    hash_index_remove(queue->index, item, item->hash);
+    if(queue->by_content)
+        content_tree_delete(queue->by_content, item);
+    time_tree_delete(queue->by_time, item);
+    if(queue->by_priority)
+        priority_tree_delete(queue->by_priority, item);
+    unlink_item(queue, item);
+    queue->bytes -= item_charge(item);
+    if(item->backing)
+        release_backing(queue, item->backing);
+    else if(item->chunks) {
+        for(int i = 0; i < item->chunks_count; i++)
+            chunk_release(queue->chunk_store, item->chunks[i]);
+        arena_free(&queue->strings, item->chunks);
+    } else
+        arena_free(&queue->strings, item->elem);
+    pool_free(&queue->items_pool, item);
+    queue->size--; // decrement the size of the queue
+}
+
+Item * find_item(Queue * queue, char * str, size_t len) {
+    return (Item *) hash_index_find(queue->index, str, len, hash_bytes(str, len));
+}
+
+Item * find_nth_item(Queue * queue, int n) {
+    // by_time keeps the oldest item first
+    return (Item *) find_nth(queue->by_time, queue->size - 1 - n);
+}
+
+int item_index(Queue * queue, Item * item) {
+    return queue->size - 1 - lower_bound_rank(queue->by_time, item);
+}
+
+int find_items_in_time_range(Queue * queue, time_t from, time_t to, int (*my_callback)(void *, void *), void * arg) {
+    Item from_item, to_item;
+    from_item.time = from;
+    from_item.seq = LLONG_MIN;
+    from_item.device = 0;
+    to_item.time = to;
+    to_item.seq = LLONG_MAX;
+    to_item.device = ULLONG_MAX;
+    return in_range_get(queue->by_time, &from_item, &to_item, my_callback, arg);
+}
+
+int find_items_with_prefix(Queue * queue, char * prefix, size_t len, int (*my_callback)(void *, void *), void * arg) {
+    Item prefix_item, * item;
+    int res;
+    prefix_item.elem = prefix;
+    prefix_item.chunks = NULL;
+    prefix_item.len = len;
+    if(!queue->by_content)
+        build_content_tree(queue);
+    // items with the prefix form a contiguous run starting at the prefix itself
+    for(int i = lower_bound_rank(queue->by_content, &prefix_item); (item = (Item *) find_nth(queue->by_content, i)); i++) {
+        if(item->len < prefix_item.len || compare_range(item, 0, prefix, prefix_item.len)) break;
+        if((res = (*my_callback)(item, arg))) return res;
+    }
+    return 0;
+}
+
+int item_pieces(Item * item) {
+    return item->chunks ? item->chunks_count : 1;
+}
+
+char * item_piece(Item * item, int n, size_t * len) {
+    if(!item->chunks) {
+        *len = item->len;
+        return item->elem;
+    }
+    *len = item->chunks[n]->len;
+    return item->chunks[n]->data;
+}
+
+void item_copy(Item * item, size_t offset, size_t len, char * buf) {
+    size_t piece_len, count;
+    char * piece;
+    for(int i = 0; len && i < item_pieces(item); i++) {
+        piece = item_piece(item, i, &piece_len);
+        if(offset >= piece_len) {
+            offset -= piece_len;
+            continue;
+        }
+        count = piece_len - offset < len ? piece_len - offset : len;
+        memcpy(buf, piece + offset, count);
+        buf += count;
+        len -= count;
+        offset = 0;
+    }
+}
+
+int item_contains(Item * item, const char * str, size_t len) {
+    size_t piece_len, boundary = 0, from, to;
+    char * piece, * window;
+    int found = 0;
+    if(item->len < len) return 0;
+    if(!item->chunks) return memmem(item->elem, item->len, str, len) != NULL;
+    for(int i = 0; i < item->chunks_count; i++) {
+        piece = item_piece(item, i, &piece_len);
+        if(memmem(piece, piece_len, str, len)) return 1;
+    }
+    if(len < 2) return 0;
+    // a match, that crosses a boundary, lies within len - 1 bytes on both sides of it
+    window = (char *) malloc(2 * (len - 1));
+    for(int i = 0; !found && i + 1 < item->chunks_count; i++) {
+        boundary += item->chunks[i]->len;
+        from = boundary > len - 1 ? boundary - (len - 1) : 0;
+        to = boundary + (len - 1) < item->len ? boundary + (len - 1) : item->len;
+        item_copy(item, from, to - from, window);
+        found = memmem(window, to - from, str, len) != NULL;
+    }
+    free(window);
+    return found;
+}
+
+int payload_type(const char * str, size_t len) {
+    const unsigned char * p = (const unsigned char *) str;
+    size_t sniffed = len < ITEM_SNIFF_SIZE ? len : ITEM_SNIFF_SIZE, i = 0;
+    if(len >= 8 && !memcmp(p, "\x89PNG\r\n\x1a\n", 8)) return ITEM_PNG;
+    if(len >= 3 && !memcmp(p, "\xff\xd8\xff", 3)) return ITEM_JPEG;
+    if(len >= 6 && (!memcmp(p, "GIF87a", 6) || !memcmp(p, "GIF89a", 6))) return ITEM_GIF;
+    if(len >= 5 && !memcmp(p, "%PDF-", 5)) return ITEM_PDF;
+    if(len >= 5 && !memcmp(p, "{\\rtf", 5)) return ITEM_RTF;
+    // text may contain tabs, line and page breaks, backspaces and escape sequences, but no other controls
+    for(; i < sniffed; i++)
+        if(p[i] < 0x20 && p[i] != '\t' && p[i] != '\n' && p[i] != '\r' && p[i] != '\f' && p[i] != '\v' && p[i] != '\b' && p[i] != 0x1b)
+            return ITEM_BINARY;
+    // HTML may follow a byte order mark and some blank space
+    for(i = (len >= 3 && !memcmp(p, "\xef\xbb\xbf", 3)) ? 3 : 0; i < sniffed && (p[i] == ' ' || p[i] == '\t' || p[i] == '\n' || p[i] == '\r'); i++);
+    if(sniffed - i >= 5 && (!strncasecmp(str + i, "<html", 5) || (sniffed - i >= 9 && !strncasecmp(str + i, "<!doctype", 9))))
+        return ITEM_HTML;
+    return ITEM_TEXT;
+}
+
+const char * item_mime(Item * item) {
+    static const char * mimes[] = {"text/plain", "text/html", "text/rtf", "image/png", "image/jpeg", "image/gif", "application/pdf", "application/octet-stream"};
+    return mimes[item->type];
+}
+
+void iterate_n_print(Item * items_start) {
+    int counter = 0;
+    Item * tmp = items_start;
+    size_t len;
+    char * piece;
+    while(tmp) {
+        printf("%d:\n", counter);
+        for(int i = 0; i < item_pieces(tmp); i++) {
+            piece = item_piece(tmp, i, &len);
+            fwrite(piece, 1, len, stdout);
+        }
+        putchar('\n');
+        tmp = tmp->next;
+    }
+}
+
+void free_only_queue(Queue * queue) {
+    Backing * backing = queue->backings, * next;
+    while(backing) {
+        next = backing->next;
+        backing->refs = 0;
+        (*backing->release_func)(backing);
+        backing = next;
+    }
+    queue->backings = NULL;
+    pool_destroy(&queue->items_pool);
+    arena_destroy(&queue->strings);
+    hash_index_free(queue->index);
+    free_tree(queue->by_content);
+    free_tree(queue->by_time);
+    free_tree(queue->by_priority);
+    queue->start = queue->end = NULL;
+    queue->index = NULL;
+    queue->by_content = queue->by_time = queue->by_priority = NULL;
+    queue->size = 0;
+    queue->bytes = 0;
+    queue->listeners_count = 0;
+}
+
+static void unlink_item(Queue * queue, Item * item) {
+    // change start and end pointers(if needed)
+    if(queue->start == item)
+        queue->start = item->next;
+    if(queue->end == item)
+        queue->end = item->prev;
+    // change next and prev pointers
+    if(item->prev)
+        item->prev->next = item->next;
+    if(item->next)
+        item->next->prev = item->prev;
+    item->prev = item->next = NULL;
+}
+
+static void link_item(Queue * queue, Item * item, int flag_reversed) {
+    if(!queue->start) {
+        queue->start = item;
+        queue->end = item;
+    } else if(!flag_reversed) {
+        // add to the start of the queue and connect pointers
+        item->next = queue->start;
+        queue->start->prev = item;
+        queue->start = item;
+    } else {
+        // add to the end of the queue and connect pointers
+        item->prev = queue->end;
+        queue->end->next = item;
+        queue->end = item;
+    }
+}
+
+static void link_item_before(Queue * queue, Item * item, Item * next) {
+    if(!next) {
+        link_item(queue, item, 1);
+        return;
+    }
+    item->next = next;
+    item->prev = next->prev;
+    if(next->prev) next->prev->next = item;
+    else queue->start = item;
+    next->prev = item;
+}
+
+static int stamp_newer(Item * item, long long seq, unsigned long long device) {
+    return item->seq > seq || (item->seq == seq && item->device > device);
+}
+
+static void stamp_item(Queue * queue, Item * item, int flag_reversed) {
+    time_t now = time(NULL);
+    if(!flag_reversed) {
+        // never go back in time, even if the clock does, so that by_time order matches queue order
+        item->time = (queue->start && queue->start->time > now) ? queue->start->time : now;
+        item->seq = ++queue->newest_seq;
+    } else {
+        // items appended to the end are older than everything already in the queue
+        item->time = (queue->end && queue->end->time < now) ? queue->end->time : now;
+        item->seq = --queue->oldest_seq;
+    }
+    item->device = queue->device;
+    item->source = queue->source;
+}
+
+static int make_room(Queue * queue, size_t len) {
+    if(!queue->by_priority) {
+        // delete the last item, if it is an overflow of clipboard
+        if(queue->size >= queue->capacity)
+            delete_item(queue, queue->end);
+        return 1;
+    }
+    // a new chunked item may share its chunks, but it is charged as if it didn't
+    if(ITEM_BYTES(len) > queue->max_bytes) return 0;
+    while(queue->size && (queue->size >= queue->capacity || queue_memory(queue) + ITEM_BYTES(len) > queue->max_bytes))
+        evict_lowest(queue);
+    return 1;
+}
+
+static void evict_lowest(Queue * queue) {
+    Item * item = (Item *) find_nth(queue->by_priority, 0);
+    if(item->priority > queue->inflation)
+        queue->inflation = item->priority;
+    delete_item(queue, item);
+}
+
+static void prioritize_item(Queue * queue, Item * item) {
+    if(!queue->by_priority) return;
+    item->priority = queue->inflation + (item->hits + 1) * QUEUE_PRIORITY_UNIT / ITEM_BYTES(item->len);
+    priority_tree_insert(queue->by_priority, item);
+}
+
+static void materialize_item(Queue * queue, Item * item) {
+    Backing * backing = item->backing;
+    queue->bytes -= item_charge(item);
+    store_payload(queue, item, item->elem, item->len);
+    queue->bytes += item_charge(item);
+    release_backing(queue, backing);
+    item->backing = NULL;
+}
+
+static void use_backing(Queue * queue, Backing * backing) {
+    // the queue remembers every backing it uses, so that it can let go of all of them at once
+    if(!backing->refs++) {
+        backing->prev = NULL;
+        backing->next = queue->backings;
+        if(queue->backings) queue->backings->prev = backing;
+        queue->backings = backing;
+    }
+}
+
+static void build_content_tree(Queue * queue) {
+    queue->by_content = create_tree(&compare_content, NULL);
+    for(Item * item = queue->start; item; item = item->next)
+        content_tree_insert(queue->by_content, item);
+}
+
+static void store_payload(Queue * queue, Item * item, char * str, size_t len) {
+    Chunk ** chunks;
+    size_t offset = 0, cut;
+    int count = 0;
+    if(!queue->chunk_store || len < queue->chunk_store->min_len) {
+        item->elem = (char *) arena_alloc(&queue->strings, (len + 1) * sizeof(char));
+        memcpy(item->elem, str, len);
+        item->elem[len] = '\0';
+        return;
+    }
+    // every chunk but the last one has at least CHUNK_MIN_SIZE bytes
+    chunks = (Chunk **) malloc((len / CHUNK_MIN_SIZE + 1) * sizeof(Chunk *));
+    while(offset < len) {
+        cut = chunk_cut(str + offset, len - offset);
+        chunks[count++] = chunk_store_add(queue->chunk_store, str + offset, cut);
+        offset += cut;
+    }
+    item->chunks = (Chunk **) arena_alloc(&queue->strings, count * sizeof(Chunk *));
+    memcpy(item->chunks, chunks, count * sizeof(Chunk *));
+    item->chunks_count = count;
+    item->elem = NULL;
+    free(chunks);
+}
+
+static size_t item_charge(Item * item) {
+    return item->chunks ? ITEM_BYTES(item->chunks_count * sizeof(Chunk *)) : ITEM_BYTES(item->len);
+}
+
+static int compare_range(const Item * item, size_t offset, const char * str, size_t n) {
+    size_t piece_len, count;
+    char * piece;
+    int res;
+    if(!item->chunks) return memcmp(item->elem + offset, str, n);
+    for(int i = 0; n && i < item->chunks_count; i++) {
+        piece = item_piece((Item *) item, i, &piece_len);
+        if(offset >= piece_len) {
+            offset -= piece_len;
+            continue;
+        }
+        count = piece_len - offset < n ? piece_len - offset : n;
+        if((res = memcmp(piece + offset, str, count))) return res;
+        str += count;
+        n -= count;
+        offset = 0;
+    }
+    return 0;
+}
+
+static void release_backing(Queue * queue, Backing * backing) {
+    if(--backing->refs) return;
+    if(backing->prev) backing->prev->next = backing->next;
+    else queue->backings = backing->next;
+    if(backing->next) backing->next->prev = backing->prev;
+    (*backing->release_func)(backing);
+}
+
+static void notify(Queue * queue, int event, Item * item) {
+    for(int i = 0; i < queue->listeners_count; i++)
+        (*queue->listeners[i])(queue->listener_contexts[i], queue, event, item);
+}
+
+static int item_equal(const void * value, const char * str, size_t len) {
+    return !compare_range((const Item *) value, 0, str, len);
+}
+
+static int compare_content(const void * a, const void * b, void * context) {
+    const Item * arg1 = (const Item *) a, * arg2 = (const Item *) b;
+    size_t n = arg1->len < arg2->len ? arg1->len : arg2->len, offset = 0, piece_len;
+    char * piece;
+    int res = 0;
+    if(!arg1->chunks)
+        res = -compare_range(arg2, 0, arg1->elem, n);
+    else {
+        // walk the chunks of the first one against the same range of the second one
+        for(int i = 0; !res && offset < n && i < arg1->chunks_count; i++) {
+            piece = item_piece((Item *) arg1, i, &piece_len);
+            if(piece_len > n - offset) piece_len = n - offset;
+            res = -compare_range(arg2, offset, piece, piece_len);
+            offset += piece_len;
+        }
+    }
+    if(res) return res;
+    return (arg1->len > arg2->len) - (arg1->len < arg2->len);
+}
+
+static int compare_time(const void * a, const void * b, void * context) {
+    const Item * arg1 = (const Item *) a, * arg2 = (const Item *) b;
+    if(arg1->time != arg2->time) return (arg1->time > arg2->time) ? 1 : -1;
+    if(arg1->seq != arg2->seq) return (arg1->seq > arg2->seq) ? 1 : -1;
+    if(arg1->device != arg2->device) return (arg1->device > arg2->device) ? 1 : -1;
+    // every item is a node of its own, even if its stamp isn't unique
+    return (arg1->id > arg2->id) - (arg1->id < arg2->id);
+}
+
+static int compare_priority(const void * a, const void * b, void * context) {
+    const Item * arg1 = (const Item *) a, * arg2 = (const Item *) b;
+    if(arg1->priority != arg2->priority) return (arg1->priority > arg2->priority) ? 1 : -1;
+    return (arg1->id > arg2->id) - (arg1->id < arg2->id);
+}
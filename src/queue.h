@@ -0,0 +1,178 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "hash_index.h"
+#include "avl_tree.h"
+#include "pool.h"
+#include "chunk_store.h"
+
+#ifndef QUEUE_H
+#define QUEUE_H
+
+// maximum number of listeners of one queue
+#define QUEUE_MAX_LISTENERS 8
+
+// queue change events, that are reported to the listeners
+#define QUEUE_INSERTED 1 // new item was linked
+#define QUEUE_MOVED 2 // existing item was moved to the start(or the end)
+#define QUEUE_EVICTED 3 // item is about to be unlinked and freed
+
+// bytes, that one item is charged for besides its elem(the item itself and its index and tree nodes)
+#define QUEUE_ITEM_OVERHEAD 256
+// bytes of an item, that is worth 1.0 of eviction priority per use
+#define QUEUE_PRIORITY_UNIT 4096.0
+
+// payload types(see payload_type), the text ones go first
+#define ITEM_TEXT 0 // text/plain
+#define ITEM_HTML 1 // text/html
+#define ITEM_RTF 2 // text/rtf
+#define ITEM_PNG 3 // image/png
+#define ITEM_JPEG 4 // image/jpeg
+#define ITEM_GIF 5 // image/gif
+#define ITEM_PDF 6 // application/pdf
+#define ITEM_BINARY 7 // application/octet-stream(anything else, that isn't text)
+#define ITEM_IS_TEXT(type) ((type) <= ITEM_RTF)
+// bytes at the start of a payload, that payload_type looks at(so the type costs O(1) however long it is)
+#define ITEM_SNIFF_SIZE 4096
+
+// read-only memory, that items can point into instead of owning a copy(e.g. a mapped history file)
+typedef struct _backing {
+    char * data;
+    size_t size;
+    int refs; // number of items pointing into it
+    void (*release_func)(struct _backing *); // called when the last item lets go of it
+    struct _backing * prev, * next; // backings referenced by the queue
+} Backing;
+
+// clipboard item structure
+/* elem is '\0'-terminated only when the queue owns it(backing == NULL), so always use len; */
+/* a big payload is kept as a list of shared chunks instead(elem is NULL then), so code, */
+/* that reads the payload, goes through item_pieces and item_piece */
+typedef struct _item {
+    char * elem;
+    Backing * backing; // memory, that elem points into(NULL if elem is owned by the queue)
+    Chunk ** chunks; // chunks of the payload in order(NULL if it is in elem)
+    int chunks_count;
+    size_t len; // length of elem(without '\0'), the payload may contain any bytes, '\0' too
+    int type; // ITEM_TEXT, ITEM_PNG, ...(derived from the content, so equal payloads have equal types)
+    unsigned long long hash; // content hash of elem
+    time_t time; // capture time(when it was last moved to the start)
+    long long seq; // Lamport timestamp of the capture, orders captures across devices
+    unsigned long long device; // device, that made the capture(together with seq and hash it is the entry id)
+    int source; // capture source of this device, that copied it last(1, 2, ...; 0: none, e.g. a merged item)
+    unsigned long long id; // stable id of the item(kept while it is moved)
+    unsigned int hits; // times the item was copied again(moved to the start) since it was inserted
+    double priority; // eviction priority(only with a memory budget, see queue_set_budget)
+    struct _item * prev, * next;
+} Item;
+
+struct _queue;
+// queue listener: gets its context, the queue, the event and the item
+typedef void (*QueueListener)(void *, struct _queue *, int, Item *);
+
+// clipboard items queue(most recent item at the start)
+typedef struct _queue {
+    Item * start, * end; // start and end of the items queue
+    int size; // current number of items in the queue
+    int capacity; // maximum number of items in the queue
+    HashIndex * index; // items by content, so that lookups don't walk the queue
+    AvlTree * by_content; // items ordered by content(NULL until the first prefix lookup)
+    AvlTree * by_time; // items ordered by capture time(oldest first)
+    AvlTree * by_priority; // items ordered by eviction priority(NULL without a memory budget)
+    size_t bytes; // memory, that the items take(elem lengths and QUEUE_ITEM_OVERHEAD per item,-
+    // chunk lists instead of the lengths of the chunked items, whose chunks are in chunk_store)
+    size_t max_bytes; // memory budget of the items(0: only the capacity limits the queue)
+    double inflation; // priority of the last evicted item(the GDSF clock)
+    long long newest_seq, oldest_seq; // Lamport clock(newest seq seen anywhere) and seq of the end
+    unsigned long long device; // id of this device, that local captures are stamped with
+    int source; // capture source, that inserted and moved items are stamped with(0 outside of a capture)
+    Pool items_pool; // all items of the queue are allocated from here
+    Arena strings; // and all their elem strings from here
+    ChunkStore * chunk_store; // where big payloads are chunked(NULL: every payload is kept whole)
+    unsigned long long next_id; // id of the next created item
+    QueueListener listeners[QUEUE_MAX_LISTENERS];
+    void * listener_contexts[QUEUE_MAX_LISTENERS];
+    int listeners_count;
+    Backing * backings; // backings, that items of the queue point into
+} Queue;
+
+// initialize an empty queue of the given capacity
+void queue_init(Queue *, int);
+// give the queue a memory budget(call it while the queue is empty, 0 keeps only the capacity)
+/* with a budget the item with the lowest priority is evicted instead of the end of the queue: */
+/* GDSF priority = (hits + 1) * QUEUE_PRIORITY_UNIT / bytes of the item + priority of the last evicted one, */
+/* so one huge paste goes before many small items, that are copied again and again, and items, */
+/* that nobody touches, age out as the evicted priorities grow(the room is made before the new */
+/* item is linked, so a capture is never its own victim); items larger than the budget are not inserted */
+void queue_set_budget(Queue *, size_t);
+// chunk the payloads of new items in the store(call it while the queue is empty)
+/* payloads at least store->min_len long become chunk lists, so near-identical big pastes */
+/* share most of their memory; the store outlives the queue(free it after free_only_queue) */
+void queue_set_chunk_store(Queue *, ChunkStore *);
+// memory, that the items and their chunks take
+size_t queue_memory(Queue *);
+// add a listener, that gets told about every change of the queue(return 0 if there is no room)
+int queue_add_listener(Queue *, QueueListener, void *);
+// remove the listener with this context
+void queue_remove_listener(Queue *, QueueListener, void *);
+// create Item structure element(from the pool and the arena of the queue)
+/* if backing is given, elem points right into it and nothing is copied(unless the payload is chunked) */
+Item * create_item(Queue *, char *, size_t, unsigned long long, Backing *);
+// insert the '\0'-terminated string into the queue(at the start, or at the end if flag_reversed is set)
+/* if such a string is already in the queue, it is moved instead */
+/* return 1 if the queue was changed and 0 otherwise(also if the string exceeds the memory budget) */
+int insert_item(Queue *, char *, int);
+// the same for len bytes of str(any bytes), that lie in the backing(or are copied, if backing is NULL)
+/* a backed item gets its own copy once it is moved, so that old backings can go away */
+int insert_item_backed(Queue *, char *, size_t, Backing *, int);
+// merge a capture of another device: insert(or move) the string to its place in the queue
+/* the queue is kept ordered by (seq, device), newest first, so concurrent captures of */
+/* two devices end up in the same order on both; the Lamport clock is moved past seq */
+/* arguments: queue, str, len, backing(or NULL), hash of str, device and seq of the capture */
+/* return 1 if the queue was changed and 0 if it already has the string with a newer stamp */
+int merge_item(Queue *, char *, size_t, Backing *, unsigned long long, unsigned long long, long long);
+// append an item, that was saved before(e.g. in a snapshot), to the end of the queue
+/* the caller fills the template: elem(or chunks, whose references the item takes over), len, type, */
+/* hash, device, seq, source, time and hits; nothing of the payload is read, so restoring costs the same */
+/* however big the payloads are; elem stays in the backing(unless it is big enough to be chunked) */
+/* the listeners are not told(the queue is being loaded) */
+/* return the item or NULL if the queue(or its memory budget) is full */
+Item * restore_item(Queue *, Item *, Backing *);
+// move the item to the start(or to the end, if flag_reversed is set), as if it was inserted again
+/* return 1 if the queue was changed and 0 otherwise */
+int move_item(Queue *, Item *, int);
+// unlink the item from the queue and free it
+void delete_item(Queue *, Item *);
+// find the item with len bytes of str in the queue
+Item * find_item(Queue *, char *, size_t);
+// find the n-th most recent item(0 is the start of the queue)
+Item * find_nth_item(Queue *, int);
+// get the position of the item in the queue(0 is the start), the inverse of find_nth_item
+int item_index(Queue *, Item *);
+// call my_callback on items captured within [from, to], oldest first
+/* stops early when the callback returns non-zero value and returns that value */
+int find_items_in_time_range(Queue *, time_t, time_t, int (*my_callback)(void *, void *), void *);
+// call my_callback on items starting with len bytes of the prefix, in content order
+/* stops early when the callback returns non-zero value and returns that value */
+int find_items_with_prefix(Queue *, char *, size_t, int (*my_callback)(void *, void *), void *);
+// number of contiguous pieces of the payload of the item(its chunks, or just elem)
+int item_pieces(Item *);
+// n-th piece of the payload, its length is stored
+char * item_piece(Item *, int, size_t *);
+// copy len bytes of the payload from the offset into the buffer
+void item_copy(Item *, size_t, size_t, char *);
+// the payload contains len bytes of str(also across the chunk boundaries)
+int item_contains(Item *, const char *, size_t);
+// type of len bytes of the payload(ITEM_TEXT, ITEM_PNG, ...)
+/* the magic numbers of the known formats, then text is told from binary data by the first */
+/* ITEM_SNIFF_SIZE bytes: '\0' or control characters, that text never has, make it ITEM_BINARY */
+int payload_type(const char *, size_t);
+// MIME type of the payload of the item
+const char * item_mime(Item *);
+// simply iterate through list and print items
+void iterate_n_print(Item *);
+// free all the items and the indexes of the queue(in O(slabs), not O(items))
+void free_only_queue(Queue *);
+
+#endif
@@ -0,0 +1,203 @@
+#define _GNU_SOURCE // pidfd_open through syscall()
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <spawn.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <time.h>
+#include "reactor.h"
+
+extern char ** environ;
+
+// the child exited(its pidfd became readable)
+static void child_exited(Reactor *, void *, uint32_t);
+// the child's timeout expired
+static void child_timed_out(Reactor *, void *, uint32_t);
+
+uint64_t reactor_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+int reactor_init(Reactor * reactor) {
+    reactor->flag_running = 0;
+    return (reactor->epoll_fd = epoll_create1(EPOLL_CLOEXEC)) >= 0;
+}
+
+int reactor_add(Reactor * reactor, ReactorSource * source, int fd, uint32_t events, ReactorHandler handler, void * context) {
+    struct epoll_event event;
+    source->fd = -1;
+    if(fd < 0) return 0;
+    event.events = events;
+    event.data.ptr = source;
+    if(epoll_ctl(reactor->epoll_fd, EPOLL_CTL_ADD, fd, &event)) {
+        close(fd);
+        return 0;
+    }
+    source->fd = fd;
+    source->handler = handler;
+    source->context = context;
+    return 1;
+}
+
+int reactor_modify(Reactor * reactor, ReactorSource * source, uint32_t events) {
+    struct epoll_event event;
+    if(source->fd < 0) return 0;
+    event.events = events;
+    event.data.ptr = source;
+    return !epoll_ctl(reactor->epoll_fd, EPOLL_CTL_MOD, source->fd, &event);
+}
+
+void reactor_remove(Reactor * reactor, ReactorSource * source) {
+    if(source->fd < 0) return;
+    epoll_ctl(reactor->epoll_fd, EPOLL_CTL_DEL, source->fd, NULL);
+    close(source->fd);
+    source->fd = -1;
+}
+
+int reactor_run(Reactor * reactor) {
+    struct epoll_event events[REACTOR_MAX_EVENTS];
+    ReactorSource * source;
+    int count;
+    reactor->flag_running = 1;
+    while(reactor->flag_running) {
+        if((count = epoll_wait(reactor->epoll_fd, events, REACTOR_MAX_EVENTS, -1)) < 0) {
+            if(errno == EINTR) continue;
+            return 0;
+        }
+        for(int i = 0; i < count && reactor->flag_running; i++) {
+            source = (ReactorSource *) events[i].data.ptr;
+            // an earlier handler of this batch may have removed the source
+            if(source->fd >= 0)
+                (*source->handler)(reactor, source->context, events[i].events);
+        }
+    }
+    return 1;
+}
+
+void reactor_stop(Reactor * reactor) {
+    reactor->flag_running = 0;
+}
+
+void reactor_free(Reactor * reactor) {
+    if(reactor->epoll_fd >= 0)
+        close(reactor->epoll_fd);
+    reactor->epoll_fd = -1;
+}
+
+int reactor_timer_fd(long first_ms, long interval_ms) {
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if(fd < 0) return -1;
+    // zero would disarm the timer
+    if(!reactor_timer_set(fd, first_ms < 1 ? 1 : first_ms, interval_ms)) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int reactor_timer_set(int fd, long first_ms, long interval_ms) {
+    struct itimerspec spec;
+    spec.it_value.tv_sec = first_ms / 1000;
+    spec.it_value.tv_nsec = first_ms % 1000 * 1000000;
+    spec.it_interval.tv_sec = interval_ms / 1000;
+    spec.it_interval.tv_nsec = interval_ms % 1000 * 1000000;
+    return !timerfd_settime(fd, 0, &spec, NULL);
+}
+
+uint64_t reactor_timer_read(int fd) {
+    uint64_t expirations;
+    if(read(fd, &expirations, sizeof(expirations)) != sizeof(expirations)) return 0;
+    return expirations;
+}
+
+int reactor_signal_fd(sigset_t * signals_set) {
+    if(sigprocmask(SIG_BLOCK, signals_set, NULL)) return -1;
+    return signalfd(-1, signals_set, SFD_NONBLOCK | SFD_CLOEXEC);
+}
+
+void reactor_child_init(ReactorChild * child) {
+    child->process.fd = child->timeout.fd = -1;
+    child->pid = 0;
+    child->status = 0;
+    child->flag_timed_out = 0;
+}
+
+int reactor_spawn(Reactor * reactor, ReactorChild * child, char ** argv, long timeout_ms, ReactorChildHandler done, void * context) {
+    pid_t pid;
+    sigset_t signals_set;
+    posix_spawnattr_t attr;
+    int res;
+    uint64_t started = reactor_now(); // the spawn itself counts too
+    // the child gets an empty signal mask(the reactor blocks the signals it reads through signalfd)-
+    // and its own process group
+    sigemptyset(&signals_set);
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setsigmask(&attr, &signals_set);
+    posix_spawnattr_setpgroup(&attr, 0);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETPGROUP);
+    res = posix_spawn(&pid, argv[0], NULL, &attr, argv, environ);
+    posix_spawnattr_destroy(&attr);
+    if(res) return 0;
+    if(reactor_watch(reactor, child, pid, timeout_ms, done, context)) {
+        child->started = started;
+        return 1;
+    }
+    kill(-pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+    return 0;
+}
+
+int reactor_watch(Reactor * reactor, ReactorChild * child, pid_t pid, long timeout_ms, ReactorChildHandler done, void * context) {
+    child->pid = pid;
+    child->started = reactor_now();
+    child->status = 0;
+    child->flag_timed_out = 0;
+    child->done = done;
+    child->context = context;
+    child->timeout.fd = -1;
+    if(!reactor_add(reactor, &child->process, (int) syscall(SYS_pidfd_open, pid, 0), EPOLLIN, &child_exited, child))
+        return 0;
+    if(timeout_ms > 0 && !reactor_add(reactor, &child->timeout, reactor_timer_fd(timeout_ms, 0), EPOLLIN, &child_timed_out, child)) {
+        reactor_remove(reactor, &child->process);
+        return 0;
+    }
+    return 1;
+}
+
+int reactor_child_ok(ReactorChild * child) {
+    return !child->flag_timed_out && WIFEXITED(child->status) && !WEXITSTATUS(child->status);
+}
+
+void reactor_child_kill(Reactor * reactor, ReactorChild * child) {
+    if(!child->pid) return;
+    kill(-child->pid, SIGKILL);
+    waitpid(child->pid, &child->status, 0);
+    reactor_remove(reactor, &child->process);
+    reactor_remove(reactor, &child->timeout);
+    child->pid = 0;
+}
+
+static void child_exited(Reactor * reactor, void * context, uint32_t events) {
+    ReactorChild * child = (ReactorChild *) context;
+    // the pidfd is readable only after the exit, so this doesn't block
+    if(waitpid(child->pid, &child->status, WNOHANG) != child->pid) return;
+    reactor_remove(reactor, &child->process);
+    reactor_remove(reactor, &child->timeout);
+    child->pid = 0;
+    (*child->done)(reactor, child, child->context);
+}
+
+static void child_timed_out(Reactor * reactor, void * context, uint32_t events) {
+    ReactorChild * child = (ReactorChild *) context;
+    if(!reactor_timer_read(child->timeout.fd)) return;
+    // the pidfd reports the exit as usual, flag_timed_out tells why
+    child->flag_timed_out = 1;
+    kill(-child->pid, SIGKILL);
+    reactor_remove(reactor, &child->timeout);
+}
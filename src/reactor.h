@@ -0,0 +1,90 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <signal.h>
+#include <sys/types.h>
+
+#ifndef REACTOR_H
+#define REACTOR_H
+
+// maximum number of events handled per epoll_wait call
+#define REACTOR_MAX_EVENTS 16
+
+struct _reactor;
+
+// handler of a ready file descriptor(gets the reactor, the context and the epoll events)
+typedef void (*ReactorHandler)(struct _reactor *, void *, uint32_t);
+
+// file descriptor watched by the reactor
+/* sources are owned by the caller and must stay valid while registered */
+typedef struct _reactor_source {
+    int fd; // -1 if the source is not registered
+    ReactorHandler handler;
+    void * context;
+} ReactorSource;
+
+// epoll based event loop
+/* everything the daemon waits for(timers, signals, child processes, pipes) */
+/* is a file descriptor, so the daemon sleeps in epoll_wait between events */
+typedef struct _reactor {
+    int epoll_fd;
+    int flag_running;
+} Reactor;
+
+struct _reactor_child;
+// called once the child exited(or was killed after its timeout)
+typedef void (*ReactorChildHandler)(Reactor *, struct _reactor_child *, void *);
+
+// child process watched through its pidfd, with an optional timeout
+/* the child leads its own process group, so the timeout kills its children too */
+typedef struct _reactor_child {
+    ReactorSource process; // pidfd of the child
+    ReactorSource timeout; // timerfd of the timeout(fd is -1 if there is none)
+    pid_t pid; // 0 if no child is running
+    int status; // waitpid status, after the child exited
+    int flag_timed_out;
+    uint64_t started; // reactor_now() when the child started
+    ReactorChildHandler done;
+    void * context;
+} ReactorChild;
+
+// get CLOCK_MONOTONIC time in nanoseconds
+uint64_t reactor_now(void);
+// create the epoll instance(return 1 on success and 0 otherwise)
+int reactor_init(Reactor *);
+// register the file descriptor(the reactor owns it from now on)
+/* return 1 on success and 0 otherwise(the descriptor is closed then) */
+int reactor_add(Reactor *, ReactorSource *, int, uint32_t, ReactorHandler, void *);
+// change the epoll events of the registered source(return 1 on success and 0 otherwise)
+int reactor_modify(Reactor *, ReactorSource *, uint32_t);
+// unregister the source and close its file descriptor(nothing happens if it is not registered)
+void reactor_remove(Reactor *, ReactorSource *);
+// dispatch events until reactor_stop is called(return 0 if epoll_wait failed)
+int reactor_run(Reactor *);
+// make reactor_run return after the current events
+void reactor_stop(Reactor *);
+// close the epoll instance(sources should be removed before)
+void reactor_free(Reactor *);
+// create a non-blocking timerfd, that first expires after the given milliseconds-
+// and then every interval milliseconds(0: only once), -1 on error
+int reactor_timer_fd(long, long);
+// re-arm the timerfd(0 first milliseconds disarm it), return 1 on success
+int reactor_timer_set(int, long, long);
+// consume the expirations of a timerfd(return their number, 0 if there were none)
+uint64_t reactor_timer_read(int);
+// block the signals and create a non-blocking signalfd for them(-1 on error)
+int reactor_signal_fd(sigset_t *);
+// initialize the child handle(nothing is started)
+void reactor_child_init(ReactorChild *);
+// start argv[0] with argv in its own process group and watch it
+/* the timeout is in milliseconds(0: no timeout) */
+/* return 1 on success and 0 if the child couldn't be started */
+int reactor_spawn(Reactor *, ReactorChild *, char **, long, ReactorChildHandler, void *);
+// watch an already started child, that leads its own process group
+int reactor_watch(Reactor *, ReactorChild *, pid_t, long, ReactorChildHandler, void *);
+// check if the child exited successfully
+int reactor_child_ok(ReactorChild *);
+// kill the child's process group(if running) and reap it without calling done
+void reactor_child_kill(Reactor *, ReactorChild *);
+
+#endif
@@ -0,0 +1,60 @@
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include "ring.h"
+
+int ring_init(Ring * ring, size_t capacity) {
+    size_t size = 2;
+    while(size < capacity)
+        size *= 2;
+    if(!(ring->slots = (void **) malloc(size * sizeof(void *)))) return 0;
+    if((ring->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+        free(ring->slots);
+        return 0;
+    }
+    ring->mask = size - 1;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->full, 0);
+    atomic_init(&ring->max_depth, 0);
+    return 1;
+}
+
+int ring_push(Ring * ring, void * entry) {
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    size_t depth = tail - atomic_load_explicit(&ring->head, memory_order_acquire);
+    uint64_t one = 1;
+    if(depth > ring->mask) {
+        atomic_fetch_add_explicit(&ring->full, 1, memory_order_relaxed);
+        return 0;
+    }
+    ring->slots[tail & ring->mask] = entry;
+    // the slot is written before the consumer can see the new tail
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+    if(depth + 1 > atomic_load_explicit(&ring->max_depth, memory_order_relaxed))
+        atomic_store_explicit(&ring->max_depth, depth + 1, memory_order_relaxed);
+    if(write(ring->event_fd, &one, sizeof(one)) < 0) {} // only fails if the counter is saturated, which still wakes up
+    return 1;
+}
+
+void * ring_pop(Ring * ring) {
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    void * entry;
+    if(head == atomic_load_explicit(&ring->tail, memory_order_acquire)) return NULL;
+    entry = ring->slots[head & ring->mask];
+    // the slot is read before the producer can reuse it
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    return entry;
+}
+
+void ring_clear_event(Ring * ring) {
+    uint64_t count;
+    if(read(ring->event_fd, &count, sizeof(count)) < 0) {} // EAGAIN: nothing to clear
+}
+
+void ring_free(Ring * ring) {
+    free(ring->slots);
+    ring->slots = NULL;
+    if(ring->event_fd >= 0)
+        close(ring->event_fd);
+    ring->event_fd = -1;
+}
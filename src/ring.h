@@ -0,0 +1,37 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#ifndef RING_H
+#define RING_H
+
+// size of a cache line(head and tail are kept on different lines)
+#define RING_CACHE_LINE 64
+
+// bounded lock-free single-producer/single-consumer ring of pointers
+/* the producer hands over whatever the pointer owns, the consumer takes it over, */
+/* so nothing is copied; every push also bumps the eventfd, so the consumer can */
+/* sleep in epoll(or read) instead of spinning */
+typedef struct _ring {
+    void ** slots;
+    size_t mask; // capacity - 1(capacity is a power of 2)
+    int event_fd; // readable while pushes are not consumed yet
+    _Alignas(RING_CACHE_LINE) atomic_size_t head; // next slot to pop(written by the consumer)
+    _Alignas(RING_CACHE_LINE) atomic_size_t tail; // next slot to push(written by the producer)
+    atomic_uint_least64_t full; // pushes refused, because the ring was full(backpressure)
+    atomic_size_t max_depth; // most entries, that were waiting at once
+} Ring;
+
+// initialize the ring with room for at least the given number of entries(return 1 on success)
+int ring_init(Ring *, size_t);
+// push the entry(producer only), return 0 if the ring is full
+int ring_push(Ring *, void *);
+// pop the oldest entry(consumer only), NULL if the ring is empty
+void * ring_pop(Ring *);
+// consume the wakeups of the eventfd(consumer only, call before popping everything)
+void ring_clear_event(Ring *);
+// free the slots and close the eventfd(entries left in the ring are not freed)
+void ring_free(Ring *);
+
+#endif
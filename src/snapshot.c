@@ -0,0 +1,284 @@
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "snapshot.h"
+
+// round the offset up to SNAPSHOT_ALIGN
+#define ALIGN(offset) (((offset) + SNAPSHOT_ALIGN - 1) & ~(uint64_t) (SNAPSHOT_ALIGN - 1))
+
+// distinct chunks of the items, sorted by address(return their number, the array is stored)
+static size_t collect_chunks(Queue *, Chunk ***);
+// number of the chunk in the sorted array
+static uint32_t chunk_number(Chunk **, size_t, Chunk *);
+// the header and the tables of the mapped file are whole and every blob lies inside the file
+static int check_snapshot(char *, size_t);
+// write zeros up to the aligned offset(return 1 on success and 0 otherwise)
+static int pad(FILE *, uint64_t *);
+// unmap the snapshot(release function of its backing)
+static void unmap_snapshot(Backing *);
+// compare function for qsort and bsearch
+static int compare_pointers(const void *, const void *);
+
+long write_snapshot(Queue * queue, char * file_name) {
+    char * tmp_file = (char *) malloc(strlen(file_name) + strlen(".tmp") + 1);
+    SnapshotHeader header;
+    SnapshotEntry * entries;
+    SnapshotChunk * chunk_table;
+    Chunk ** chunks;
+    size_t chunks_count = collect_chunks(queue, &chunks), tables_len, len;
+    uint64_t offset;
+    uint32_t number;
+    char * tables, * piece;
+    FILE * fp;
+    int i, res = 1;
+    Item * item;
+    // the entry table is followed by the chunk table, so one hash covers both
+    tables_len = queue->size * sizeof(SnapshotEntry) + chunks_count * sizeof(SnapshotChunk);
+    tables = (char *) calloc(1, tables_len ? tables_len : 1);
+    entries = (SnapshotEntry *) tables;
+    chunk_table = (SnapshotChunk *) (tables + queue->size * sizeof(SnapshotEntry));
+    offset = ALIGN(sizeof(header) + tables_len);
+    for(i = 0, item = queue->start; item; item = item->next, i++) {
+        entries[i].offset = offset;
+        entries[i].len = item->len;
+        entries[i].hash = item->hash;
+        entries[i].device = item->device;
+        entries[i].seq = item->seq;
+        entries[i].time = item->time;
+        entries[i].hits = item->hits;
+        entries[i].type = item->type;
+        entries[i].source = item->source;
+        entries[i].chunks_count = item->chunks ? item->chunks_count : 0;
+        offset = ALIGN(offset + (item->chunks ? item->chunks_count * sizeof(uint32_t) : item->len));
+    }
+    for(size_t j = 0; j < chunks_count; j++) {
+        chunk_table[j].offset = offset;
+        chunk_table[j].len = chunks[j]->len;
+        chunk_table[j].hash = chunks[j]->hash;
+        chunk_table[j].hash2 = chunks[j]->hash2;
+        chunk_table[j].flags = chunks[j]->flag_saved ? SNAPSHOT_CHUNK_SAVED : 0;
+        offset = ALIGN(offset + chunks[j]->len);
+    }
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.count = queue->size;
+    header.chunks_count = chunks_count;
+    header.size = offset;
+    header.tables_hash = hash_bytes(tables, tables_len);
+    header.newest_seq = queue->newest_seq;
+
+    strcpy(tmp_file, file_name);
+    strcat(tmp_file, ".tmp");
+    if(!(fp = fopen(tmp_file, "wb"))) res = 0;
+    else {
+        offset = sizeof(header) + tables_len;
+        res = fwrite(&header, sizeof(header), 1, fp) == 1 && fwrite(tables, 1, tables_len, fp) == tables_len && pad(fp, &offset);
+        // the blobs in the order of the tables
+        for(item = queue->start; res && item; item = item->next) {
+            if(item->chunks) {
+                for(i = 0; res && i < item->chunks_count; i++) {
+                    number = chunk_number(chunks, chunks_count, item->chunks[i]);
+                    res = fwrite(&number, sizeof(number), 1, fp) == 1;
+                }
+                offset += item->chunks_count * sizeof(uint32_t);
+            } else {
+                piece = item_piece(item, 0, &len);
+                res = fwrite(piece, 1, len, fp) == len;
+                offset += len;
+            }
+            res = res && pad(fp, &offset);
+        }
+        for(size_t j = 0; res && j < chunks_count; j++) {
+            res = fwrite(chunks[j]->data, 1, chunks[j]->len, fp) == chunks[j]->len;
+            offset += chunks[j]->len;
+            res = res && pad(fp, &offset);
+        }
+        if(fflush(fp) || fdatasync(fileno(fp))) res = 0;
+        if(fclose(fp) || !res || rename(tmp_file, file_name)) {
+            unlink(tmp_file);
+            res = 0;
+        }
+    }
+    free(tmp_file);
+    free(tables);
+    free(chunks);
+    return res ? (long) header.size : -1;
+}
+
+int load_snapshot(Queue * queue, char * file_name) {
+    struct stat st;
+    SnapshotHeader * header;
+    SnapshotEntry * entry;
+    SnapshotChunk * chunk_table, * chunk;
+    Backing * backing;
+    Chunk ** chunks = NULL;
+    Item from;
+    char * data, * chunk_data = NULL, * payload;
+    uint32_t * numbers;
+    size_t len;
+    int fd = open(file_name, O_RDONLY), restored = 0, flag_loaded;
+    if(fd < 0) return -1;
+    if(fstat(fd, &st) || (size_t) st.st_size < sizeof(SnapshotHeader) ||
+        (data = (char *) mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+    {
+        close(fd);
+        unlink(file_name);
+        return -1;
+    }
+    if(!check_snapshot(data, st.st_size)) {
+        munmap(data, st.st_size);
+        close(fd);
+        unlink(file_name);
+        return -1;
+    }
+    header = (SnapshotHeader *) data;
+    entry = (SnapshotEntry *) (data + sizeof(SnapshotHeader));
+    chunk_table = (SnapshotChunk *) (data + sizeof(SnapshotHeader) + header->count * sizeof(SnapshotEntry));
+    backing = (Backing *) malloc(sizeof(Backing));
+    backing->data = data;
+    backing->size = st.st_size;
+    backing->refs = 0;
+    backing->release_func = &unmap_snapshot;
+    backing->prev = backing->next = NULL;
+    // the chunk store keeps its own mapping, so the chunks don't depend on the items, that point into this one
+    if(header->chunks_count && queue->chunk_store &&
+        (chunk_data = (char *) mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+    {
+        chunk_data = NULL;
+    }
+    close(fd);
+    for(uint32_t i = 0; i < header->count; i++, entry++) {
+        memset(&from, 0, sizeof(from));
+        from.elem = data + entry->offset;
+        from.len = entry->len;
+        from.type = entry->type;
+        from.hash = entry->hash;
+        from.device = entry->device;
+        from.seq = entry->seq;
+        from.time = (time_t) entry->time;
+        from.hits = entry->hits;
+        from.source = (int) entry->source;
+        payload = NULL;
+        flag_loaded = 1;
+        if(entry->chunks_count) {
+            numbers = (uint32_t *) (data + entry->offset);
+            if(chunk_data) {
+                chunks = (Chunk **) realloc(chunks, entry->chunks_count * sizeof(Chunk *));
+                for(uint32_t j = 0; j < entry->chunks_count; j++) {
+                    chunk = &chunk_table[numbers[j]];
+                    chunks[j] = chunk_store_add_mapped(queue->chunk_store, chunk_data + chunk->offset, chunk->len,
+                        chunk->hash, chunk->hash2, (chunk->flags & SNAPSHOT_CHUNK_SAVED) != 0);
+                }
+                from.chunks = chunks;
+                from.chunks_count = entry->chunks_count;
+                from.elem = NULL;
+            } else if(queue->chunk_store) flag_loaded = 0; // the chunks couldn't be mapped
+            else {
+                // the queue keeps every payload whole now, so the chunks are put together
+                from.elem = payload = (char *) malloc(entry->len);
+                len = 0;
+                for(uint32_t j = 0; j < entry->chunks_count; j++) {
+                    chunk = &chunk_table[numbers[j]];
+                    memcpy(payload + len, data + chunk->offset, chunk->len);
+                    len += chunk->len;
+                }
+            }
+        }
+        if(flag_loaded && !restore_item(queue, &from, from.chunks || payload ? NULL : backing)) {
+            // the queue is full, so the older entries wouldn't fit either
+            for(int j = 0; j < from.chunks_count; j++)
+                chunk_release(queue->chunk_store, from.chunks[j]);
+            free(payload);
+            break;
+        }
+        restored += flag_loaded;
+        free(payload);
+    }
+    free(chunks);
+    if(chunk_data)
+        chunk_store_keep_mapping(queue->chunk_store, chunk_data, st.st_size);
+    if(header->newest_seq > queue->newest_seq)
+        queue->newest_seq = header->newest_seq;
+    // nothing points into the mapping
+    if(!backing->refs)
+        unmap_snapshot(backing);
+    // the history goes on without the snapshot, so it must not be loaded again
+    unlink(file_name);
+    return restored;
+}
+
+static size_t collect_chunks(Queue * queue, Chunk *** chunks) {
+    size_t count = 0, distinct = 0;
+    for(Item * item = queue->start; item; item = item->next)
+        count += item->chunks ? item->chunks_count : 0;
+    *chunks = (Chunk **) malloc((count ? count : 1) * sizeof(Chunk *));
+    count = 0;
+    for(Item * item = queue->start; item; item = item->next)
+        for(int i = 0; item->chunks && i < item->chunks_count; i++)
+            (*chunks)[count++] = item->chunks[i];
+    qsort(*chunks, count, sizeof(Chunk *), &compare_pointers);
+    for(size_t i = 0; i < count; i++)
+        if(!distinct || (*chunks)[distinct - 1] != (*chunks)[i])
+            (*chunks)[distinct++] = (*chunks)[i];
+    return distinct;
+}
+
+static uint32_t chunk_number(Chunk ** chunks, size_t count, Chunk * chunk) {
+    return (uint32_t) ((Chunk **) bsearch(&chunk, chunks, count, sizeof(Chunk *), &compare_pointers) - chunks);
+}
+
+static int check_snapshot(char * data, size_t size) {
+    SnapshotHeader * header = (SnapshotHeader *) data;
+    SnapshotEntry * entries = (SnapshotEntry *) (data + sizeof(SnapshotHeader));
+    SnapshotChunk * chunks;
+    uint32_t * numbers;
+    uint64_t tables_len, len;
+    if(memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) || header->version != SNAPSHOT_VERSION || header->size != size ||
+        header->chunks_count > size / sizeof(SnapshotChunk))
+    {
+        return 0;
+    }
+    tables_len = header->count * sizeof(SnapshotEntry) + header->chunks_count * sizeof(SnapshotChunk);
+    if(sizeof(SnapshotHeader) + tables_len > size || hash_bytes((char *) entries, tables_len) != header->tables_hash) return 0;
+    chunks = (SnapshotChunk *) (data + sizeof(SnapshotHeader) + header->count * sizeof(SnapshotEntry));
+    for(uint64_t i = 0; i < header->chunks_count; i++)
+        if(chunks[i].offset > size || chunks[i].len > size - chunks[i].offset) return 0;
+    for(uint32_t i = 0; i < header->count; i++) {
+        len = entries[i].chunks_count ? entries[i].chunks_count * sizeof(uint32_t) : entries[i].len;
+        if(!entries[i].len || entries[i].type > ITEM_BINARY || entries[i].offset % SNAPSHOT_ALIGN ||
+            entries[i].offset > size || len > size - entries[i].offset)
+        {
+            return 0;
+        }
+        if(!entries[i].chunks_count) continue;
+        // the chunks have to add up to the payload
+        numbers = (uint32_t *) (data + entries[i].offset);
+        len = 0;
+        for(uint32_t j = 0; j < entries[i].chunks_count; j++) {
+            if(numbers[j] >= header->chunks_count) return 0;
+            len += chunks[numbers[j]].len;
+        }
+        if(len != entries[i].len) return 0;
+    }
+    return 1;
+}
+
+static int pad(FILE * fp, uint64_t * offset) {
+    static const char zeros[SNAPSHOT_ALIGN] = {0};
+    size_t count = ALIGN(*offset) - *offset;
+    *offset += count;
+    return fwrite(zeros, 1, count, fp) == count;
+}
+
+static void unmap_snapshot(Backing * backing) {
+    munmap(backing->data, backing->size);
+    free(backing);
+}
+
+static int compare_pointers(const void * a, const void * b) {
+    const Chunk * arg1 = *(Chunk * const *) a, * arg2 = *(Chunk * const *) b;
+    return (arg1 > arg2) - (arg1 < arg2);
+}
@@ -0,0 +1,69 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "queue.h"
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+// first bytes of a snapshot file
+#define SNAPSHOT_MAGIC "CLIPSNAP"
+// version of the format(a snapshot of another version is ignored)
+#define SNAPSHOT_VERSION 1
+// alignment of the tables and of every blob in the file
+#define SNAPSHOT_ALIGN 8
+// chunk flag: the chunk file was written(see Chunk)
+#define SNAPSHOT_CHUNK_SAVED 1
+
+// snapshot file header(all numbers in host byte order, the file never leaves the device)
+typedef struct _snapshot_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t count; // entries
+    uint64_t chunks_count; // distinct chunks of the chunked entries
+    uint64_t size; // size of the whole file(a shorter file is torn)
+    uint64_t tables_hash; // content hash of the entry and the chunk tables
+    int64_t newest_seq; // Lamport clock of the queue
+} SnapshotHeader;
+
+// one entry of the offset table(newest first, in the queue order)
+typedef struct _snapshot_entry {
+    uint64_t offset; // blob of the payload(or of the uint32_t numbers of its chunks)
+    uint64_t len; // length of the payload
+    uint64_t hash; // content hash of the payload
+    uint64_t device;
+    int64_t seq;
+    int64_t time;
+    uint32_t hits;
+    uint32_t type;
+    uint32_t chunks_count; // 0 if the payload is in the blob itself
+    uint32_t source; // capture source(0 in the snapshots written before sources were kept)
+} SnapshotEntry;
+
+// one chunk of the chunk table
+typedef struct _snapshot_chunk {
+    uint64_t offset; // blob of the chunk data
+    uint64_t len;
+    uint64_t hash, hash2; // name of the chunk
+    uint64_t flags; // SNAPSHOT_CHUNK_SAVED
+} SnapshotChunk;
+
+// binary snapshot of the queue, that the next start maps instead of parsing the text history
+/* layout: SnapshotHeader, SnapshotEntry table, SnapshotChunk table, then the blobs, every one */
+/* SNAPSHOT_ALIGN-aligned; a chunk shared by many entries is stored once */
+/* loading reads only the header and the tables: items point right into the mapping(chunks */
+/* too), so nothing of the payloads is read until an entry is touched, and a start costs */
+/* O(entries + chunks), however many bytes the history has; a moved item gets its own copy */
+/* as a backed one always does(see insert_item_backed) */
+/* the text history stays the format, that is synced and read by humans: the snapshot is */
+/* written on a clean exit and removed once it is loaded, so it never outlives a crash */
+
+// write the queue into the snapshot file(aside and renamed, like the history file)
+/* return the number of bytes written and -1 on error */
+long write_snapshot(Queue *, char *);
+// map the snapshot file and restore its entries at the end of the queue, then remove the file
+/* chunked entries get their chunks from the mapping(the queue's chunk store keeps it) */
+/* return the number of restored entries and -1 if there is no valid snapshot */
+int load_snapshot(Queue *, char *);
+
+#endif
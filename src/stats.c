@@ -0,0 +1,107 @@
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include "stats.h"
+
+// stage names in the dump
+static const char * stage_names[STATS_STAGES] = {"git_pull", "capture", "parse", "insert", "write", "git_push", "sync"};
+
+// bucket of the value
+static int bucket_index(uint64_t);
+// biggest value, that falls into the bucket
+static uint64_t bucket_value(int);
+
+void stats_init(Stats * stats, uint64_t now) {
+    memset(stats, 0, sizeof(Stats));
+    for(int i = 0; i < STATS_STAGES; i++)
+        stats->stages[i].min = UINT64_MAX;
+    stats->started = now;
+}
+
+void histogram_record(Histogram * histogram, uint64_t value) {
+    histogram->buckets[bucket_index(value)]++;
+    histogram->count++;
+    histogram->sum += value;
+    if(value < histogram->min) histogram->min = value;
+    if(value > histogram->max) histogram->max = value;
+}
+
+uint64_t histogram_percentile(Histogram * histogram, double fraction) {
+    uint64_t rank, seen = 0, value;
+    if(!histogram->count) return 0;
+    rank = (uint64_t) (fraction * histogram->count + 0.5);
+    if(rank < 1) rank = 1;
+    for(int i = 0; i < STATS_BUCKETS; i++)
+        if((seen += histogram->buckets[i]) >= rank) {
+            value = bucket_value(i);
+            return value < histogram->max ? value : histogram->max;
+        }
+    return histogram->max;
+}
+
+void stats_record(Stats * stats, int stage, uint64_t duration) {
+    histogram_record(&stats->stages[stage], duration);
+}
+
+void stats_listener(void * context, Queue * queue, int event, Item * item) {
+    Stats * stats = (Stats *) context;
+    if(event == QUEUE_INSERTED) stats->inserted++;
+    else if(event == QUEUE_MOVED) stats->moved++;
+    else if(event == QUEUE_EVICTED) stats->evicted++;
+}
+
+int stats_dump(Stats * stats, char * file_name, uint64_t now) {
+    char * tmp_file = (char *) malloc(strlen(file_name) + strlen(".tmp") + 1);
+    struct rusage usage;
+    Histogram * histogram;
+    FILE * fp;
+    int res = 1;
+    strcpy(tmp_file, file_name);
+    strcat(tmp_file, ".tmp");
+    if(!(fp = fopen(tmp_file, "w"))) {
+        free(tmp_file);
+        return 0;
+    }
+    getrusage(RUSAGE_SELF, &usage);
+    fprintf(fp, "{\n  \"uptime_ms\": %llu,\n", (unsigned long long) ((now - stats->started) / 1000000));
+    fprintf(fp, "  \"peak_rss_kb\": %ld,\n", usage.ru_maxrss);
+    fprintf(fp, "  \"captures\": %llu,\n  \"unchanged\": %llu,\n  \"inserted\": %llu,\n  \"moved\": %llu,\n  \"evicted\": %llu,\n  \"bytes_written\": %llu,\n",
+        (unsigned long long) stats->captures, (unsigned long long) stats->unchanged, (unsigned long long) stats->inserted,
+        (unsigned long long) stats->moved, (unsigned long long) stats->evicted, (unsigned long long) stats->bytes_written);
+    fprintf(fp, "  \"skipped\": %llu,\n  \"dropped\": %llu,\n  \"max_backlog\": %llu,\n  \"memory_bytes\": %llu,\n", (unsigned long long) stats->skipped,
+        (unsigned long long) stats->dropped, (unsigned long long) stats->max_backlog, (unsigned long long) stats->memory_bytes);
+    // latencies are in nanoseconds
+    fprintf(fp, "  \"stages\": {\n");
+    for(int i = 0; i < STATS_STAGES; i++) {
+        histogram = &stats->stages[i];
+        fprintf(fp, "    \"%s\": {\"count\": %llu, \"failures\": %llu, \"min\": %llu, \"mean\": %llu, \"p50\": %llu, \"p90\": %llu, \"p99\": %llu, \"p999\": %llu, \"max\": %llu}%s\n",
+            stage_names[i], (unsigned long long) histogram->count, (unsigned long long) stats->failures[i],
+            (unsigned long long) (histogram->count ? histogram->min : 0),
+            (unsigned long long) (histogram->count ? histogram->sum / histogram->count : 0),
+            (unsigned long long) histogram_percentile(histogram, 0.5), (unsigned long long) histogram_percentile(histogram, 0.9),
+            (unsigned long long) histogram_percentile(histogram, 0.99), (unsigned long long) histogram_percentile(histogram, 0.999),
+            (unsigned long long) histogram->max, i + 1 < STATS_STAGES ? "," : "");
+    }
+    fprintf(fp, "  }\n}\n");
+    if(fclose(fp) || rename(tmp_file, file_name)) {
+        unlink(tmp_file);
+        res = 0;
+    }
+    free(tmp_file);
+    return res;
+}
+
+static int bucket_index(uint64_t value) {
+    int exponent;
+    if(value < STATS_SUB_BUCKETS) return (int) value;
+    // position of the highest bit selects the group, the next STATS_SUB_BITS bits the bucket in it
+    exponent = 63 - __builtin_clzll(value);
+    return (exponent - STATS_SUB_BITS + 1) * STATS_SUB_BUCKETS + (int) ((value >> (exponent - STATS_SUB_BITS)) & (STATS_SUB_BUCKETS - 1));
+}
+
+static uint64_t bucket_value(int index) {
+    int shift;
+    if(index < STATS_SUB_BUCKETS) return (uint64_t) index;
+    shift = index / STATS_SUB_BUCKETS - 1;
+    return (((uint64_t) (STATS_SUB_BUCKETS + index % STATS_SUB_BUCKETS) << shift) - 1) + ((uint64_t) 1 << shift);
+}
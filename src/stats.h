@@ -0,0 +1,64 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "queue.h"
+
+#ifndef STATS_H
+#define STATS_H
+
+// histogram precision: every power of two is split into 2^STATS_SUB_BITS buckets(~6% error)
+#define STATS_SUB_BITS 4
+#define STATS_SUB_BUCKETS (1 << STATS_SUB_BITS)
+// enough buckets for any 64-bit value
+#define STATS_BUCKETS ((64 - STATS_SUB_BITS + 1) * STATS_SUB_BUCKETS)
+
+// stages of the daemon, that are timed
+#define STATS_GIT_PULL 0 // git pull script(spawn to exit)
+#define STATS_CAPTURE 1 // clipboard reader(spawn to exit)
+#define STATS_PARSE 2 // getting the clipboard contents out of the reader's output
+#define STATS_INSERT 3 // insert_item(with the journal append in journal mode)
+#define STATS_WRITE 4 // write_to_file
+#define STATS_GIT_PUSH 5 // git sync script(spawn to exit)
+#define STATS_SYNC 6 // fdatasync of the journal(one per SYNC_WINDOW_MS of changes, in journal mode)
+#define STATS_STAGES 7
+
+// log-linear(HDR style) latency histogram of nanosecond values
+/* bucket width grows with the value, so the relative error stays fixed */
+/* and recording is a couple of bit operations with no allocation */
+typedef struct _histogram {
+    uint64_t buckets[STATS_BUCKETS];
+    uint64_t count, sum, min, max;
+} Histogram;
+
+// counters and latencies of the daemon
+typedef struct _stats {
+    Histogram stages[STATS_STAGES];
+    uint64_t failures[STATS_STAGES]; // failed or timed out runs of the stage
+    uint64_t captures; // successful clipboard reads, that reached the index thread
+    uint64_t unchanged; // captures equal to the newest item
+    uint64_t inserted; // new items(queue events, so pulled history counts too)
+    uint64_t moved; // duplicates moved to the start of the queue
+    uint64_t evicted; // items dropped from the end of the queue
+    uint64_t bytes_written; // history file and journal bytes
+    uint64_t skipped; // captures identical to the previous one(dropped by the capture thread, not timed)
+    uint64_t dropped; // captures dropped, because the index thread was behind(its ring was full)
+    uint64_t max_backlog; // most captures, that were waiting for the index thread at once
+    uint64_t memory_bytes; // memory of the items, when the stats were dumped(see QUEUE_ITEM_OVERHEAD)
+    uint64_t started; // CLOCK_MONOTONIC nanoseconds at stats_init
+} Stats;
+
+// reset all counters and histograms
+void stats_init(Stats *, uint64_t);
+// add a value to the histogram
+void histogram_record(Histogram *, uint64_t);
+// get the value, that the given fraction(0..1) of the recorded values doesn't exceed
+uint64_t histogram_percentile(Histogram *, double);
+// add the duration of one run of the stage
+void stats_record(Stats *, int, uint64_t);
+// queue listener, that counts inserted, moved and evicted items
+void stats_listener(void *, Queue *, int, Item *);
+// write all stats as one JSON object(written aside and renamed, so readers never see half of it)
+/* the current time is needed for the uptime, return 1 on success and 0 otherwise */
+int stats_dump(Stats *, char *, uint64_t);
+
+#endif
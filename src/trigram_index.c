@@ -0,0 +1,350 @@
+#include <string.h>
+#include "trigram_index.h"
+
+// postings lists and entries in one slab of their pools
+#define POSTINGS_PER_SLAB 1024
+#define ENTRIES_PER_SLAB 256
+// serials, that a new postings list has room for
+#define POSTINGS_INITIAL_CAPACITY 2
+// first code point above Unicode(invalid bytes are mapped past it)
+#define INVALID_CODE_POINT 0x110000
+
+// index the item(flag_misplaced: it wasn't linked at the start of the queue)
+static void add_entry(TrigramIndex *, Item *, int);
+// forget the item(its serials stay in the postings until the compaction)
+static void remove_entry(TrigramIndex *, Item *);
+// drop the serials of the evicted entries and the empty postings lists
+static void compact(TrigramIndex *);
+// add the serial to the postings list of the trigram
+static void add_posting(TrigramIndex *, Trigram, unsigned long long);
+// find the postings list of the trigram(NULL if no item has it)
+static TrigramPostings * find_postings(TrigramIndex *, Trigram);
+// move the cursor down to the serial(return 1 if the list has it)
+/* the serials are looked up in descending order, so the cursor only goes down */
+static int seek_serial(TrigramPostings *, size_t *, unsigned long long);
+// put the distinct trigrams of len bytes of str into index->trigrams(return their number)
+static size_t extract(TrigramIndex *, const char *, size_t);
+// decode one UTF-8 sequence(return its length, invalid bytes are decoded one by one)
+static size_t decode(const unsigned char *, size_t, unsigned int *);
+// cut the incomplete characters off both ends of the query
+static void trim_to_characters(const char **, size_t *);
+// the item contains the query
+static int item_matches(Item *, const char *, size_t);
+// add the item to the results, that are kept newest first(return the new number of results)
+static int offer(Item **, int, int, Item *);
+// the first item is more recent than the second one(the order of the queue)
+static int newer(const Item *, const Item *);
+// compare functions for the hash indexes
+static int postings_equal(const void *, const char *, size_t);
+static int serial_equal(const void *, const char *, size_t);
+static int item_equal(const void *, const char *, size_t);
+// compare function for qsort
+static int compare_trigrams(const void *, const void *);
+
+void trigram_index_init(TrigramIndex * index, Queue * queue) {
+    index->postings = hash_index_create(1024, &postings_equal);
+    index->by_serial = hash_index_create(queue->capacity, &serial_equal);
+    index->by_item = hash_index_create(queue->capacity, &item_equal);
+    pool_init(&index->postings_pool, sizeof(TrigramPostings), POSTINGS_PER_SLAB);
+    pool_init(&index->entries_pool, sizeof(TrigramEntry), ENTRIES_PER_SLAB);
+    index->long_entries = NULL;
+    index->next_serial = 1;
+    index->live_postings = index->dead_postings = 0;
+    index->misplaced = 0;
+    index->trigrams = NULL;
+    index->trigrams_size = 0;
+    index->lists = NULL;
+    index->cursors = NULL;
+    index->lists_size = 0;
+    // an empty queue is indexed already
+    index->flag_built = !queue->start;
+}
+
+void trigram_index_listener(void * context, Queue * queue, int event, Item * item) {
+    TrigramIndex * index = (TrigramIndex *) context;
+    if(!index->flag_built) return;
+    if(event == QUEUE_EVICTED || event == QUEUE_MOVED)
+        remove_entry(index, item);
+    // a moved item is indexed again, so that it gets the newest serial
+    if(event == QUEUE_INSERTED || event == QUEUE_MOVED)
+        add_entry(index, item, item != queue->start);
+    if(index->dead_postings > TRIGRAM_COMPACT_MIN_DEAD && index->dead_postings > index->live_postings * TRIGRAM_COMPACT_RATIO)
+        compact(index);
+}
+
+int trigram_search(TrigramIndex * index, Queue * queue, const char * query, size_t len, Item ** results, int max_results) {
+    const char * core = query;
+    size_t core_len = len, count, i, j;
+    TrigramPostings * postings, * shortest;
+    TrigramEntry * entry;
+    Item * item;
+    unsigned long long serial;
+    int found = 0;
+    if(!len || max_results < 1) return 0;
+    if(!index->flag_built) {
+        // from the oldest item, so that serials follow the queue order
+        for(item = queue->end; item; item = item->prev)
+            add_entry(index, item, 0);
+        index->flag_built = 1;
+    }
+    // the query may start or end in the middle of a character, but its trigrams can't
+    trim_to_characters(&core, &core_len);
+    if(!(count = extract(index, core, core_len))) {
+        // too short for a trigram: the queue is already newest first, so stop at max_results
+        for(item = queue->start; item && found < max_results; item = item->next)
+            if(item_matches(item, query, len))
+                results[found++] = item;
+        return found;
+    }
+    if(count > index->lists_size) {
+        index->lists_size = count;
+        index->lists = (TrigramPostings **) realloc(index->lists, count * sizeof(TrigramPostings *));
+        index->cursors = (size_t *) realloc(index->cursors, count * sizeof(size_t));
+    }
+    // every trigram of the query has to be there, the rarest one gives the candidates,-
+    // and the other lists are checked from the shortest one, so that most candidates fail early
+    for(i = 0; i < count; i++) {
+        if(!(postings = find_postings(index, index->trigrams[i]))) break;
+        for(j = i; j > 0 && index->lists[j - 1]->count > postings->count; j--)
+            index->lists[j] = index->lists[j - 1];
+        index->lists[j] = postings;
+    }
+    if(i == count) {
+        shortest = index->lists[0];
+        for(i = 1; i < count; i++)
+            index->cursors[i] = index->lists[i]->count;
+        // newest serials first, with no misplaced entries the first matches are the newest ones
+        for(j = shortest->count; j-- > 0 && (index->misplaced || found < max_results); ) {
+            serial = shortest->serials[j];
+            for(i = 1; i < count && seek_serial(index->lists[i], &index->cursors[i], serial); i++);
+            if(i < count) continue;
+            // dead serials wait for the compaction
+            if(!(entry = (TrigramEntry *) hash_index_find(index->by_serial, (char *) &serial, sizeof(serial), serial))) continue;
+            if(item_matches(entry->item, query, len))
+                found = offer(results, found, max_results, entry->item);
+        }
+    }
+    for(entry = index->long_entries; entry; entry = entry->next)
+        if(item_matches(entry->item, query, len))
+            found = offer(results, found, max_results, entry->item);
+    return found;
+}
+
+void trigram_index_free(TrigramIndex * index) {
+    TrigramPostings * postings;
+    for(size_t i = 0; i < index->postings->capacity; i++)
+        if((postings = (TrigramPostings *) index->postings->slots[i].value))
+            free(postings->serials);
+    hash_index_free(index->postings);
+    hash_index_free(index->by_serial);
+    hash_index_free(index->by_item);
+    pool_destroy(&index->postings_pool);
+    pool_destroy(&index->entries_pool);
+    free(index->trigrams);
+    free(index->lists);
+    free(index->cursors);
+    index->postings = index->by_serial = index->by_item = NULL;
+    index->trigrams = NULL;
+    index->lists = NULL;
+    index->cursors = NULL;
+}
+
+static void add_entry(TrigramIndex * index, Item * item, int flag_misplaced) {
+    TrigramEntry * entry = (TrigramEntry *) pool_alloc(&index->entries_pool);
+    entry->item = item;
+    entry->serial = index->next_serial++;
+    entry->flag_misplaced = flag_misplaced;
+    index->misplaced += flag_misplaced;
+    entry->prev = entry->next = NULL;
+    if(!ITEM_IS_TEXT(item->type)) {
+        // images and other binary payloads are never found by text, so they are in no list at all
+        entry->trigrams = 0;
+    } else if(item->len > TRIGRAM_MAX_INDEXED_LEN || item->chunks) {
+        entry->trigrams = 0;
+        entry->next = index->long_entries;
+        if(index->long_entries) index->long_entries->prev = entry;
+        index->long_entries = entry;
+    } else {
+        // serials only grow, so appending keeps every postings list sorted
+        entry->trigrams = extract(index, item->elem, item->len);
+        for(size_t i = 0; i < entry->trigrams; i++)
+            add_posting(index, index->trigrams[i], entry->serial);
+        index->live_postings += entry->trigrams;
+    }
+    hash_index_insert(index->by_serial, entry, sizeof(entry->serial), entry->serial);
+    hash_index_insert(index->by_item, entry, sizeof(item), hash_bytes((char *) &item, sizeof(item)));
+}
+
+static void remove_entry(TrigramIndex * index, Item * item) {
+    unsigned long long hash = hash_bytes((char *) &item, sizeof(item));
+    TrigramEntry * entry = (TrigramEntry *) hash_index_find(index->by_item, (char *) &item, sizeof(item), hash);
+    if(!entry) return;
+    hash_index_remove(index->by_item, entry, hash);
+    hash_index_remove(index->by_serial, entry, entry->serial);
+    // the item may have been chunked since it was added, so the list itself tells where it is
+    if(entry->prev || index->long_entries == entry) {
+        if(entry->prev) entry->prev->next = entry->next;
+        else index->long_entries = entry->next;
+        if(entry->next) entry->next->prev = entry->prev;
+    }
+    index->live_postings -= entry->trigrams;
+    index->dead_postings += entry->trigrams;
+    index->misplaced -= entry->flag_misplaced;
+    pool_free(&index->entries_pool, entry);
+}
+
+static void compact(TrigramIndex * index) {
+    HashIndex * old_postings = index->postings;
+    TrigramPostings * postings;
+    size_t live;
+    // the lists are moved into a new table, so that the emptied ones don't have to be removed one by one
+    index->postings = hash_index_create(old_postings->size / 2, &postings_equal);
+    for(size_t i = 0; i < old_postings->capacity; i++) {
+        if(!(postings = (TrigramPostings *) old_postings->slots[i].value)) continue;
+        live = 0;
+        for(size_t j = 0; j < postings->count; j++)
+            if(hash_index_find(index->by_serial, (char *) &postings->serials[j], sizeof(unsigned long long), postings->serials[j]))
+                postings->serials[live++] = postings->serials[j];
+        if(!(postings->count = live)) {
+            free(postings->serials);
+            pool_free(&index->postings_pool, postings);
+        } else hash_index_insert(index->postings, postings, sizeof(Trigram), old_postings->slots[i].hash);
+    }
+    hash_index_free(old_postings);
+    index->dead_postings = 0;
+}
+
+static void add_posting(TrigramIndex * index, Trigram trigram, unsigned long long serial) {
+    TrigramPostings * postings = find_postings(index, trigram);
+    if(!postings) {
+        postings = (TrigramPostings *) pool_alloc(&index->postings_pool);
+        postings->trigram = trigram;
+        postings->count = 0;
+        postings->capacity = POSTINGS_INITIAL_CAPACITY;
+        postings->serials = (unsigned long long *) malloc(postings->capacity * sizeof(unsigned long long));
+        hash_index_insert(index->postings, postings, sizeof(Trigram), hash_bytes((char *) &trigram, sizeof(Trigram)));
+    } else if(postings->count == postings->capacity) {
+        postings->capacity *= 2;
+        postings->serials = (unsigned long long *) realloc(postings->serials, postings->capacity * sizeof(unsigned long long));
+    }
+    postings->serials[postings->count++] = serial;
+}
+
+static TrigramPostings * find_postings(TrigramIndex * index, Trigram trigram) {
+    return (TrigramPostings *) hash_index_find(index->postings, (char *) &trigram, sizeof(Trigram), hash_bytes((char *) &trigram, sizeof(Trigram)));
+}
+
+static int seek_serial(TrigramPostings * postings, size_t * cursor, unsigned long long serial) {
+    size_t low, high = *cursor, step = 1, middle;
+    // gallop down to a range, that ends above the serial, then search it in halves
+    while(step <= high && postings->serials[high - step] > serial) {
+        high -= step;
+        step *= 2;
+    }
+    low = step <= high ? high - step : 0;
+    // the answer is the first serial in [low, high), that is greater than the serial
+    while(low < high) {
+        middle = low + (high - low) / 2;
+        if(postings->serials[middle] > serial) high = middle;
+        else low = middle + 1;
+    }
+    *cursor = low;
+    return low > 0 && postings->serials[low - 1] == serial;
+}
+
+static size_t extract(TrigramIndex * index, const char * str, size_t len) {
+    const unsigned char * p = (const unsigned char *) str, * end = p + len;
+    unsigned int a = 0, b = 0, c;
+    size_t count = 0, distinct = 0, decoded = 0;
+    // a string has at most len - 2 trigrams
+    if(len < 3) return 0;
+    if(len - 2 > index->trigrams_size) {
+        index->trigrams_size = len - 2;
+        index->trigrams = (Trigram *) realloc(index->trigrams, index->trigrams_size * sizeof(Trigram));
+    }
+    while(p < end) {
+        p += decode(p, end - p, &c);
+        if(++decoded >= 3)
+            index->trigrams[count++] = ((Trigram) a << 42) | ((Trigram) b << 21) | c;
+        a = b;
+        b = c;
+    }
+    if(!count) return 0;
+    qsort(index->trigrams, count, sizeof(Trigram), &compare_trigrams);
+    for(size_t i = 0; i < count; i++)
+        if(!distinct || index->trigrams[i] != index->trigrams[distinct - 1])
+            index->trigrams[distinct++] = index->trigrams[i];
+    return distinct;
+}
+
+static size_t decode(const unsigned char * p, size_t left, unsigned int * code_point) {
+    size_t len = p[0] < 0x80 ? 1 : (p[0] >> 5) == 0x6 ? 2 : (p[0] >> 4) == 0xe ? 3 : (p[0] >> 3) == 0x1e ? 4 : 0;
+    unsigned int value = len == 1 ? p[0] : len == 2 ? (p[0] & 0x1f) : len == 3 ? (p[0] & 0xf) : (p[0] & 0x7);
+    if(len && len <= left) {
+        for(size_t i = 1; i < len; i++) {
+            if((p[i] & 0xc0) != 0x80) {
+                len = 0;
+                break;
+            }
+            value = (value << 6) | (p[i] & 0x3f);
+        }
+        if(len) {
+            *code_point = value;
+            return len;
+        }
+    }
+    *code_point = INVALID_CODE_POINT + p[0];
+    return 1;
+}
+
+static void trim_to_characters(const char ** str, size_t * len) {
+    const unsigned char * p = (const unsigned char *) *str;
+    size_t start = 0, last;
+    unsigned int code_point;
+    // continuation bytes at the start belong to a character, that began before the query
+    while(start < *len && start < 3 && (p[start] & 0xc0) == 0x80)
+        start++;
+    // a character at the end, that misses some of its continuation bytes
+    for(last = *len; last > start && *len - last < 3 && (p[last - 1] & 0xc0) == 0x80; last--);
+    if(last > start && p[last - 1] >= 0xc0 && decode(p + last - 1, *len - last + 1, &code_point) == 1)
+        *len = last - 1;
+    *str += start;
+    *len = *len > start ? *len - start : 0;
+}
+
+static int item_matches(Item * item, const char * query, size_t len) {
+    return ITEM_IS_TEXT(item->type) && item_contains(item, query, len);
+}
+
+static int offer(Item ** results, int found, int max_results, Item * item) {
+    int i;
+    if(found == max_results && !newer(item, results[found - 1])) return found;
+    if(found < max_results) found++;
+    for(i = found - 1; i > 0 && newer(item, results[i - 1]); i--)
+        results[i] = results[i - 1];
+    results[i] = item;
+    return found;
+}
+
+static int newer(const Item * a, const Item * b) {
+    if(a->time != b->time) return a->time > b->time;
+    if(a->seq != b->seq) return a->seq > b->seq;
+    return a->device > b->device;
+}
+
+static int postings_equal(const void * value, const char * key, size_t len) {
+    return ((const TrigramPostings *) value)->trigram == *(const Trigram *) key;
+}
+
+static int serial_equal(const void * value, const char * key, size_t len) {
+    return ((const TrigramEntry *) value)->serial == *(const unsigned long long *) key;
+}
+
+static int item_equal(const void * value, const char * key, size_t len) {
+    return ((const TrigramEntry *) value)->item == *(Item * const *) key;
+}
+
+static int compare_trigrams(const void * a, const void * b) {
+    Trigram arg1 = *(const Trigram *) a, arg2 = *(const Trigram *) b;
+    return (arg1 > arg2) - (arg1 < arg2);
+}
@@ -0,0 +1,77 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "queue.h"
+#include "hash_index.h"
+#include "pool.h"
+
+#ifndef TRIGRAM_INDEX_H
+#define TRIGRAM_INDEX_H
+
+// longer(and chunked) items are not indexed, every query checks them directly
+/* binary items(see ITEM_IS_TEXT) are not searched at all */
+#define TRIGRAM_MAX_INDEXED_LEN (64 * 1024)
+// compact the postings once dead serials take more than this many slots...
+#define TRIGRAM_COMPACT_MIN_DEAD 65536
+// ...and more than live serials do
+#define TRIGRAM_COMPACT_RATIO 1
+
+// three UTF-8 code points(21 bits each), bytes that aren't valid UTF-8 get code points above Unicode
+typedef unsigned long long Trigram;
+
+// postings list: entries, that contain the trigram
+typedef struct _trigram_postings {
+    Trigram trigram;
+    unsigned long long * serials; // serials of the entries in ascending order(some may be dead)
+    size_t count, capacity;
+} TrigramPostings;
+
+// indexed item
+/* postings hold serials instead of items, because the pool hands evicted items out again */
+typedef struct _trigram_entry {
+    Item * item;
+    unsigned long long serial; // never reused, so it can stay in the postings after the eviction
+    size_t trigrams; // number of postings lists of the entry(0 if the item is too long to be indexed)
+    int flag_misplaced; // the item wasn't linked at the start of the queue, so its serial isn't its recency
+    struct _trigram_entry * prev, * next; // entries of the long items
+} TrigramEntry;
+
+// inverted index of the trigrams of the items, that is kept up to date by the queue events
+/* a query looks up its trigrams, walks the shortest postings list and gallops through the other */
+/* lists, so it costs O(rarest trigram), not O(items); the candidates are confirmed */
+/* with memmem, so the result is exact; evicted entries leave dead serials behind, that are */
+/* dropped by an occasional compaction */
+/* an item gets a new serial whenever it becomes the start of the queue, so unless something */
+/* was linked elsewhere(merged history), the newest serials are the newest items, and a query */
+/* walks them down and stops as soon as it has enough results */
+typedef struct _trigram_index {
+    HashIndex * postings; // TrigramPostings by trigram
+    HashIndex * by_serial; // live TrigramEntry by serial
+    HashIndex * by_item; // live TrigramEntry by item
+    Pool postings_pool, entries_pool;
+    TrigramEntry * long_entries; // entries of the items longer than TRIGRAM_MAX_INDEXED_LEN
+    unsigned long long next_serial;
+    size_t live_postings, dead_postings; // serials of live and of evicted entries in the postings
+    size_t misplaced; // live entries with flag_misplaced(queries rank all matches while there are any)
+    Trigram * trigrams; // distinct trigrams of one item or query
+    size_t trigrams_size;
+    TrigramPostings ** lists; // postings lists of one query
+    size_t * cursors; // how much of each list is still ahead of the query(serials below the cursor)
+    size_t lists_size;
+    int flag_built; // the items of the queue are indexed(see trigram_index_init)
+} TrigramIndex;
+
+// initialize the index of the items of the queue
+/* items, that are already in the queue(e.g. a restored snapshot), are indexed by the first query, */
+/* so that a start doesn't read every payload; until then the queue events are ignored */
+void trigram_index_init(TrigramIndex *, Queue *);
+// queue listener, that indexes inserted and moved items and forgets evicted ones
+void trigram_index_listener(void *, Queue *, int, Item *);
+// find the items, that contain len bytes of the query, most recent first
+/* arguments: index, its queue, query, len, array for the results and its size */
+/* queries shorter than three characters scan the queue instead(they match a lot anyway) */
+/* return the number of items put into the array */
+int trigram_search(TrigramIndex *, Queue *, const char *, size_t, Item **, int);
+// free the index(the items are not touched)
+void trigram_index_free(TrigramIndex *);
+
+#endif
@@ -0,0 +1,67 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../src/history.h"
+
+/* loads a text history of the old format("NN:" headers without stamps, like the shipped */
+/* Resources/clipboard_history.txt) and checks, that every record is an item of its own: */
+/*   - the time tree has a node for every item, so positions and indexes work(LIST, GET) */
+/*   - the items are in the order of the file, newest first */
+/*   - reading the same file again(as after a pull) adds nothing */
+/* usage: history_test.out HISTORY_FILE, the exit code is the number of failed checks */
+
+static int failures = 0;
+
+// report the check, if it failed
+static void check(int flag_ok, const char * what) {
+    if(flag_ok) return;
+    printf("FAILED: %s\n", what);
+    failures++;
+}
+
+int main(int argc, char ** argv) {
+    Queue queue;
+    HistoryFile history;
+    Backing * map;
+    HistoryRecord record;
+    Item * item;
+    size_t offset = 0, len = 0;
+    int records = 0, flag_order = 1, flag_index = 1;
+    char * first = NULL;
+    if(argc < 2 || !(map = map_history(argv[1]))) {
+        fprintf(stderr, "usage: %s HISTORY_FILE\n", argv[0]);
+        return 1;
+    }
+    // the records of the file, and the newest one
+    while(next_history_record(map, &offset, &record)) {
+        if(!records) {
+            first = (char *) malloc(record.len);
+            len = unescape_record(&record, first);
+        }
+        records++;
+    }
+    queue_init(&queue, records + 10);
+    history_file_init(&history, argv[1]);
+    read_clip_history(&queue, &history);
+    check(queue.size == records, "every record is in the queue");
+    check(tree_size(queue.by_time) == queue.size, "every item is in the time tree");
+    for(int i = 0; i < queue.size; i++) {
+        item = find_nth_item(&queue, i);
+        if(!item || item_index(&queue, item) != i) flag_index = 0;
+        // the stamps are distinct and fall newest first
+        if(item && item->next && item->seq <= item->next->seq) flag_order = 0;
+    }
+    check(flag_index, "find_nth_item and item_index agree on every position");
+    check(flag_order, "the items are stamped in the file order");
+    check(queue.start && first && queue.start->len == len && !memcmp(item_piece(queue.start, 0, &(size_t) {0}), first, len),
+        "the newest record is the start of the queue");
+    // a changed file is read again in full(it has no version vector)
+    history_file_init(&history, argv[1]);
+    read_clip_history(&queue, &history);
+    check(queue.size == records && tree_size(queue.by_time) == queue.size, "reading the file again adds nothing");
+    printf("%d records, %d failed checks\n", records, failures);
+    free(first);
+    free_only_queue(&queue);
+    map->release_func(map);
+    return failures;
+}